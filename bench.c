@@ -0,0 +1,1430 @@
+/* Benchmarks comparing alternative ways to get the same queue */
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Our program needs to use regular malloc/free */
+#define INTERNAL 1
+#include "harness.h"
+
+#include "bench.h"
+#include "bqueue.h"
+#include "console.h"
+#include "cqueue.h"
+#include "pqueue.h"
+#include "queue.h"
+#include "report.h"
+#include "shqueue.h"
+#include "wal.h"
+#include "wsdeque.h"
+
+#define BENCH_STRLEN 16
+
+static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
+
+/* Fill n buffers of BENCH_STRLEN bytes with random strings */
+static void bench_strings(char *buf, int n)
+{
+    for (int i = 0; i < n; i++) {
+        char *s = buf + (size_t) i * BENCH_STRLEN;
+        int len = 5 + rand() % (BENCH_STRLEN - 6);
+        for (int j = 0; j < len; j++)
+            s[j] = charset[rand() % (sizeof charset - 1)];
+        s[len] = '\0';
+    }
+}
+
+/* Return whether both queues hold the same strings in the same order */
+static bool bench_same(queue_t *a, queue_t *b)
+{
+    list_ele_t *x = a->head, *y = b->head;
+    for (; x && y; x = x->next, y = y->next)
+        if (strcmp(x->value, y->value))
+            return false;
+    return !x && !y;
+}
+
+/*
+ * Keep a queue sorted while n random strings arrive in batches, either by
+ * q_insert_sorted on each string, or by q_insert_tail on each string and
+ * q_sort after each batch.
+ */
+static bool bench_sorted(int n, int batch)
+{
+    char *strs = malloc((size_t) n * BENCH_STRLEN);
+    if (!strs) {
+        report(1, "ERROR: Could not allocate %d strings", n);
+        return false;
+    }
+    bench_strings(strs, n);
+
+    bool ok = true;
+    double t, t_sorted = 0, t_sort = 0;
+    queue_t *qs = NULL, *qt = NULL;
+    set_cautious_mode(false);
+    if (exception_setup(false)) {
+        qs = q_new();
+        qt = q_new();
+        ok = qs && qt;
+
+        init_time(&t);
+        for (int i = 0; ok && i < n; i++)
+            ok = q_insert_sorted(qs, strs + (size_t) i * BENCH_STRLEN);
+        t_sorted = delta_time(&t);
+
+        for (int i = 0; ok && i < n; i += batch) {
+            for (int j = i; ok && j < n && j < i + batch; j++)
+                ok = q_insert_tail(qt, strs + (size_t) j * BENCH_STRLEN);
+            q_sort(qt);
+        }
+        t_sort = delta_time(&t);
+
+        if (!ok)
+            report(1, "ERROR: Insertion failed");
+        else if (!bench_same(qs, qt)) {
+            report(1, "ERROR: Sorted queues differ");
+            ok = false;
+        }
+    }
+    exception_cancel();
+    if (exception_setup(false)) {
+        q_free(qs);
+        q_free(qt);
+    }
+    exception_cancel();
+    set_cautious_mode(true);
+    free(strs);
+
+    if (ok) {
+        report(1, "insert sorted:      %.3f s", t_sorted);
+        report(1, "insert, sort every %d: %.3f s", batch, t_sort);
+    }
+    return ok && !error_check();
+}
+
+/* Touch each string of a queue, as a traversal would */
+static void bench_touch(const char *s, void *arg)
+{
+    *(size_t *) arg += (unsigned char) s[0];
+}
+
+/* Return the time taken by q_foreach over queue q */
+static double bench_traverse(queue_t *q)
+{
+    size_t sum = 0;
+    double t;
+    init_time(&t);
+    q_foreach(q, bench_touch, &sum);
+    return delta_time(&t);
+}
+
+/*
+ * Time traversals of a queue of n random strings after q_sort scattered its
+ * elements, and again after q_defrag.
+ */
+static bool bench_defrag(int n)
+{
+    char buf[BENCH_STRLEN];
+    bool ok = true;
+    double sorted = 0, defragged = 0;
+    queue_t *q = NULL;
+    set_cautious_mode(false);
+    if (exception_setup(false)) {
+        q = q_new();
+        ok = q != NULL;
+        for (int i = 0; ok && i < n; i++) {
+            bench_strings(buf, 1);
+            ok = q_insert_tail(q, buf);
+        }
+        if (ok) {
+            q_sort(q);
+            sorted = bench_traverse(q);
+            ok = q_defrag(q);
+            defragged = bench_traverse(q);
+        }
+        if (!ok)
+            report(1, "ERROR: Could not allocate space");
+        q_free(q);
+    }
+    exception_cancel();
+    set_cautious_mode(true);
+
+    if (ok) {
+        report(1, "traverse after sort:   %.3f s", sorted);
+        report(1, "traverse after defrag: %.3f s", defragged);
+    }
+    return ok && !error_check();
+}
+
+/*
+ * Compare memory use and speed of queue_t and cqueue_t holding the same n
+ * random strings, inserted at both ends, sorted, reversed and then drained
+ * from the head.
+ */
+static bool bench_pool(int n)
+{
+    char *strs = malloc((size_t) n * BENCH_STRLEN);
+    if (!strs) {
+        report(1, "ERROR: Could not allocate %d strings", n);
+        return false;
+    }
+    bench_strings(strs, n);
+
+    bool ok = true;
+    size_t bytes[2] = {0, 0}, blocks[2] = {0, 0};
+    double times[2] = {0, 0};
+    queue_t *q = NULL;
+    cqueue_t *cq = NULL;
+    char a[BENCH_STRLEN], b[BENCH_STRLEN];
+    set_cautious_mode(false);
+    if (exception_setup(false)) {
+        double t;
+        size_t base_bytes = allocation_bytes(), base_blocks = allocation_check();
+        init_time(&t);
+        q = q_new();
+        ok = q != NULL;
+        for (int i = 0; ok && i < n; i++) {
+            char *s = strs + (size_t) i * BENCH_STRLEN;
+            ok = i % 2 ? q_insert_head(q, s) : q_insert_tail(q, s);
+        }
+        bytes[0] = allocation_bytes() - base_bytes;
+        blocks[0] = allocation_check() - base_blocks;
+        if (ok)
+            q_sort(q);
+        times[0] = delta_time(&t);
+
+        base_bytes = allocation_bytes();
+        base_blocks = allocation_check();
+        cq = cq_new();
+        ok = ok && cq != NULL;
+        for (int i = 0; ok && i < n; i++) {
+            char *s = strs + (size_t) i * BENCH_STRLEN;
+            ok = i % 2 ? cq_insert_head(cq, s) : cq_insert_tail(cq, s);
+        }
+        bytes[1] = allocation_bytes() - base_bytes;
+        blocks[1] = allocation_check() - base_blocks;
+        if (ok)
+            cq_sort(cq);
+        times[1] = delta_time(&t);
+
+        if (!ok)
+            report(1, "ERROR: Could not allocate space");
+        if (ok && cq_memory(cq) != bytes[1]) {
+            report(1, "ERROR: cqueue_t reports %zu bytes, allocated %zu",
+                   cq_memory(cq), bytes[1]);
+            ok = false;
+        }
+        q_reverse(q);
+        cq_reverse(cq);
+        while (ok && q_remove_head(q, a, sizeof(a))) {
+            if (!cq_remove_head(cq, b, sizeof(b)) || strcmp(a, b)) {
+                report(1, "ERROR: Queues differ");
+                ok = false;
+            }
+        }
+        if (ok && cq_size(cq)) {
+            report(1, "ERROR: Queues differ in size");
+            ok = false;
+        }
+        q_free(q);
+        cq_free(cq);
+    }
+    exception_cancel();
+    set_cautious_mode(true);
+    free(strs);
+
+    /* glibc malloc adds at least 8 bytes to each block, rounding to 16 */
+    for (int i = 0; ok && i < 2; i++) {
+        report(1,
+               "%s %.1f bytes in %.2f blocks per element, %.1f with malloc "
+               "headers, %.3f s to fill and sort",
+               i ? "cqueue_t:" : "queue_t: ", (double) bytes[i] / n,
+               (double) blocks[i] / n, (double) (bytes[i] + 16 * blocks[i]) / n,
+               times[i]);
+    }
+    return ok && !error_check();
+}
+
+/*
+ * Time q_reverse, q_sort and q_free on a queue of n random strings scattered
+ * by q_sort, without prefetching and with the current prefetch distance.
+ */
+static bool bench_prefetch(int n)
+{
+    char *strs = malloc((size_t) n * BENCH_STRLEN);
+    if (!strs) {
+        report(1, "ERROR: Could not allocate %d strings", n);
+        return false;
+    }
+    bench_strings(strs, n);
+
+    bool ok = true;
+    int distance = prefetch_distance;
+    double times[2][3];
+    set_cautious_mode(false);
+    for (int pass = 0; ok && pass < 2; pass++) {
+        prefetch_distance = distance;
+        if (exception_setup(false)) {
+            queue_t *q = q_new();
+            ok = q != NULL;
+            for (int i = 0; ok && i < n; i++)
+                ok = q_insert_tail(q, strs + (size_t) i * BENCH_STRLEN);
+            if (!ok)
+                report(1, "ERROR: Could not allocate space");
+            q_sort(q);
+
+            double t;
+            prefetch_distance = pass ? distance : 0;
+            init_time(&t);
+            q_reverse(q);
+            times[pass][0] = delta_time(&t);
+            q_sort(q);
+            times[pass][1] = delta_time(&t);
+            q_free(q);
+            times[pass][2] = delta_time(&t);
+        }
+        exception_cancel();
+    }
+    prefetch_distance = distance;
+    set_cautious_mode(true);
+    free(strs);
+
+    static const char *names[] = {"reverse:", "sort:   ", "free:   "};
+    for (int i = 0; ok && i < 3; i++)
+        report(1, "%s %.3f s without prefetch, %.3f s prefetching %d ahead",
+               names[i], times[0][i], times[1][i], distance);
+    return ok && !error_check();
+}
+
+/*
+ * Combine k sorted queues of n random strings each, either by q_merge_sorted,
+ * or by relinking them one after another and calling q_sort.
+ */
+static bool bench_merge(int k, int n)
+{
+    size_t total = (size_t) k * n;
+    char *strs = malloc(total * BENCH_STRLEN);
+    queue_t **qs = calloc(2 * (size_t) k, sizeof(queue_t *));
+    if (!strs || !qs) {
+        report(1, "ERROR: Could not allocate %lu strings", total);
+        free(strs);
+        free(qs);
+        return false;
+    }
+    bench_strings(strs, total);
+
+    bool ok = true;
+    double t_merge = 0, t_sort = 0;
+    set_cautious_mode(false);
+    if (exception_setup(false)) {
+        /* Shards qs[0..k) get merged, qs[k..2k) the same strings get sorted */
+        for (int i = 0; ok && i < 2 * k; i++) {
+            ok = (qs[i] = q_new()) != NULL;
+            char *s = strs + (size_t)(i % k) * n * BENCH_STRLEN;
+            for (int j = 0; ok && j < n; j++, s += BENCH_STRLEN)
+                ok = q_insert_tail(qs[i], s);
+            if (ok && i < k)
+                q_sort(qs[i]);
+        }
+        if (!ok)
+            report(1, "ERROR: Could not allocate space");
+
+        if (ok) {
+            init_time(&t_merge);
+            ok = q_merge_sorted(qs, k);
+            t_merge = delta_time(&t_merge);
+            if (!ok)
+                report(1, "ERROR: Merge failed");
+        }
+
+        if (ok) {
+            queue_t *dst = qs[k];
+            init_time(&t_sort);
+            for (int i = k + 1; i < 2 * k; i++) {
+                queue_t *src = qs[i];
+                if (!src->head)
+                    continue;
+                if (dst->tail)
+                    dst->tail->next = src->head;
+                else
+                    dst->head = src->head;
+                dst->tail = src->tail;
+                dst->size += src->size;
+                src->head = src->tail = NULL;
+                src->size = 0;
+            }
+            q_sort(dst);
+            t_sort = delta_time(&t_sort);
+
+            if (!bench_same(qs[0], dst)) {
+                report(1, "ERROR: Merged and sorted queues differ");
+                ok = false;
+            }
+        }
+    } else
+        ok = false;
+    exception_cancel();
+    for (int i = 0; i < 2 * k; i++)
+        q_free(qs[i]);
+    set_cautious_mode(true);
+    free(qs);
+    free(strs);
+
+    if (ok)
+        report(1,
+               "%d queues of %d elements: merge %.3f s, concatenate and "
+               "sort %.3f s",
+               k, n, t_merge, t_sort);
+    return ok && !error_check();
+}
+
+/*
+ * Take n random strings out in ascending order, either from a priority queue
+ * they went into, or from a queue they got inserted at the tail of and which
+ * q_sort sorted.
+ */
+static bool bench_pq(int n)
+{
+    char *strs = malloc((size_t) n * BENCH_STRLEN);
+    char *out = malloc((size_t) n * BENCH_STRLEN);
+    if (!strs || !out) {
+        report(1, "ERROR: Could not allocate %d strings", n);
+        free(strs);
+        free(out);
+        return false;
+    }
+    bench_strings(strs, n);
+
+    bool ok = true;
+    double t, t_pq[2] = {0, 0}, t_sort[2] = {0, 0};
+    char buf[BENCH_STRLEN];
+    set_cautious_mode(false);
+    if (exception_setup(false)) {
+        pqueue_t *pq = pq_new();
+        ok = pq != NULL;
+        init_time(&t);
+        for (int i = 0; ok && i < n; i++)
+            ok = pq_insert(pq, strs + (size_t) i * BENCH_STRLEN);
+        t_pq[0] = delta_time(&t);
+        for (int i = 0; ok && i < n; i++)
+            ok = pq_remove_min(pq, out + (size_t) i * BENCH_STRLEN,
+                               BENCH_STRLEN);
+        t_pq[1] = delta_time(&t);
+        pq_free(pq);
+
+        queue_t *q = ok ? q_new() : NULL;
+        ok = q != NULL;
+        init_time(&t);
+        for (int i = 0; ok && i < n; i++)
+            ok = q_insert_tail(q, strs + (size_t) i * BENCH_STRLEN);
+        q_sort(q);
+        t_sort[0] = delta_time(&t);
+        for (int i = 0; ok && i < n; i++) {
+            ok = q_remove_head(q, buf, sizeof(buf));
+            if (ok && strcmp(buf, out + (size_t) i * BENCH_STRLEN)) {
+                report(1, "ERROR: Priority queue and sorted queue differ");
+                ok = false;
+            }
+        }
+        t_sort[1] = delta_time(&t);
+        q_free(q);
+        if (!q)
+            report(1, "ERROR: Could not allocate space");
+    } else
+        ok = false;
+    exception_cancel();
+    set_cautious_mode(true);
+    free(strs);
+    free(out);
+
+    if (ok) {
+        report(1, "priority queue: insert %.3f s, remove %.3f s", t_pq[0],
+               t_pq[1]);
+        report(1, "sorted queue:   insert and sort %.3f s, remove %.3f s",
+               t_sort[0], t_sort[1]);
+    }
+    return ok && !error_check();
+}
+
+/* Shared by the producer and consumer threads of bench_bq */
+typedef struct {
+    bqueue_t *bq;
+    long per_producer;
+    uint64_t *latency; /* Nanoseconds from insertion to removal */
+    long removed;      /* Updated atomically */
+    bool failed;
+} bq_bench_t;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Insert strings holding the time of their insertion */
+static void *bq_producer(void *arg)
+{
+    bq_bench_t *b = arg;
+    char buf[24];
+    for (long i = 0; i < b->per_producer; i++) {
+        snprintf(buf, sizeof(buf), "%lu", (unsigned long) now_ns());
+        if (!bq_insert_tail(b->bq, buf, -1)) {
+            b->failed = true;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Remove strings until the queue is closed and empty, noting latencies */
+static void *bq_consumer(void *arg)
+{
+    bq_bench_t *b = arg;
+    char buf[24];
+    while (bq_remove_head(b->bq, buf, sizeof(buf), -1)) {
+        uint64_t t = now_ns();
+        long i = __atomic_fetch_add(&b->removed, 1, __ATOMIC_RELAXED);
+        b->latency[i] = t - strtoull(buf, NULL, 10);
+    }
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Pass n strings through a bounded queue of the given capacity, with several
+ * ratios of producer to consumer threads, reporting throughput, latency
+ * percentiles and how often threads had to wait.
+ */
+static bool bench_bq(int n, int capacity)
+{
+    static const int ratios[][2] = {{1, 1}, {1, 4}, {4, 1}, {4, 4}};
+    bq_bench_t b;
+    b.latency = malloc(sizeof(uint64_t) * n);
+    b.bq = bq_new(capacity);
+    if (!b.latency || !b.bq) {
+        report(1, "ERROR: Could not allocate space");
+        free(b.latency);
+        bq_free(b.bq);
+        return false;
+    }
+
+    /* Full and empty queues give up once the timeout passes */
+    bool ok = true;
+    for (int i = 0; ok && i < capacity; i++)
+        ok = bq_insert_tail(b.bq, "x", 0);
+    double t;
+    init_time(&t);
+    if (ok && (bq_insert_tail(b.bq, "x", 0) || bq_insert_tail(b.bq, "x", 10) ||
+               delta_time(&t) < 0.005)) {
+        report(1, "ERROR: Insertion into full queue did not time out");
+        ok = false;
+    }
+    while (ok && bq_size(b.bq))
+        ok = bq_remove_head(b.bq, NULL, 0, 0);
+    if (ok && bq_remove_head(b.bq, NULL, 0, 10)) {
+        report(1, "ERROR: Removal from empty queue did not time out");
+        ok = false;
+    }
+    bq_free(b.bq);
+
+    /* Leave signals such as the alarm of the harness to this thread */
+    sigset_t all, old;
+    sigfillset(&all);
+    for (size_t r = 0; ok && r < sizeof(ratios) / sizeof(ratios[0]); r++) {
+        int np = ratios[r][0], nc = ratios[r][1];
+        pthread_t threads[8];
+        int started = 0;
+        b.bq = bq_new(capacity);
+        b.per_producer = n / np;
+        b.removed = 0;
+        b.failed = !b.bq;
+
+        init_time(&t);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        for (int i = 0; !b.failed && i < np + nc; i++) {
+            if (pthread_create(&threads[i], NULL,
+                               i < np ? bq_producer : bq_consumer, &b)) {
+                b.failed = true;
+                break;
+            }
+            started++;
+        }
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        for (int i = 0; i < started && i < np; i++)
+            pthread_join(threads[i], NULL);
+        bq_close(b.bq);
+        for (int i = np; i < started; i++)
+            pthread_join(threads[i], NULL);
+        double elapsed = delta_time(&t);
+
+        long total = b.per_producer * np;
+        if (b.failed || b.removed != total) {
+            report(1, "ERROR: %ld of %ld strings passed through the queue",
+                   b.removed, total);
+            ok = false;
+        } else {
+            qsort(b.latency, total, sizeof(uint64_t), cmp_u64);
+            report(1,
+                   "%d producers, %d consumers: %.0f strings/s, latency "
+                   "p50 %.1f us, p99 %.1f us, max %.1f us",
+                   np, nc, total / elapsed, b.latency[total / 2] / 1e3,
+                   b.latency[total - 1 - total / 100] / 1e3,
+                   b.latency[total - 1] / 1e3);
+            report(1,
+                   "  producers waited %lu times, consumers %lu times, "
+                   "%lu wakeups",
+                   b.bq->producer_waits, b.bq->consumer_waits, b.bq->wakeups);
+        }
+        bq_free(b.bq);
+    }
+    free(b.latency);
+    return ok && !error_check();
+}
+
+/* Shared by the worker threads of bench_ws */
+typedef struct {
+    wsdeque_t **deques;
+    int workers;
+    long tasks;
+    atomic_long remaining; /* Tasks not yet run, including ungenerated ones */
+    atomic_ulong checksum; /* Sum of the numbers of all tasks run */
+} ws_sched_t;
+
+typedef struct {
+    ws_sched_t *s;
+    int id;
+    unsigned seed;
+    long run, stolen, retries, misses;
+    pthread_t thread;
+} ws_worker_t;
+
+/* Task n hashes for a while, longer for some tasks than for others */
+static void ws_run(ws_sched_t *s, const char *task)
+{
+    unsigned long n = strtoul(task, NULL, 10);
+    uint64_t x = n + 1;
+    for (unsigned long i = 0; i < 64 * (n % 97); i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+    /* Keep the hashing from being optimized away */
+    atomic_fetch_add_explicit(&s->checksum, n + (x == 0),
+                              memory_order_relaxed);
+    atomic_fetch_sub_explicit(&s->remaining, 1, memory_order_relaxed);
+}
+
+/*
+ * Worker 0 generates all tasks into its deque, working through them from
+ * the bottom, while the other workers steal from random victims.
+ */
+static void *ws_worker(void *arg)
+{
+    ws_worker_t *w = arg;
+    ws_sched_t *s = w->s;
+    wsdeque_t *own = s->deques[w->id];
+    char buf[24];
+    if (w->id == 0) {
+        for (long i = 0; i < s->tasks; i++) {
+            snprintf(buf, sizeof(buf), "%ld", i);
+            while (!ws_push(own, buf))
+                ;
+            /* Run one task per 16 generated */
+            if (i % 16 == 15 && ws_pop(own, buf, sizeof(buf))) {
+                ws_run(s, buf);
+                w->run++;
+            }
+        }
+    }
+    while (atomic_load_explicit(&s->remaining, memory_order_relaxed) > 0) {
+        if (ws_pop(own, buf, sizeof(buf))) {
+            ws_run(s, buf);
+            w->run++;
+            continue;
+        }
+        if (s->workers == 1)
+            continue;
+        int victim = rand_r(&w->seed) % (s->workers - 1);
+        if (victim >= w->id)
+            victim++;
+        switch (ws_steal(s->deques[victim], buf, sizeof(buf))) {
+        case WS_STOLEN:
+            ws_run(s, buf);
+            w->run++;
+            w->stolen++;
+            break;
+        case WS_RETRY:
+            w->retries++;
+            break;
+        case WS_EMPTY:
+            w->misses++;
+            sched_yield();
+            break;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Run a scheduler over work-stealing deques with 1, 2, 4, ... up to workers
+ * threads, on tasks generated by one of them, reporting throughput, speedup
+ * and steals.
+ */
+static bool bench_ws(int workers, long tasks)
+{
+    ws_sched_t s;
+    s.tasks = tasks;
+    s.deques = calloc(workers, sizeof(wsdeque_t *));
+    ws_worker_t *ws = calloc(workers, sizeof(ws_worker_t));
+    bool ok = s.deques && ws;
+    for (int i = 0; ok && i < workers; i++)
+        ok = (s.deques[i] = ws_new()) != NULL;
+    if (!ok)
+        report(1, "ERROR: Could not allocate space");
+
+    double base = 0;
+    sigset_t all, old;
+    sigfillset(&all);
+    for (int n = 1; ok && n <= workers; n = n < workers && 2 * n > workers ?
+                                                workers :
+                                                2 * n) {
+        s.workers = n;
+        atomic_init(&s.remaining, tasks);
+        atomic_init(&s.checksum, 0);
+        int started = 0;
+        double t;
+        init_time(&t);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        for (int i = 0; i < n; i++) {
+            memset(&ws[i], 0, sizeof(ws_worker_t));
+            ws[i].s = &s;
+            ws[i].id = i;
+            ws[i].seed = i + 1;
+            if (pthread_create(&ws[i].thread, NULL, ws_worker, &ws[i]))
+                break;
+            started++;
+        }
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        if (started < n) {
+            /* Let the started workers finish the tasks */
+            report(1, "ERROR: Could not start %d workers", n);
+            ok = false;
+        }
+        for (int i = 0; i < started; i++)
+            pthread_join(ws[i].thread, NULL);
+        double elapsed = delta_time(&t);
+        if (!ok)
+            break;
+
+        long run = 0, stolen = 0, retries = 0, misses = 0;
+        for (int i = 0; i < n; i++) {
+            run += ws[i].run;
+            stolen += ws[i].stolen;
+            retries += ws[i].retries;
+            misses += ws[i].misses;
+        }
+        unsigned long sum = (unsigned long) tasks * (tasks - 1) / 2;
+        if (run != tasks || atomic_load(&s.checksum) != sum) {
+            report(1, "ERROR: Ran %ld tasks, but generated %ld", run, tasks);
+            ok = false;
+            break;
+        }
+        if (n == 1)
+            base = elapsed;
+        report(1,
+               "%d workers: %.0f tasks/s, speedup %.2f, %ld stolen (%.1f%%), "
+               "%ld lost races, %ld empty victims",
+               n, tasks / elapsed, base / elapsed, stolen,
+               100.0 * stolen / tasks, retries, misses);
+    }
+
+    for (int i = 0; s.deques && i < workers; i++)
+        ws_free(s.deques[i]);
+    free(s.deques);
+    free(ws);
+    return ok && !error_check();
+}
+
+#define SHM_RECORD 32
+#define SHM_MAXPROCS 64
+
+/* Tallies of the consumers of bench_shm, in memory shared with them */
+typedef struct {
+    atomic_long removed;
+    atomic_ulong checksum;
+    atomic_int errors;
+} shm_tally_t;
+
+/* Count one element "producer number" taken by a consumer */
+static void shm_consume(shm_tally_t *t, const char *s, long *last, int procs)
+{
+    int p;
+    long i;
+    if (sscanf(s, "%d %ld", &p, &i) != 2 || p < 0 || p >= procs ||
+        i <= last[p]) {
+        /* Elements of each producer come out in the order it put them in */
+        atomic_fetch_add(&t->errors, 1);
+    } else {
+        last[p] = i;
+    }
+    atomic_fetch_add(&t->checksum, i);
+    atomic_fetch_add(&t->removed, 1);
+}
+
+/*
+ * Body of process number id of bench_shm, a producer if id < procs and a
+ * consumer otherwise, passing elements through a queue in the region named
+ * name if there is one, else through the pipe fds.
+ * Return whether it went fine.
+ */
+static bool shm_child(int id, int procs, long n, const char *name, int *fds,
+                      shm_tally_t *t)
+{
+    shqueue_t *q = NULL;
+    if (name) {
+        /* Map the region anew, at another address than the parent's */
+        q = shq_attach(name);
+        if (!q)
+            return false;
+    }
+    char buf[SHM_RECORD];
+    if (id < procs) {
+        long cnt = n / procs + (id < n % procs);
+        for (long i = 0; i < cnt; i++) {
+            memset(buf, 0, sizeof(buf));
+            snprintf(buf, sizeof(buf), "%d %ld", id, i);
+            if (!q) {
+                if (write(fds[1], buf, sizeof(buf)) != sizeof(buf))
+                    return false;
+                continue;
+            }
+            while (!shq_insert_tail(q, buf))
+                sched_yield();
+        }
+        return true;
+    }
+    long last[SHM_MAXPROCS];
+    for (int p = 0; p < procs; p++)
+        last[p] = -1;
+    if (!q) {
+        /* Records are written whole, being shorter than PIPE_BUF */
+        while (read(fds[0], buf, sizeof(buf)) == sizeof(buf))
+            shm_consume(t, buf, last, procs);
+        return true;
+    }
+    while (atomic_load(&t->removed) < n) {
+        if (shq_remove_head(q, buf, sizeof(buf)))
+            shm_consume(t, buf, last, procs);
+        else
+            sched_yield();
+    }
+    return true;
+}
+
+/*
+ * Pass n elements from procs producer processes to procs consumer processes
+ * through a queue in the region named name, or through a pipe if name is
+ * NULL, reporting the rate.
+ */
+static bool shm_run(int procs, long n, const char *name, shm_tally_t *t)
+{
+    int fds[2] = {-1, -1};
+    if (!name && pipe(fds)) {
+        report(1, "ERROR: Could not create pipe");
+        return false;
+    }
+    atomic_init(&t->removed, 0);
+    atomic_init(&t->checksum, 0);
+    atomic_init(&t->errors, 0);
+
+    bool ok = true;
+    int started = 0;
+    double elapsed;
+    init_time(&elapsed);
+    fflush(stdout);
+    for (int id = 0; id < 2 * procs; id++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            if (!name)
+                close(fds[id < procs ? 0 : 1]);
+            _exit(shm_child(id, procs, n, name, fds, t) ? 0 : 1);
+        }
+        if (pid < 0) {
+            report(1, "ERROR: Could not fork process");
+            ok = false;
+            break;
+        }
+        started++;
+    }
+    if (!name) {
+        close(fds[0]);
+        close(fds[1]);
+    }
+    if (!ok)
+        /* Let the consumers started already finish */
+        atomic_store(&t->removed, n);
+    for (int i = 0; i < started; i++) {
+        int status;
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+            ok = false;
+    }
+    elapsed = delta_time(&elapsed);
+    if (!ok)
+        return false;
+
+    unsigned long sum = 0;
+    for (int p = 0; p < procs; p++) {
+        unsigned long cnt = n / procs + (p < n % procs);
+        sum += cnt * (cnt - 1) / 2;
+    }
+    if (atomic_load(&t->removed) != n || atomic_load(&t->checksum) != sum ||
+        atomic_load(&t->errors)) {
+        report(1, "ERROR: Consumers got %ld elements, %d out of order",
+               atomic_load(&t->removed), atomic_load(&t->errors));
+        return false;
+    }
+    report(1, "%s %d producers, %d consumers: %.0f elements/s",
+           name ? "Shared queue:" : "Pipe:        ", procs, procs,
+           n / elapsed);
+    return true;
+}
+
+/*
+ * Check that a queue survives a process dying while holding its lock: the
+ * next operation has to repair it and go on.
+ */
+static bool shm_recover(shqueue_t *q)
+{
+    char buf[SHM_RECORD];
+    bool ok = shq_insert_tail(q, "before");
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+        _exit(pthread_mutex_lock(&q->hdr->lock) ? 1 : 0);
+    int status;
+    ok = ok && pid > 0 && waitpid(pid, &status, 0) == pid &&
+         WIFEXITED(status) && !WEXITSTATUS(status);
+    ok = ok && shq_insert_tail(q, "after") && q->hdr->recoveries == 1 &&
+         shq_size(q) == 2;
+    ok = ok && shq_remove_head(q, buf, sizeof(buf)) && !strcmp(buf, "before");
+    ok = ok && shq_remove_head(q, buf, sizeof(buf)) && !strcmp(buf, "after");
+    if (!ok)
+        report(1, "ERROR: Queue did not recover from death of lock holder");
+    else
+        report(1, "Recovered queue after death of the process holding it");
+    return ok;
+}
+
+/*
+ * Compare a queue in a shared memory region with a pipe to pass n elements
+ * between 1, 2, 4, ... up to procs producer processes and as many consumer
+ * processes.
+ */
+static bool bench_shm(int procs, long n)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/lab0-bench-%d", (int) getpid());
+    /* Room for all elements, should consumers fall behind */
+    shqueue_t *q = shq_create(name, (size_t) n * SHM_RECORD * 2 + (1 << 16));
+    shm_tally_t *t = mmap(NULL, sizeof(shm_tally_t), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    bool ok = q && t != MAP_FAILED;
+    if (!ok)
+        report(1, "ERROR: Could not create shared memory");
+
+    for (int p = 1; ok && p <= procs; p = p < procs && 2 * p > procs ?
+                                                procs :
+                                                2 * p) {
+        ok = shm_run(p, n, name, t) && shm_run(p, n, NULL, t);
+    }
+    ok = ok && shm_recover(q);
+
+    shq_detach(q);
+    shq_unlink(name);
+    if (t != MAP_FAILED)
+        munmap(t, sizeof(shm_tally_t));
+    return ok && !error_check();
+}
+
+/*
+ * Insert n elements into a queue logged at path, committing them every
+ * interval_us microseconds or batch records, or one by one if sync is true,
+ * and report the rate and commit latencies.
+ */
+static bool wal_run(const char *path, int n, long interval_us, size_t batch,
+                    bool sync)
+{
+    wal_unlink(path);
+    queue_t *q = q_new();
+    wal_t *w = q ? wal_open(path, q, interval_us, batch) : NULL;
+    bool ok = w != NULL;
+    q_log(q, w);
+    char buf[BENCH_STRLEN];
+    double t;
+    init_time(&t);
+    for (int i = 0; ok && i < n; i++) {
+        snprintf(buf, sizeof(buf), "%d", i);
+        ok = q_insert_tail(q, buf) && (!sync || wal_commit(w, i + 1, false));
+    }
+    ok = ok && wal_commit(w, n, true);
+    double elapsed = delta_time(&t);
+    wal_stats_t st;
+    wal_stats(w, &st);
+    ok = wal_close(w) && ok;
+    q_free(q);
+    if (!ok) {
+        report(1, "ERROR: Could not log %d records in %s", n, path);
+        return false;
+    }
+    char label[32];
+    if (sync)
+        snprintf(label, sizeof(label), "commit every record:");
+    else
+        snprintf(label, sizeof(label), "group commit %5ld us:", interval_us);
+    report(1,
+           "%-21s %8.0f records/s, %6.1f records/commit, latency p50 %.0f "
+           "us, p99 %.0f us, p99.9 %.0f us",
+           label, n / elapsed, (double) st.records / st.commits, st.p50,
+           st.p99, st.p999);
+    return true;
+}
+
+/*
+ * Kill a process logging a queue at path after it committed some records,
+ * and check that recovering the queue finds them all, in order.
+ */
+static bool wal_crash(const char *path, int n)
+{
+    wal_unlink(path);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        queue_t *q = q_new();
+        wal_t *w = q ? wal_open(path, q, 1000, 4096) : NULL;
+        q_log(q, w);
+        char buf[BENCH_STRLEN];
+        bool ok = w != NULL;
+        for (int i = 0; ok && i < 2 * n; i++) {
+            snprintf(buf, sizeof(buf), "%d", i);
+            ok = q_insert_tail(q, buf) &&
+                 (i != n - 1 || wal_commit(w, n, true));
+        }
+        /* Die without committing the second half */
+        _exit(ok ? 0 : 1);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status)) {
+        report(1, "ERROR: Logging process failed");
+        return false;
+    }
+
+    queue_t *q = q_new();
+    wal_t *w = q ? wal_open(path, q, 1000, 4096) : NULL;
+    size_t size = q_size(q);
+    bool ok = w && size >= (size_t) n;
+    char buf[BENCH_STRLEN], expect[24];
+    for (size_t i = 0; ok && i < size; i++) {
+        snprintf(expect, sizeof(expect), "%lu", i);
+        ok = q_remove_head(q, buf, sizeof(buf)) && !strcmp(buf, expect);
+    }
+    wal_close(w);
+    q_free(q);
+    wal_unlink(path);
+    if (!ok) {
+        report(1, "ERROR: Recovered %lu records, but %d got committed", size,
+               n);
+        return false;
+    }
+    report(1, "Recovered %lu records after crash, %d of them committed", size,
+           n);
+    return true;
+}
+
+/*
+ * Compare committing every record of a write-ahead log with group commits
+ * every 100 us, 1 ms and 10 ms, then check recovery after a crash
+ */
+static bool bench_wal(int n)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/qtest-bench-%d.wal", (int) getpid());
+    long intervals[] = {100, 1000, 10000};
+    bool ok = true;
+    set_cautious_mode(false);
+    if (exception_setup(false)) {
+        /* Each commit takes an fsync, so fewer records will do */
+        ok = wal_run(path, n < 2000 ? n : 2000, 0, 1, true);
+        for (int i = 0; ok && i < 3; i++)
+            ok = wal_run(path, n, intervals[i], 4096, false);
+        ok = ok && wal_crash(path, n / 2 ? n / 2 : 1);
+    } else
+        ok = false;
+    exception_cancel();
+    set_cautious_mode(true);
+    wal_unlink(path);
+    return ok && !error_check();
+}
+
+/*
+ * Ship n inserts, committed every interval_us microseconds or batch records,
+ * to a follower process at the other end of a socket, and report the rate
+ * of inserts, the rate until the follower caught up, and its lag.
+ */
+static bool repl_run(int n, long interval_us, size_t batch)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+        report(1, "ERROR: Could not create socket pair");
+        return false;
+    }
+    char label[32];
+    snprintf(label, sizeof(label), "%5ld us, batch %4lu:", interval_us, batch);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        queue_t *r = q_new();
+        wal_stats_t st;
+        bool ok = r && wal_follow(fds[1], r, &st) && q_size(r) == (size_t) n;
+        if (ok)
+            report(1,
+                   "%-22s follower lag p50 %.0f us, p99 %.0f us, p99.9 %.0f "
+                   "us, %.1f records/frame",
+                   label, st.p50, st.p99, st.p999,
+                   (double) st.records / st.commits);
+        fflush(NULL);
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        report(1, "ERROR: Could not fork follower process");
+        return false;
+    }
+
+    queue_t *q = q_new();
+    wal_t *w = q ? wal_open(NULL, q, interval_us, batch) : NULL;
+    bool ok = w && wal_ship(w, fds[0], q);
+    if (!ok)
+        close(fds[0]);
+    q_log(q, w);
+    char buf[BENCH_STRLEN];
+    double t;
+    init_time(&t);
+    for (int i = 0; ok && i < n; i++) {
+        snprintf(buf, sizeof(buf), "%d", i);
+        ok = q_insert_tail(q, buf);
+    }
+    double inserted = delta_time(&t);
+    ok = ok && wal_unship(w, q);
+    double caught_up = inserted + delta_time(&t);
+    wal_stats_t st;
+    wal_stats(w, &st);
+    ok = wal_close(w) && ok;
+    q_free(q);
+    int status;
+    ok = waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+         !WEXITSTATUS(status) && ok;
+    if (!ok) {
+        report(1, "ERROR: Follower failed to replicate %d records", n);
+        return false;
+    }
+    report(1,
+           "%-22s %8.0f inserts/s, %8.0f records/s replicated, at most %lu "
+           "records behind",
+           label, n / inserted, n / caught_up, (size_t) st.max_lag);
+    return true;
+}
+
+/*
+ * Compare shipping records to a follower as soon as the log thread gets to
+ * them, in frames of whatever piled up meanwhile, with group commits every
+ * 100 us, 1 ms and 10 ms
+ */
+static bool bench_repl(int n)
+{
+    long intervals[] = {100, 1000, 10000};
+    bool ok = true;
+    set_cautious_mode(false);
+    if (exception_setup(false)) {
+        ok = repl_run(n, 0, 1);
+        for (int i = 0; ok && i < 3; i++)
+            ok = repl_run(n, intervals[i], 4096);
+    } else
+        ok = false;
+    exception_cancel();
+    set_cautious_mode(true);
+    return ok && !error_check();
+}
+
+/* Export of a snapshot by a thread of bench_snap */
+typedef struct {
+    qsnap_t *s;
+    uint64_t digest;
+    long cnt;
+    double seconds;
+} snap_export_t;
+
+/* Hash string s into the FNV-1a digest at arg */
+static void snap_digest(const char *s, void *arg)
+{
+    uint64_t *h = arg;
+    do {
+        *h ^= (unsigned char) *s;
+        *h *= 1099511628211ULL;
+    } while (*s++);
+}
+
+static void *snap_exporter(void *arg)
+{
+    snap_export_t *e = arg;
+    double t;
+    init_time(&t);
+    e->digest = 14695981039346656037ULL;
+    e->cnt = q_snap_foreach(e->s, snap_digest, &e->digest);
+    e->seconds = delta_time(&t);
+    return NULL;
+}
+
+/*
+ * Compare getting a point in time view of a queue of n strings by copying
+ * it with q_clone, then export the view from another thread while this one
+ * keeps removing, inserting at the tail and, now and then, in the middle,
+ * and report how many elements the queue still shares with the view.
+ */
+static bool bench_snap(int n)
+{
+    char *buf = malloc((size_t) n * BENCH_STRLEN);
+    queue_t *q = q_new(), *copy = q_new();
+    if (!buf || !q || !copy) {
+        report(1, "ERROR: Could not allocate space");
+        free(buf);
+        q_free(q);
+        q_free(copy);
+        return false;
+    }
+    bench_strings(buf, n);
+    bool ok = true;
+    set_cautious_mode(false);
+    if (exception_setup(false)) {
+        for (int i = 0; ok && i < n; i++)
+            ok = q_insert_tail(q, buf + (size_t) i * BENCH_STRLEN);
+        uint64_t digest = 14695981039346656037ULL;
+        q_foreach(q, snap_digest, &digest);
+
+        double t;
+        init_time(&t);
+        for (list_ele_t *e = q->head; ok && e; e = e->next)
+            ok = q_insert_tail(copy, e->value);
+        double copied = delta_time(&t);
+        snap_export_t e = {.s = q_clone(q)};
+        double cloned = delta_time(&t);
+        ok = ok && e.s;
+
+        pthread_t exporter;
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        ok = ok && !pthread_create(&exporter, NULL, snap_exporter, &e);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        double writes = 0;
+        if (ok) {
+            init_time(&t);
+            for (int i = 0; ok && i < n / 10; i++) {
+                char *s = buf + (size_t) i * BENCH_STRLEN;
+                if (i % 1000 == 999)
+                    ok = q_insert_at(q, rand() % q_size(q), s);
+                else if (i % 2)
+                    ok = q_insert_tail(q, s);
+                else
+                    ok = q_remove_head(q, NULL, 0);
+            }
+            writes = delta_time(&t);
+            pthread_join(exporter, NULL);
+        }
+        if (ok && (e.cnt != n || e.digest != digest)) {
+            report(1, "ERROR: Snapshot changed while being exported");
+            ok = false;
+        }
+        if (ok) {
+            report(1, "Deep copy of %d elements: %.6f s, q_clone: %.6f s",
+                   n, copied, cloned);
+            report(1,
+                   "%d writes in %.6f s while exporting snapshot in %.6f "
+                   "s, queue shares %lu of %lu elements",
+                   n / 10, writes, e.seconds, q_shared(q), q_size(q));
+        }
+        q_snap_free(e.s);
+    } else
+        ok = false;
+    exception_cancel();
+    q_free(copy);
+    q_free(q);
+    set_cautious_mode(true);
+    free(buf);
+    return ok && !error_check();
+}
+
+static bool do_bench(int argc, char *argv[])
+{
+    if (argc < 2) {
+        report(1, "%s needs a benchmark name", argv[0]);
+        return false;
+    }
+
+    if (!strcmp(argv[1], "sorted")) {
+        int n = 100000, batch = 1000;
+        if (argc > 4 || (argc > 2 && (!get_int(argv[2], &n) || n <= 0)) ||
+            (argc > 3 && (!get_int(argv[3], &batch) || batch <= 0))) {
+            report(1, "Usage: %s sorted [n] [batch]", argv[0]);
+            return false;
+        }
+        return bench_sorted(n, batch);
+    }
+
+    if (!strcmp(argv[1], "defrag")) {
+        int n = 1000000;
+        if (argc > 3 || (argc > 2 && (!get_int(argv[2], &n) || n <= 0))) {
+            report(1, "Usage: %s defrag [n]", argv[0]);
+            return false;
+        }
+        return bench_defrag(n);
+    }
+
+    if (!strcmp(argv[1], "pool")) {
+        int n = 1000000;
+        if (argc > 3 || (argc > 2 && (!get_int(argv[2], &n) || n <= 0))) {
+            report(1, "Usage: %s pool [n]", argv[0]);
+            return false;
+        }
+        return bench_pool(n);
+    }
+
+    if (!strcmp(argv[1], "prefetch")) {
+        int n = 1000000;
+        if (argc > 3 || (argc > 2 && (!get_int(argv[2], &n) || n <= 0))) {
+            report(1, "Usage: %s prefetch [n]", argv[0]);
+            return false;
+        }
+        return bench_prefetch(n);
+    }
+
+    if (!strcmp(argv[1], "merge")) {
+        int k = 16, n = 65536;
+        if (argc > 4 || (argc > 2 && (!get_int(argv[2], &k) || k <= 0)) ||
+            (argc > 3 && (!get_int(argv[3], &n) || n <= 0))) {
+            report(1, "Usage: %s merge [k] [n]", argv[0]);
+            return false;
+        }
+        return bench_merge(k, n);
+    }
+
+    if (!strcmp(argv[1], "pq")) {
+        int n = 1000000;
+        if (argc > 3 || (argc > 2 && (!get_int(argv[2], &n) || n <= 0))) {
+            report(1, "Usage: %s pq [n]", argv[0]);
+            return false;
+        }
+        return bench_pq(n);
+    }
+
+    if (!strcmp(argv[1], "bq")) {
+        int n = 1000000, capacity = 1024;
+        if (argc > 4 || (argc > 2 && (!get_int(argv[2], &n) || n <= 0)) ||
+            (argc > 3 && (!get_int(argv[3], &capacity) || capacity <= 0))) {
+            report(1, "Usage: %s bq [n] [capacity]", argv[0]);
+            return false;
+        }
+        return bench_bq(n, capacity);
+    }
+
+    if (!strcmp(argv[1], "ws")) {
+        int workers = 4, tasks = 1000000;
+        if (argc > 4 ||
+            (argc > 2 && (!get_int(argv[2], &workers) || workers <= 0)) ||
+            (argc > 3 && (!get_int(argv[3], &tasks) || tasks <= 0))) {
+            report(1, "Usage: %s ws [workers] [tasks]", argv[0]);
+            return false;
+        }
+        return bench_ws(workers, tasks);
+    }
+
+    if (!strcmp(argv[1], "shm")) {
+        int procs = 2, n = 200000;
+        if (argc > 4 ||
+            (argc > 2 && (!get_int(argv[2], &procs) || procs <= 0 ||
+                          procs > SHM_MAXPROCS)) ||
+            (argc > 3 && (!get_int(argv[3], &n) || n <= 0))) {
+            report(1, "Usage: %s shm [procs] [n]", argv[0]);
+            return false;
+        }
+        return bench_shm(procs, n);
+    }
+
+    if (!strcmp(argv[1], "wal")) {
+        int n = 200000;
+        if (argc > 3 || (argc > 2 && (!get_int(argv[2], &n) || n <= 0))) {
+            report(1, "Usage: %s wal [n]", argv[0]);
+            return false;
+        }
+        return bench_wal(n);
+    }
+
+    if (!strcmp(argv[1], "repl")) {
+        int n = 1000000;
+        if (argc > 3 || (argc > 2 && (!get_int(argv[2], &n) || n <= 0))) {
+            report(1, "Usage: %s repl [n]", argv[0]);
+            return false;
+        }
+        return bench_repl(n);
+    }
+
+    if (!strcmp(argv[1], "snap")) {
+        int n = 1000000;
+        if (argc > 3 || (argc > 2 && (!get_int(argv[2], &n) || n <= 0))) {
+            report(1, "Usage: %s snap [n]", argv[0]);
+            return false;
+        }
+        return bench_snap(n);
+    }
+
+    report(1, "Unknown benchmark '%s'", argv[1]);
+    return false;
+}
+
+void bench_init()
+{
+    add_cmd("bench", do_bench,
+            " name [args]    | Run benchmark name.  'sorted [n] [batch]' "
+            "compares insert sorted with insert and sort every batch, "
+            "'defrag [n]' traversal after sort with and without q_defrag, "
+            "'pool [n]' memory per element of queue_t and cqueue_t, "
+            "'prefetch [n]' list traversals with and without prefetching, "
+            "'merge [k] [n]' q_merge_sorted with concatenation and q_sort, "
+            "'pq [n]' priority queue with insert, q_sort and remove, "
+            "'bq [n] [capacity]' bounded queue with several numbers of "
+            "producer and consumer threads, 'ws [workers] [tasks]' "
+            "scheduler stealing tasks generated by one worker, 'shm [procs] "
+            "[n]' queue shared by processes against a pipe, 'wal [n]' "
+            "write-ahead log committing each record against group commits, "
+            "'repl [n]' shipping a log to a follower process at several "
+            "commit intervals, 'snap [n]' q_clone against a deep copy, "
+            "with a thread exporting the snapshot while writes continue");
+}
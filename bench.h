@@ -0,0 +1,9 @@
+#ifndef LAB0_BENCH_H
+#define LAB0_BENCH_H
+
+/* Benchmarks comparing queue operations, run by the bench command */
+
+/* Register the bench command with the console */
+void bench_init();
+
+#endif /* LAB0_BENCH_H */
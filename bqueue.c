@@ -0,0 +1,155 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bqueue.h"
+#include "harness.h"
+
+bqueue_t *bq_new(size_t capacity)
+{
+    if (!capacity)
+        return NULL;
+    bqueue_t *bq = malloc(sizeof(bqueue_t));
+    if (!bq)
+        return NULL;
+    bq->q = q_new();
+    if (!bq->q) {
+        free(bq);
+        return NULL;
+    }
+    size_t batch = capacity / BQ_BATCH_DIV;
+    bq->capacity = capacity;
+    bq->low_mark = capacity - (batch ? batch : 1);
+    bq->closed = false;
+    bq->producers_waiting = bq->consumers_waiting = 0;
+    bq->producers_woken = bq->consumers_woken = 0;
+    bq->producer_waits = bq->consumer_waits = bq->wakeups = 0;
+
+    /* Timeouts are measured on the monotonic clock */
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&bq->lock, NULL);
+    pthread_cond_init(&bq->not_full, &attr);
+    pthread_cond_init(&bq->not_empty, &attr);
+    pthread_condattr_destroy(&attr);
+    return bq;
+}
+
+void bq_free(bqueue_t *bq)
+{
+    if (!bq)
+        return;
+    q_free(bq->q);
+    pthread_cond_destroy(&bq->not_full);
+    pthread_cond_destroy(&bq->not_empty);
+    pthread_mutex_destroy(&bq->lock);
+    free(bq);
+}
+
+/* Compute the deadline of a wait of timeout_ms milliseconds from now */
+static void deadline_after(struct timespec *ts, long timeout_ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += timeout_ms / 1000;
+    ts->tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+/*
+ * Wait on cond, holding the lock of bq, until the deadline if there is one.
+ * Return false once the deadline passed.
+ */
+static bool wait_until(bqueue_t *bq,
+                       pthread_cond_t *cond,
+                       const struct timespec *deadline)
+{
+    if (!deadline)
+        return !pthread_cond_wait(cond, &bq->lock);
+    return pthread_cond_timedwait(cond, &bq->lock, deadline) != ETIMEDOUT;
+}
+
+bool bq_insert_tail(bqueue_t *bq, char *s, long timeout_ms)
+{
+    if (!bq)
+        return false;
+    struct timespec ts;
+    if (timeout_ms > 0)
+        deadline_after(&ts, timeout_ms);
+
+    pthread_mutex_lock(&bq->lock);
+    bool ok = true;
+    if (bq->q->size >= bq->capacity && !bq->closed && timeout_ms) {
+        bq->producer_waits++;
+        bq->producers_waiting++;
+        while (ok && bq->q->size >= bq->capacity && !bq->closed) {
+            ok = wait_until(bq, &bq->not_full, timeout_ms > 0 ? &ts : NULL);
+            if (bq->producers_woken)
+                bq->producers_woken--;
+        }
+        bq->producers_waiting--;
+    }
+    ok = bq->q->size < bq->capacity && !bq->closed && q_insert_tail(bq->q, s);
+    if (ok && bq->consumers_waiting > bq->consumers_woken) {
+        pthread_cond_signal(&bq->not_empty);
+        bq->consumers_woken++;
+        bq->wakeups++;
+    }
+    pthread_mutex_unlock(&bq->lock);
+    return ok;
+}
+
+bool bq_remove_head(bqueue_t *bq, char *sp, size_t bufsize, long timeout_ms)
+{
+    if (!bq)
+        return false;
+    struct timespec ts;
+    if (timeout_ms > 0)
+        deadline_after(&ts, timeout_ms);
+
+    pthread_mutex_lock(&bq->lock);
+    bool ok = true;
+    if (!bq->q->size && !bq->closed && timeout_ms) {
+        bq->consumer_waits++;
+        bq->consumers_waiting++;
+        while (ok && !bq->q->size && !bq->closed) {
+            ok = wait_until(bq, &bq->not_empty, timeout_ms > 0 ? &ts : NULL);
+            if (bq->consumers_woken)
+                bq->consumers_woken--;
+        }
+        bq->consumers_waiting--;
+    }
+    ok = q_remove_head(bq->q, sp, bufsize);
+    if (ok && bq->producers_waiting > bq->producers_woken &&
+        bq->q->size <= bq->low_mark) {
+        pthread_cond_broadcast(&bq->not_full);
+        bq->producers_woken = bq->producers_waiting;
+        bq->wakeups++;
+    }
+    pthread_mutex_unlock(&bq->lock);
+    return ok;
+}
+
+void bq_close(bqueue_t *bq)
+{
+    if (!bq)
+        return;
+    pthread_mutex_lock(&bq->lock);
+    bq->closed = true;
+    pthread_cond_broadcast(&bq->not_full);
+    pthread_cond_broadcast(&bq->not_empty);
+    pthread_mutex_unlock(&bq->lock);
+}
+
+size_t bq_size(bqueue_t *bq)
+{
+    if (!bq)
+        return 0;
+    pthread_mutex_lock(&bq->lock);
+    size_t size = bq->q->size;
+    pthread_mutex_unlock(&bq->lock);
+    return size;
+}
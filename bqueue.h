@@ -0,0 +1,80 @@
+#ifndef LAB0_BQUEUE_H
+#define LAB0_BQUEUE_H
+
+/*
+ * Bounded queue shared by producer and consumer threads.
+ * Inserting into a full queue, or removing from an empty one, waits on a
+ * condition variable for at most a given time. Wakeups are batched: an
+ * insertion signals a consumer only if more consumers wait than have been
+ * signaled already, and blocked producers get woken together once consumers
+ * have freed a BQ_BATCH_DIV-th of the capacity, rather than on every removal.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+/* Blocked producers wait for capacity / BQ_BATCH_DIV free elements */
+#define BQ_BATCH_DIV 8
+
+typedef struct {
+    queue_t *q;
+    size_t capacity;
+    size_t low_mark; /* Size at which blocked producers get woken */
+    bool closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_full, not_empty;
+    int producers_waiting, consumers_waiting;
+    int producers_woken, consumers_woken; /* Woken, but not yet running */
+    /* Counters */
+    size_t producer_waits, consumer_waits; /* Times a thread had to wait */
+    size_t wakeups;                        /* Signals and broadcasts sent */
+} bqueue_t;
+
+/*
+ * Create empty queue holding at most capacity elements.
+ * Return NULL if capacity is 0 or could not allocate space.
+ */
+bqueue_t *bq_new(size_t capacity);
+
+/*
+ * Free all storage used by queue, which no thread may be using.
+ * No effect if bq is NULL
+ */
+void bq_free(bqueue_t *bq);
+
+/*
+ * Attempt to insert element at tail of queue, waiting up to timeout_ms
+ * milliseconds while it is full, or without limit if timeout_ms is negative.
+ * Return true if successful.
+ * Return false if bq is NULL, closed, still full after the timeout, or could
+ * not allocate space.
+ * Argument s points to the string to be stored, as for q_insert_tail.
+ */
+bool bq_insert_tail(bqueue_t *bq, char *s, long timeout_ms);
+
+/*
+ * Attempt to remove element from head of queue, waiting up to timeout_ms
+ * milliseconds while it is empty, or without limit if timeout_ms is negative.
+ * Return true if successful.
+ * Return false if bq is NULL, or still empty after the timeout or once
+ * closed.
+ * The removed string is copied to *sp as q_remove_head does.
+ */
+bool bq_remove_head(bqueue_t *bq, char *sp, size_t bufsize, long timeout_ms);
+
+/*
+ * Make insertions fail from now on, and wake all waiting threads, so that
+ * consumers return once the queue is empty.
+ */
+void bq_close(bqueue_t *bq);
+
+/*
+ * Return number of elements in queue.
+ * Return 0 if bq is NULL or empty
+ */
+size_t bq_size(bqueue_t *bq);
+
+#endif /* LAB0_BQUEUE_H */
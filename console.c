@@ -3,6 +3,7 @@
 #include "console.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
@@ -69,6 +70,9 @@ static bool has_infile = false;
 static cmd_function quit_helpers[MAXQUIT];
 static int quit_helper_cnt = 0;
 
+/* Optional function selecting the target of commands written cmd@target */
+static target_function target_fn = NULL;
+
 static bool do_quit_cmd(int argc, char *argv[]);
 static bool do_help_cmd(int argc, char *argv[]);
 static bool do_option_cmd(int argc, char *argv[]);
@@ -207,21 +211,44 @@ static void record_error()
     }
 }
 
+/* Find the command called name, or NULL if there is none */
+static cmd_ptr find_cmd(const char *name)
+{
+    cmd_ptr next_cmd = cmd_list;
+    while (next_cmd && strcmp(name, next_cmd->name) != 0)
+        next_cmd = next_cmd->next;
+    return next_cmd;
+}
+
 /* Execute a command that has already been split into arguments */
 static bool interpret_cmda(int argc, char *argv[])
 {
     if (argc == 0)
         return true;
     /* Try to find matching command */
-    cmd_ptr next_cmd = cmd_list;
+    cmd_ptr next_cmd = find_cmd(argv[0]);
+    char *target = next_cmd ? NULL : strchr(argv[0], '@');
     bool ok = true;
-    while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
-        next_cmd = next_cmd->next;
-    if (next_cmd) {
+    if (target && target_fn) {
+        /* Run cmd@target as cmd, with target selected while it runs */
+        *target = '\0';
+        next_cmd = find_cmd(argv[0]);
+        if (next_cmd) {
+            ok = target_fn(target + 1);
+            if (ok) {
+                ok = next_cmd->operation(argc, argv);
+                target_fn(NULL);
+            }
+            if (!ok)
+                record_error();
+        }
+        *target = '@';
+    } else if (next_cmd) {
         ok = next_cmd->operation(argc, argv);
         if (!ok)
             record_error();
-    } else {
+    }
+    if (!next_cmd) {
         report(1, "Unknown command '%s'", argv[0]);
         record_error();
         ok = false;
@@ -258,6 +285,12 @@ void add_quit_helper(cmd_function qf)
         report_event(MSG_FATAL, "Exceeded limit on quit helpers");
 }
 
+/* Set function selecting the target of commands written cmd@target */
+void set_target_function(target_function tf)
+{
+    target_fn = tf;
+}
+
 /* Turn echoing on/off */
 void set_echo(bool on)
 {
@@ -325,12 +358,24 @@ static bool do_comment_cmd(int argc, char *argv[])
     return true;
 }
 
-/* Extract integer from text and store at loc */
-bool get_int(char *vname, int *loc)
+/* Extract long integer from text and store at loc */
+bool get_long(char *vname, long *loc)
 {
     char *end = NULL;
+    errno = 0;
     long int v = strtol(vname, &end, 0);
-    if (v == LONG_MIN || *end != '\0')
+    if (errno || end == vname || *end != '\0')
+        return false;
+
+    *loc = v;
+    return true;
+}
+
+/* Extract integer from text and store at loc */
+bool get_int(char *vname, int *loc)
+{
+    long v;
+    if (!get_long(vname, &v) || v < INT_MIN || v > INT_MAX)
         return false;
 
     *loc = (int) v;
@@ -647,6 +692,24 @@ void completion(const char *buf, linenoiseCompletions *lc)
     }
 }
 
+bool run_script(char *fname)
+{
+    while (buf_stack)
+        pop_file();
+    if (!push_file(fname)) {
+        report(1, "ERROR: Could not open script file '%s'", fname);
+        return false;
+    }
+
+    err_cnt = 0;
+    while (!cmd_done()) {
+        char *cmdline = readline();
+        if (cmdline)
+            interpret_cmd(cmdline);
+    }
+    return err_cnt == 0;
+}
+
 bool run_console(char *infile_name)
 {
     if (!push_file(infile_name)) {
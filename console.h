@@ -53,9 +53,20 @@ void add_param(char *name,
 /* Extract integer from text and store at loc */
 bool get_int(char *vname, int *loc);
 
+/* Extract long integer, as used for element counts, from text into loc */
+bool get_long(char *vname, long *loc);
+
 /* Add function to be executed as part of program exit */
 void add_quit_helper(cmd_function qf);
 
+/*
+ * Optionally supply function that selects target before running a command
+ * written cmd@target, returning false if there is no such target, and that
+ * gets called with NULL afterwards to select the previous target again.
+ */
+typedef bool (*target_function)(char *target);
+void set_target_function(target_function tf);
+
 /* Turn echoing on/off */
 void set_echo(bool on);
 
@@ -78,6 +89,12 @@ int cmd_select(int nfds,
  */
 bool run_console(char *infile_name);
 
+/*
+ * Run commands from file fname in place of any pending input, as done by a
+ * forked process.  Return true if no errors occurred
+ */
+bool run_script(char *fname);
+
 /* Callback function to complete command by linenoise */
 void completion(const char *buf, linenoiseCompletions *lc);
 
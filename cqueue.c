@@ -0,0 +1,282 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cqueue.h"
+#include "harness.h"
+
+#define CQ_MIN_CAP 16
+
+/* Access element i of the pool of q */
+#define NODE(q, i) ((q)->pool[i])
+#define STR(q, i) ((q)->heap + NODE(q, i).offset)
+
+/*
+ * Create empty queue.
+ * Return NULL if could not allocate space.
+ */
+cqueue_t *cq_new()
+{
+    cqueue_t *q = malloc(sizeof(cqueue_t));
+    if (!q)
+        return NULL;
+    memset(q, 0, sizeof(cqueue_t));
+    q->pool_free = CQ_NIL;
+    q->head = q->tail = CQ_NIL;
+    return q;
+}
+
+/* Free all storage used by queue */
+void cq_free(cqueue_t *q)
+{
+    if (!q)
+        return;
+    free(q->pool);
+    free(q->heap);
+    free(q);
+}
+
+/*
+ * Double the pool of q, linking the new elements into the free list.
+ * Return false if could not allocate space.
+ */
+static bool pool_grow(cqueue_t *q)
+{
+    uint32_t cap = q->pool_cap ? q->pool_cap * 2 : CQ_MIN_CAP;
+    if (cap <= q->pool_cap || cap == CQ_NIL)
+        return false;
+    cq_node_t *pool = realloc(q->pool, sizeof(cq_node_t) * cap);
+    if (!pool)
+        return false;
+    for (uint32_t i = q->pool_cap; i < cap; i++)
+        pool[i].next = i + 1 < cap ? i + 1 : q->pool_free;
+    q->pool_free = q->pool_cap;
+    q->pool = pool;
+    q->pool_cap = cap;
+    return true;
+}
+
+/*
+ * Rewrite the strings of q in list order into a new heap of cap bytes,
+ * leaving the garbage behind.
+ * Return false if could not allocate space.
+ */
+static bool heap_compact(cqueue_t *q, size_t cap)
+{
+    char *heap = malloc(cap);
+    if (!heap)
+        return false;
+    size_t used = 0;
+    for (uint32_t i = q->head; i != CQ_NIL; i = NODE(q, i).next) {
+        size_t len = strlen(STR(q, i)) + 1;
+        memcpy(heap + used, STR(q, i), len);
+        NODE(q, i).offset = (uint32_t) used;
+        used += len;
+    }
+    free(q->heap);
+    q->heap = heap;
+    q->heap_cap = cap;
+    q->heap_used = used;
+    q->heap_garbage = 0;
+    return true;
+}
+
+/*
+ * Make room for len more bytes in the string heap of q, dropping garbage
+ * if it takes up half of the heap or if the new string would end past the
+ * reach of 32-bit offsets.
+ * Return false if could not allocate space.
+ */
+static bool heap_reserve(cqueue_t *q, size_t len)
+{
+    size_t live = q->heap_used - q->heap_garbage;
+    if (live + len > UINT32_MAX)
+        return false;
+    bool beyond = q->heap_used + len > UINT32_MAX;
+    if (!beyond && q->heap_used + len <= q->heap_cap)
+        return true;
+    if (beyond || q->heap_garbage >= q->heap_used / 2) {
+        size_t cap = 2 * (live + len);
+        if (cap > UINT32_MAX)
+            cap = UINT32_MAX;
+        return heap_compact(q, cap < CQ_MIN_CAP ? CQ_MIN_CAP : cap);
+    }
+    size_t cap = 2 * q->heap_cap;
+    if (cap > UINT32_MAX)
+        cap = UINT32_MAX;
+    if (cap < q->heap_used + len)
+        cap = q->heap_used + len;
+    char *heap = realloc(q->heap, cap);
+    if (!heap)
+        return false;
+    q->heap = heap;
+    q->heap_cap = cap;
+    return true;
+}
+
+/*
+ * Take a free element of q holding a copy of string s, linked to nothing.
+ * Return CQ_NIL if could not allocate space.
+ */
+static uint32_t node_new(cqueue_t *q, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    if (!heap_reserve(q, len) || (q->pool_free == CQ_NIL && !pool_grow(q)))
+        return CQ_NIL;
+    uint32_t i = q->pool_free;
+    q->pool_free = NODE(q, i).next;
+    memcpy(q->heap + q->heap_used, s, len);
+    NODE(q, i).offset = (uint32_t) q->heap_used;
+    NODE(q, i).next = CQ_NIL;
+    q->heap_used += len;
+    return i;
+}
+
+/*
+ * Attempt to insert element at head of queue.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * Argument s points to the string to be stored.
+ */
+bool cq_insert_head(cqueue_t *q, char *s)
+{
+    if (!q)
+        return false;
+    uint32_t i = node_new(q, s);
+    if (i == CQ_NIL)
+        return false;
+    NODE(q, i).next = q->head;
+    q->head = i;
+    if (q->tail == CQ_NIL)
+        q->tail = i;
+    q->size++;
+    return true;
+}
+
+/*
+ * Attempt to insert element at tail of queue.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * Argument s points to the string to be stored.
+ */
+bool cq_insert_tail(cqueue_t *q, char *s)
+{
+    if (!q)
+        return false;
+    uint32_t i = node_new(q, s);
+    if (i == CQ_NIL)
+        return false;
+    if (q->tail != CQ_NIL)
+        NODE(q, q->tail).next = i;
+    else
+        q->head = i;
+    q->tail = i;
+    q->size++;
+    return true;
+}
+
+/*
+ * Attempt to remove element from head of queue.
+ * Return true if successful.
+ * Return false if queue is NULL or empty.
+ * If sp is non-NULL and an element is removed, copy the removed string to *sp
+ * (up to a maximum of bufsize-1 characters, plus a null terminator.)
+ */
+bool cq_remove_head(cqueue_t *q, char *sp, size_t bufsize)
+{
+    if (!q || !q->size)
+        return false;
+    uint32_t i = q->head;
+    if (sp) {
+        strncpy(sp, STR(q, i), bufsize - 1);
+        sp[bufsize - 1] = '\0';
+    }
+    q->heap_garbage += strlen(STR(q, i)) + 1;
+    q->head = NODE(q, i).next;
+    NODE(q, i).next = q->pool_free;
+    q->pool_free = i;
+    if (--q->size == 0) {
+        q->tail = CQ_NIL;
+        q->heap_used = q->heap_garbage = 0;
+    }
+    return true;
+}
+
+/*
+ * Return number of elements in queue.
+ * Return 0 if q is NULL or empty
+ */
+size_t cq_size(cqueue_t *q)
+{
+    return q ? q->size : 0;
+}
+
+/*
+ * Reverse elements in queue
+ * No effect if q is NULL or empty
+ */
+void cq_reverse(cqueue_t *q)
+{
+    if (!q || q->size < 2)
+        return;
+    uint32_t prev = CQ_NIL, i = q->head;
+    q->tail = i;
+    while (i != CQ_NIL) {
+        uint32_t next = NODE(q, i).next;
+        NODE(q, i).next = prev;
+        prev = i;
+        i = next;
+    }
+    q->head = prev;
+}
+
+/* Merge sort the list of elements of q starting at head, return new head */
+static uint32_t cq_sort_list(cqueue_t *q, uint32_t head)
+{
+    if (head == CQ_NIL || NODE(q, head).next == CQ_NIL)
+        return head;
+
+    uint32_t slow = head, fast = NODE(q, head).next;
+    while (fast != CQ_NIL && NODE(q, fast).next != CQ_NIL) {
+        slow = NODE(q, slow).next;
+        fast = NODE(q, NODE(q, fast).next).next;
+    }
+    uint32_t mid = NODE(q, slow).next;
+    NODE(q, slow).next = CQ_NIL;
+
+    uint32_t a = cq_sort_list(q, head), b = cq_sort_list(q, mid);
+    uint32_t first = CQ_NIL, *link = &first;
+    while (a != CQ_NIL && b != CQ_NIL) {
+        uint32_t *from = strcmp(STR(q, a), STR(q, b)) <= 0 ? &a : &b;
+        *link = *from;
+        link = &NODE(q, *from).next;
+        *from = *link;
+    }
+    *link = a != CQ_NIL ? a : b;
+    return first;
+}
+
+/*
+ * Sort elements of queue in ascending order
+ * No effect if q is NULL or empty.
+ */
+void cq_sort(cqueue_t *q)
+{
+    if (!q || q->size < 2)
+        return;
+    q->head = cq_sort_list(q, q->head);
+    uint32_t i = q->head;
+    while (NODE(q, i).next != CQ_NIL)
+        i = NODE(q, i).next;
+    q->tail = i;
+}
+
+/*
+ * Return number of bytes used by queue, including unused capacity.
+ * Return 0 if q is NULL.
+ */
+size_t cq_memory(cqueue_t *q)
+{
+    if (!q)
+        return 0;
+    return sizeof(cqueue_t) + sizeof(cq_node_t) * q->pool_cap + q->heap_cap;
+}
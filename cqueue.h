@@ -0,0 +1,95 @@
+#ifndef LAB0_CQUEUE_H
+#define LAB0_CQUEUE_H
+
+/*
+ * Compact queue with the semantics of queue.h.
+ * Elements live in a pool array and link to each other through 32-bit
+ * indices, and strings are stored back to back in a string heap, each
+ * element holding the offset of its string. That is 8 bytes of metadata per
+ * element, and without any pointer inside, the whole queue is relocatable.
+ * In exchange, a queue holds less than 2^32 elements and 4 GiB of strings.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Element of the pool, free ones being linked through next */
+typedef struct {
+    uint32_t next;   /* Index of the next element, or CQ_NIL */
+    uint32_t offset; /* Offset of the string in the string heap */
+} cq_node_t;
+
+#define CQ_NIL UINT32_MAX
+
+typedef struct {
+    cq_node_t *pool;
+    uint32_t pool_cap;
+    uint32_t pool_free; /* Head of the list of free elements */
+    char *heap;
+    size_t heap_used;
+    size_t heap_cap;
+    size_t heap_garbage; /* Bytes of strings of removed elements */
+    uint32_t head, tail;
+    size_t size;
+} cqueue_t;
+
+/*
+ * Create empty queue.
+ * Return NULL if could not allocate space.
+ */
+cqueue_t *cq_new();
+
+/* Free all storage used by queue */
+void cq_free(cqueue_t *q);
+
+/*
+ * Attempt to insert element at head of queue.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * Argument s points to the string to be stored.
+ */
+bool cq_insert_head(cqueue_t *q, char *s);
+
+/*
+ * Attempt to insert element at tail of queue.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * Argument s points to the string to be stored.
+ */
+bool cq_insert_tail(cqueue_t *q, char *s);
+
+/*
+ * Attempt to remove element from head of queue.
+ * Return true if successful.
+ * Return false if queue is NULL or empty.
+ * If sp is non-NULL and an element is removed, copy the removed string to *sp
+ * (up to a maximum of bufsize-1 characters, plus a null terminator.)
+ */
+bool cq_remove_head(cqueue_t *q, char *sp, size_t bufsize);
+
+/*
+ * Return number of elements in queue.
+ * Return 0 if q is NULL or empty
+ */
+size_t cq_size(cqueue_t *q);
+
+/*
+ * Reverse elements in queue
+ * No effect if q is NULL or empty
+ */
+void cq_reverse(cqueue_t *q);
+
+/*
+ * Sort elements of queue in ascending order
+ * No effect if q is NULL or empty.
+ */
+void cq_sort(cqueue_t *q);
+
+/*
+ * Return number of bytes used by queue, including unused capacity.
+ * Return 0 if q is NULL.
+ */
+size_t cq_memory(cqueue_t *q);
+
+#endif /* LAB0_CQUEUE_H */
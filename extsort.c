@@ -0,0 +1,363 @@
+/* External merge sort of text files, see extsort.h */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "extsort.h"
+#include "losertree.h"
+#include "report.h"
+
+/* Smallest and largest buffer worth giving a file */
+#define MIN_BUFFER (64 << 10)
+#define MAX_BUFFER (16 << 20)
+
+/* Most runs merged at once, whatever the budget */
+#define MAX_FANIN 1024
+
+/* Temporary run files of a sort, unlinked once merged */
+typedef struct {
+    char (*path)[64];
+    size_t cnt, cap;
+    size_t first; /* Runs before first are merged already */
+    const char *dir;
+} runs_t;
+
+/* A run, or the input, being merged */
+typedef struct {
+    FILE *f;
+    char *line;
+    size_t cap;
+    ssize_t len; /* Negative once exhausted */
+} source_t;
+
+/* Where merged lines go */
+typedef struct {
+    FILE *f;
+    queue_t *q;
+} sink_t;
+
+/*
+ * Line of a run, with its first 8 bytes packed into key in big-endian order,
+ * so that most comparisons while sorting need no access to the line itself
+ */
+typedef struct {
+    uint64_t key;
+    char *s;
+} line_t;
+
+static void line_set(line_t *l, char *s)
+{
+    uint64_t key = 0;
+    int i = 0;
+    for (; i < 8 && s[i]; i++)
+        key = key << 8 | (unsigned char) s[i];
+    l->key = key << (8 * (8 - i));
+    l->s = s;
+}
+
+static int cmp_line(const void *a, const void *b)
+{
+    const line_t *la = a, *lb = b;
+    if (la->key != lb->key)
+        return la->key < lb->key ? -1 : 1;
+    /* Equal keys with a null byte in them mean equal lines */
+    if (!(la->key & 0xff))
+        return 0;
+    return strcmp(la->s + 8, lb->s + 8);
+}
+
+/* Buffer of size bytes for file f, in the limits above */
+static void set_buffer(FILE *f, size_t size)
+{
+    if (size < MIN_BUFFER)
+        size = MIN_BUFFER;
+    if (size > MAX_BUFFER)
+        size = MAX_BUFFER;
+    setvbuf(f, NULL, _IOFBF, size);
+}
+
+/* Create a new run file, returning it opened for writing, or NULL */
+static FILE *run_create(runs_t *runs, size_t bufsize)
+{
+    if (runs->cnt == runs->cap) {
+        size_t cap = runs->cap ? runs->cap * 2 : 16;
+        void *path = realloc(runs->path, cap * sizeof(*runs->path));
+        if (!path)
+            return NULL;
+        runs->path = path;
+        runs->cap = cap;
+    }
+    char *path = runs->path[runs->cnt];
+    snprintf(path, sizeof(*runs->path), "%s/xsort.XXXXXX",
+             runs->dir ? runs->dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return NULL;
+    FILE *f = fdopen(fd, "w");
+    if (!f) {
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+    set_buffer(f, bufsize);
+    runs->cnt++;
+    return f;
+}
+
+/* Emit line to sink, returning whether it succeeded */
+static bool sink_put(sink_t *sink, char *line)
+{
+    if (sink->f)
+        return fputs(line, sink->f) >= 0 && putc('\n', sink->f) != EOF;
+    return q_insert_tail(sink->q, line);
+}
+
+/* Sort n lines and emit them to sink */
+static bool sort_lines(line_t *lines, size_t n, sink_t *sink)
+{
+    qsort(lines, n, sizeof(line_t), cmp_line);
+    for (size_t i = 0; i < n; i++)
+        if (!sink_put(sink, lines[i].s))
+            return false;
+    return true;
+}
+
+/*
+ * Read file in, writing each budget-sized part of it as a sorted run. An
+ * input which fits in one part goes to sink directly instead.
+ */
+static bool make_runs(FILE *in,
+                      size_t budget,
+                      runs_t *runs,
+                      sink_t *sink,
+                      extsort_stats_t *st)
+{
+    /* Half of the budget for keys of lines, the rest for lines */
+    size_t ptr_cap = budget / 2 / sizeof(line_t);
+    size_t cap = budget - ptr_cap * sizeof(line_t);
+    if (ptr_cap < 1)
+        ptr_cap = 1;
+    char *arena = malloc(cap + 1);
+    line_t *lines = malloc(ptr_cap * sizeof(line_t));
+    bool ok = arena && lines;
+
+    size_t fill = 0, parsed = 0, n = 0;
+    bool eof = false;
+    while (ok) {
+        if (!eof && n < ptr_cap && fill < cap) {
+            size_t got = fread(arena + fill, 1, cap - fill, in);
+            fill += got;
+            st->bytes += got;
+            eof = got == 0 || feof(in);
+            ok = !ferror(in);
+        }
+        char *nl;
+        while (n < ptr_cap &&
+               (nl = memchr(arena + parsed, '\n', fill - parsed))) {
+            *nl = '\0';
+            line_set(&lines[n++], arena + parsed);
+            parsed = nl + 1 - arena;
+        }
+        if (eof && n < ptr_cap && parsed < fill) {
+            /* Last line without newline */
+            arena[fill] = '\0';
+            line_set(&lines[n++], arena + parsed);
+            parsed = fill;
+        }
+        if (!eof && n < ptr_cap && fill < cap)
+            continue;
+        if (!ok || (!n && !eof)) {
+            if (ok)
+                report(1, "ERROR: Line longer than memory budget");
+            ok = false;
+            break;
+        }
+
+        st->lines += n;
+        bool last = eof && parsed == fill;
+        if (last && !runs->cnt) {
+            ok = sort_lines(lines, n, sink);
+            break;
+        }
+        if (n) {
+            FILE *f = run_create(runs, budget / 2);
+            sink_t run = {f, NULL};
+            ok = f && sort_lines(lines, n, &run);
+            ok = f && !fclose(f) && ok;
+            st->runs++;
+        }
+        if (last)
+            break;
+        memmove(arena, arena + parsed, fill - parsed);
+        fill -= parsed;
+        parsed = 0;
+        n = 0;
+    }
+
+    free(arena);
+    free(lines);
+    return ok;
+}
+
+/* Read the next line of source s, stripping its newline */
+static bool source_next(source_t *s)
+{
+    s->len = getline(&s->line, &s->cap, s->f);
+    if (s->len > 0 && s->line[s->len - 1] == '\n')
+        s->line[--s->len] = '\0';
+    return s->len >= 0 || !ferror(s->f);
+}
+
+static bool source_less(int a, int b, void *arg)
+{
+    source_t *src = arg;
+    if (src[a].len < 0)
+        return false;
+    if (src[b].len < 0)
+        return true;
+    int c = strcmp(src[a].line, src[b].line);
+    return c < 0 || (c == 0 && a < b);
+}
+
+/* Merge runs first to first + n - 1 into sink, unlinking them */
+static bool merge_runs(runs_t *runs, size_t n, size_t budget, sink_t *sink)
+{
+    source_t *src = calloc(n, sizeof(source_t));
+    int *node = malloc(n * sizeof(int));
+    bool ok = src && node;
+    for (size_t i = 0; ok && i < n; i++) {
+        src[i].f = fopen(runs->path[runs->first + i], "r");
+        ok = src[i].f != NULL;
+        if (ok) {
+            set_buffer(src[i].f, budget / (n + 1));
+            ok = source_next(&src[i]);
+        }
+    }
+
+    if (ok) {
+        losertree_t lt;
+        lt_init(&lt, node, n, source_less, src);
+        while (ok) {
+            source_t *w = &src[lt_winner(&lt)];
+            if (w->len < 0)
+                break;
+            ok = sink_put(sink, w->line) && source_next(w);
+            lt_replay(&lt);
+        }
+    }
+
+    for (size_t i = 0; src && i < n; i++) {
+        if (src[i].f)
+            fclose(src[i].f);
+        free(src[i].line);
+        unlink(runs->path[runs->first + i]);
+    }
+    runs->first += n;
+    free(src);
+    free(node);
+    return ok;
+}
+
+bool extsort(const char *in,
+             const char *out,
+             queue_t *q,
+             size_t budget,
+             const char *tmpdir,
+             extsort_stats_t *stats)
+{
+    extsort_stats_t st;
+    memset(&st, 0, sizeof(st));
+    if (budget < 2 * MIN_BUFFER)
+        budget = 2 * MIN_BUFFER;
+    size_t fanin = budget / MIN_BUFFER - 1;
+    if (fanin > MAX_FANIN)
+        fanin = MAX_FANIN;
+
+    FILE *fin = fopen(in, "r");
+    if (!fin)
+        return false;
+    set_buffer(fin, budget / 8);
+    sink_t sink = {NULL, q};
+    if (out) {
+        sink.f = fopen(out, "w");
+        if (!sink.f) {
+            fclose(fin);
+            return false;
+        }
+        set_buffer(sink.f, budget / 8);
+    }
+
+    runs_t runs = {NULL, 0, 0, 0, tmpdir};
+    double t;
+    init_time(&t);
+    bool ok = make_runs(fin, budget, &runs, &sink, &st);
+    fclose(fin);
+    st.run_time = delta_time(&t);
+
+    /* Merge groups of runs into longer ones until one pass merges all */
+    while (ok && runs.cnt - runs.first > fanin) {
+        size_t end = runs.cnt;
+        while (ok && runs.first < end) {
+            size_t n = end - runs.first < fanin ? end - runs.first : fanin;
+            FILE *f = run_create(&runs, budget / (n + 1));
+            sink_t run = {f, NULL};
+            ok = f && merge_runs(&runs, n, budget, &run);
+            ok = f && !fclose(f) && ok;
+        }
+        st.passes++;
+    }
+    if (ok && runs.cnt > runs.first) {
+        ok = merge_runs(&runs, runs.cnt - runs.first, budget, &sink);
+        st.passes++;
+    }
+    st.merge_time = delta_time(&t);
+
+    for (size_t i = runs.first; i < runs.cnt; i++)
+        unlink(runs.path[i]);
+    free(runs.path);
+    if (sink.f && fclose(sink.f))
+        ok = false;
+    if (stats)
+        *stats = st;
+    return ok;
+}
+
+/* Step the xorshift64 generator in *x, as rand() would take most time */
+static uint64_t xorshift(uint64_t *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+bool extsort_generate(const char *out, size_t bytes, unsigned seed)
+{
+    static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
+    FILE *f = fopen(out, "w");
+    if (!f)
+        return false;
+    set_buffer(f, MAX_BUFFER);
+
+    uint64_t x = 0x9E3779B97F4A7C15ULL ^ seed;
+    char line[16];
+    bool ok = true;
+    for (size_t written = 0; ok && written < bytes;) {
+        int len = 5 + xorshift(&x) % 11;
+        uint64_t r = 0;
+        /* 26^12 < 2^64, so that one step gives 12 letters */
+        for (int i = 0; i < len; i++, r /= 26) {
+            if (i % 12 == 0)
+                r = xorshift(&x);
+            line[i] = charset[r % 26];
+        }
+        line[len] = '\n';
+        ok = fwrite(line, 1, len + 1, f) == (size_t) len + 1;
+        written += len + 1;
+    }
+    return !fclose(f) && ok;
+}
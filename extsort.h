@@ -0,0 +1,49 @@
+#ifndef LAB0_EXTSORT_H
+#define LAB0_EXTSORT_H
+
+/*
+ * External merge sort of text files with one string per line, for inputs
+ * larger than memory.
+ * The input is read in runs that fit a memory budget, each run is sorted and
+ * written to a temporary run file, and the run files are merged with a loser
+ * tree, reading and writing through large buffers. When there are too many
+ * runs for the budget to give each a useful buffer, groups of them are
+ * merged into longer runs first.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+/* Counters of an external sort */
+typedef struct {
+    size_t lines;  /* Strings sorted */
+    size_t bytes;  /* Bytes of input */
+    size_t runs;   /* Runs written by the first pass */
+    size_t passes; /* Merge passes, including the final one */
+    double run_time, merge_time;
+} extsort_stats_t;
+
+/*
+ * Sort the lines of file in, using about budget bytes of memory and run
+ * files in directory tmpdir, or /tmp if tmpdir is NULL. Write the sorted
+ * lines to file out if non-NULL, or else insert them at the tail of queue q.
+ * Return true if successful, filling stats if non-NULL.
+ * Return false if could not read or write a file or allocate space.
+ */
+bool extsort(const char *in,
+             const char *out,
+             queue_t *q,
+             size_t budget,
+             const char *tmpdir,
+             extsort_stats_t *stats);
+
+/*
+ * Write random lines of lowercase letters to file out until it has at least
+ * bytes bytes, generating them from seed.
+ * Return true if successful.
+ */
+bool extsort_generate(const char *out, size_t bytes, unsigned seed);
+
+#endif /* LAB0_EXTSORT_H */
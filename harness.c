@@ -1,5 +1,6 @@
 /* Test support code */
 
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdio.h>
@@ -41,18 +42,24 @@ typedef struct BELE {
     /* Also place magic number at tail of every block */
 } block_ele_t;
 
+/* Guards the list of allocated blocks, as queues may be freed by a thread */
+static pthread_mutex_t allocated_lock = PTHREAD_MUTEX_INITIALIZER;
 static block_ele_t *allocated = NULL;
 static size_t allocated_count = 0;
+static size_t allocated_bytes = 0;
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
 static bool cautious_mode = true;
 static bool noallocate_mode = false;
+/* Thread which first set either mode above, once any did */
+static pthread_t mode_thread;
+static bool mode_thread_set = false;
 static bool error_occurred = false;
 static char *error_message = "";
 
-static int time_limit = 1;
+int time_limit = 1;
 
 /*
  * Data for managing exceptions
@@ -61,10 +68,33 @@ static jmp_buf env;
 static volatile sig_atomic_t jmp_ready = false;
 static bool time_limited = false;
 
+/* Holds taken by this thread, and the message of an exception held off */
+static __thread volatile sig_atomic_t holds = 0;
+static __thread char *volatile held_message = NULL;
+
 /*
  * Internal functions
  */
 
+/*
+ * Whether cautious and restricted allocation modes apply to the calling
+ * thread.  They only apply to the thread which set them first, so that a
+ * thread freeing queues in the background is not caught by them.
+ */
+static bool modes_apply()
+{
+    return !mode_thread_set || pthread_equal(mode_thread, pthread_self());
+}
+
+/* Tie modes to the calling thread, unless tied to a thread already */
+static void claim_modes()
+{
+    if (!mode_thread_set) {
+        mode_thread = pthread_self();
+        mode_thread_set = true;
+    }
+}
+
 /* Should this allocation fail? */
 static bool fail_allocation()
 {
@@ -84,7 +114,7 @@ static block_ele_t *find_header(void *p)
     }
 
     block_ele_t *b = (block_ele_t *) ((size_t) p - sizeof(block_ele_t));
-    if (cautious_mode) {
+    if (modes_apply() && cautious_mode) {
         /* Make sure this is really an allocated block */
         block_ele_t *ab = allocated;
         bool found = false;
@@ -119,12 +149,23 @@ static size_t *find_footer(block_ele_t *b)
     return p;
 }
 
-/*
- * Implementation of application functions
- */
-void *test_malloc(size_t size)
+/* Take the lock of the list of allocated blocks, see exception_hold */
+static void lock_allocated()
+{
+    exception_hold();
+    pthread_mutex_lock(&allocated_lock);
+}
+
+static void unlock_allocated()
 {
-    if (noallocate_mode) {
+    pthread_mutex_unlock(&allocated_lock);
+    exception_release();
+}
+
+/* Allocate a block of size bytes and add it to the list */
+static void *block_alloc(size_t size)
+{
+    if (modes_apply() && noallocate_mode) {
         report_event(MSG_FATAL, "Calls to malloc disallowed");
         return NULL;
     }
@@ -148,6 +189,7 @@ void *test_malloc(size_t size)
     *find_footer(new_block) = MAGICFOOTER;
     void *p = (void *) &new_block->payload;
     memset(p, FILLCHAR, size);
+    lock_allocated();
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->next = allocated;
     // cppcheck-suppress nullPointerRedundantCheck
@@ -157,25 +199,16 @@ void *test_malloc(size_t size)
         allocated->prev = new_block;
     allocated = new_block;
     allocated_count++;
+    allocated_bytes += size;
+    unlock_allocated();
 
     return p;
 }
 
-// cppcheck-suppress unusedFunction
-void *test_calloc(size_t nelem, size_t elsize)
-{
-    /* Reference: Malloc tutorial
-     * https://danluu.com/malloc-tutorial/
-     */
-    size_t size = nelem * elsize;  // TODO: check for overflow
-    void *ptr = test_malloc(size);
-    memset(ptr, 0, size);
-    return ptr;
-}
-
-void test_free(void *p)
+/* Remove the block of payload p from the list and free it */
+static void block_free(void *p)
 {
-    if (noallocate_mode) {
+    if (modes_apply() && noallocate_mode) {
         report_event(MSG_FATAL, "Calls to free disallowed");
         return;
     }
@@ -183,6 +216,7 @@ void test_free(void *p)
     if (!p)
         return;
 
+    lock_allocated();
     block_ele_t *b = find_header(p);
     size_t footer = *find_footer(b);
     if (footer != MAGICFOOTER) {
@@ -206,8 +240,43 @@ void test_free(void *p)
     if (bn)
         bn->prev = bp;
 
-    free(b);
+    allocated_bytes -= b->payload_size;
     allocated_count--;
+    unlock_allocated();
+    free(b);
+}
+
+/*
+ * Implementation of application functions
+ *
+ * The time limit waits until they return, since jumping out of them would
+ * leave locks of the C library or of the list of blocks held.
+ */
+void *test_malloc(size_t size)
+{
+    exception_hold();
+    void *p = block_alloc(size);
+    exception_release();
+    return p;
+}
+
+// cppcheck-suppress unusedFunction
+void *test_calloc(size_t nelem, size_t elsize)
+{
+    /* Reference: Malloc tutorial
+     * https://danluu.com/malloc-tutorial/
+     */
+    size_t size = nelem * elsize;  // TODO: check for overflow
+    void *ptr = test_malloc(size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+void test_free(void *p)
+{
+    exception_hold();
+    block_free(p);
+    exception_release();
 }
 
 // cppcheck-suppress unusedFunction
@@ -221,9 +290,40 @@ char *test_strdup(const char *s)
     return (char *) memcpy(new, s, len);
 }
 
+/*
+ * Always move the block, so that code holding on to the old address gets
+ * caught.
+ */
+void *test_realloc(void *p, size_t size)
+{
+    if (!p)
+        return test_malloc(size);
+
+    lock_allocated();
+    size_t old_size = find_header(p)->payload_size;
+    unlock_allocated();
+    void *new = test_malloc(size);
+    if (!new)
+        return NULL;
+    memcpy(new, p, old_size < size ? old_size : size);
+    test_free(p);
+    return new;
+}
+
 size_t allocation_check()
 {
-    return allocated_count;
+    lock_allocated();
+    size_t cnt = allocated_count;
+    unlock_allocated();
+    return cnt;
+}
+
+size_t allocation_bytes()
+{
+    lock_allocated();
+    size_t bytes = allocated_bytes;
+    unlock_allocated();
+    return bytes;
 }
 
 /*
@@ -236,6 +336,7 @@ size_t allocation_check()
  */
 void set_cautious_mode(bool cautious)
 {
+    claim_modes();
     cautious_mode = cautious;
 }
 
@@ -245,6 +346,7 @@ void set_cautious_mode(bool cautious)
  */
 void set_noallocate_mode(bool noallocate)
 {
+    claim_modes();
     noallocate_mode = noallocate;
 }
 
@@ -301,11 +403,36 @@ void exception_cancel()
     error_message = "";
 }
 
+/*
+ * Hold off exceptions while the calling thread holds a lock
+ */
+void exception_hold()
+{
+    holds = holds + 1;
+}
+
+/*
+ * Raise the exception held off meanwhile, if any, once no lock is held
+ */
+void exception_release()
+{
+    holds = holds - 1;
+    if (!holds && held_message) {
+        char *msg = held_message;
+        held_message = NULL;
+        trigger_exception(msg);
+    }
+}
+
 /*
  * Use longjmp to return to most recent exception setup
  */
 void trigger_exception(char *msg)
 {
+    if (holds) {
+        held_message = msg;
+        return;
+    }
     error_occurred = true;
     error_message = msg;
     if (jmp_ready)
@@ -15,19 +15,36 @@ void *test_malloc(size_t size);
 void *test_calloc(size_t nmemb, size_t size);
 void test_free(void *p);
 char *test_strdup(const char *s);
-/* FIXME: provide test_realloc as well */
+void *test_realloc(void *p, size_t size);
+
+/*
+ * Hold off exceptions, such as the time limit expiring, while the calling
+ * thread holds a lock, so that jumping out does not leave it held. Each
+ * exception_hold takes one exception_release, and an exception raised
+ * meanwhile jumps once the last one is released.
+ */
+void exception_hold();
+void exception_release();
 
 #ifdef INTERNAL
 
 /* Report number of allocated blocks */
 size_t allocation_check();
 
+/* Report number of bytes requested by allocated blocks */
+size_t allocation_bytes();
+
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/* Time limit of each risky operation, in seconds */
+extern int time_limit;
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
+ * This and restricted allocation mode only apply to the thread which first
+ * set either of them.
  */
 void set_cautious_mode(bool cautious);
 
@@ -55,6 +72,7 @@ void exception_cancel();
 
 /*
  * Use longjmp to return to most recent exception setup.  Include error message
+ * Wait for exception_release if the calling thread holds off exceptions.
  */
 void trigger_exception(char *msg);
 
@@ -63,6 +81,7 @@ void trigger_exception(char *msg);
 /* Tested program use our versions of malloc and free */
 #define malloc test_malloc
 #define free test_free
+#define realloc test_realloc
 
 /* Use undef to avoid strdup redefined error */
 #undef strdup
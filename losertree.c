@@ -0,0 +1,49 @@
+#include "losertree.h"
+
+/*
+ * Play all first matches among k > 0 sources.
+ * Source i enters at leaf k + i, so that every internal node has two
+ * children. The first source to reach a node waits there for the second,
+ * then the loser stays and the winner moves on.
+ */
+void lt_init(losertree_t *lt, int *node, int k, lt_less_t less, void *arg)
+{
+    lt->k = k;
+    lt->node = node;
+    lt->less = less;
+    lt->arg = arg;
+    for (int p = 0; p < k; p++)
+        node[p] = -1;
+    node[0] = 0;
+    for (int i = 0; i < k; i++) {
+        int w = i;
+        int p = (k + i) / 2;
+        for (; p > 0; p /= 2) {
+            if (node[p] < 0) {
+                node[p] = w;
+                break;
+            }
+            if (less(node[p], w, arg)) {
+                int t = node[p];
+                node[p] = w;
+                w = t;
+            }
+        }
+        if (!p)
+            node[0] = w;
+    }
+}
+
+/* Find the next winner after the current one advanced to its next element */
+void lt_replay(losertree_t *lt)
+{
+    int w = lt->node[0];
+    for (int p = (lt->k + w) / 2; p > 0; p /= 2) {
+        if (lt->less(lt->node[p], w, lt->arg)) {
+            int t = lt->node[p];
+            lt->node[p] = w;
+            w = t;
+        }
+    }
+    lt->node[0] = w;
+}
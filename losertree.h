@@ -0,0 +1,43 @@
+#ifndef LAB0_LOSERTREE_H
+#define LAB0_LOSERTREE_H
+
+/*
+ * Tournament tree of losers for k-way merging.
+ * Sources are numbered 0 to k-1. Each internal node keeps the loser of the
+ * match played there, so that after the winning source advances, finding
+ * the next winner replays only the matches on its path to the root, at one
+ * comparison per level, or log2(k) comparisons per element merged.
+ * The tree works on storage given by its user and never allocates.
+ */
+
+#include <stdbool.h>
+
+/*
+ * Return whether the current element of source a goes before that of source
+ * b. Exhausted sources must go after all others.
+ */
+typedef bool (*lt_less_t)(int a, int b, void *arg);
+
+typedef struct {
+    int k;
+    int *node; /* node[0] is the winner, node[1] to node[k-1] losers */
+    lt_less_t less;
+    void *arg;
+} losertree_t;
+
+/*
+ * Play all first matches among k > 0 sources, using node, an array of k
+ * ints, as storage for the tree.
+ */
+void lt_init(losertree_t *lt, int *node, int k, lt_less_t less, void *arg);
+
+/* Return the source holding the first element of all */
+static inline int lt_winner(const losertree_t *lt)
+{
+    return lt->node[0];
+}
+
+/* Find the next winner after the current one advanced to its next element */
+void lt_replay(losertree_t *lt);
+
+#endif /* LAB0_LOSERTREE_H */
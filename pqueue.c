@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "pqueue.h"
+
+static inline pq_node_t *sibling(const pq_node_t *n)
+{
+    return (pq_node_t *) n->ele.next;
+}
+
+/* Meld two heaps without siblings into one, returning its root */
+static pq_node_t *meld(pq_node_t *a, pq_node_t *b)
+{
+    if (strcmp(b->ele.value, a->ele.value) < 0) {
+        pq_node_t *t = a;
+        a = b;
+        b = t;
+    }
+    b->ele.next = (list_ele_t *) a->child;
+    a->child = b;
+    return a;
+}
+
+/*
+ * Meld a list of sibling heaps into one: first pairwise from left to right,
+ * pushing each pair onto a stack, then popping them into the result.
+ */
+static pq_node_t *meld_siblings(pq_node_t *first)
+{
+    pq_node_t *stack = NULL;
+    while (first) {
+        pq_node_t *a = first, *b = sibling(a);
+        if (b) {
+            first = sibling(b);
+            a->ele.next = b->ele.next = NULL;
+            a = meld(a, b);
+        } else
+            first = NULL;
+        a->ele.next = (list_ele_t *) stack;
+        stack = a;
+    }
+
+    pq_node_t *root = stack;
+    if (root) {
+        stack = sibling(root);
+        root->ele.next = NULL;
+    }
+    while (stack) {
+        pq_node_t *n = stack;
+        stack = sibling(n);
+        n->ele.next = NULL;
+        root = meld(n, root);
+    }
+    return root;
+}
+
+pqueue_t *pq_new()
+{
+    pqueue_t *pq = malloc(sizeof(pqueue_t));
+    if (!pq)
+        return NULL;
+    pq->root = NULL;
+    pq->size = 0;
+    return pq;
+}
+
+void pq_free(pqueue_t *pq)
+{
+    if (!pq)
+        return;
+    /*
+     * Seen as a binary tree with children on the left and siblings on the
+     * right, rotate left subtrees up until the node at hand has none.
+     */
+    pq_node_t *n = pq->root;
+    while (n) {
+        pq_node_t *c = n->child;
+        if (c) {
+            n->child = sibling(c);
+            c->ele.next = (list_ele_t *) n;
+            n = c;
+        } else {
+            pq_node_t *next = sibling(n);
+            free(n->ele.value);
+            free(n);
+            n = next;
+        }
+    }
+    free(pq);
+}
+
+bool pq_insert(pqueue_t *pq, char *s)
+{
+    if (!pq)
+        return false;
+    pq_node_t *n = malloc(sizeof(pq_node_t));
+    if (!n)
+        return false;
+    n->ele.value = strdup(s);
+    if (!n->ele.value) {
+        free(n);
+        return false;
+    }
+    n->ele.next = NULL;
+    n->child = NULL;
+    pq->root = pq->root ? meld(pq->root, n) : n;
+    pq->size++;
+    return true;
+}
+
+bool pq_remove_min(pqueue_t *pq, char *sp, size_t bufsize)
+{
+    if (!pq || !pq->root)
+        return false;
+    pq_node_t *n = pq->root;
+    pq->root = meld_siblings(n->child);
+    pq->size--;
+    if (sp && bufsize) {
+        strncpy(sp, n->ele.value, bufsize - 1);
+        sp[bufsize - 1] = '\0';
+    }
+    free(n->ele.value);
+    free(n);
+    return true;
+}
+
+const char *pq_peek(pqueue_t *pq)
+{
+    return pq && pq->root ? pq->root->ele.value : NULL;
+}
+
+size_t pq_size(pqueue_t *pq)
+{
+    return pq ? pq->size : 0;
+}
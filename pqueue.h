@@ -0,0 +1,72 @@
+#ifndef LAB0_PQUEUE_H
+#define LAB0_PQUEUE_H
+
+/*
+ * Priority queue of strings, removing the smallest one first.
+ * It is a pairing heap: every node keeps its children in a list, linked
+ * through the next field of the list element it embeds, and the smallest
+ * string sits at the root. Inserting melds a new node with the root in O(1),
+ * and removing the root melds its children pairwise, then from right to left,
+ * in O(log n) amortized time.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+typedef struct PQNODE {
+    list_ele_t ele; /* ele.next links to the next sibling */
+    struct PQNODE *child;
+} pq_node_t;
+
+typedef struct {
+    pq_node_t *root;
+    size_t size;
+} pqueue_t;
+
+/*
+ * Create empty priority queue.
+ * Return NULL if could not allocate space.
+ */
+pqueue_t *pq_new();
+
+/*
+ * Free all storage used by priority queue.
+ * No effect if pq is NULL
+ */
+void pq_free(pqueue_t *pq);
+
+/*
+ * Attempt to insert element into priority queue.
+ * Return true if successful.
+ * Return false if pq is NULL or could not allocate space.
+ * Argument s points to the string to be stored.
+ * The function explicitly allocates space and copies the string into it.
+ */
+bool pq_insert(pqueue_t *pq, char *s);
+
+/*
+ * Attempt to remove element with the smallest string from priority queue.
+ * Equal strings leave in unspecified order.
+ * Return true if successful.
+ * Return false if pq is NULL or empty.
+ * If sp is non-NULL and an element is removed, copy the removed string to *sp
+ * (up to a maximum of bufsize-1 characters, plus a null terminator.)
+ * The space used by the element and the string is freed.
+ */
+bool pq_remove_min(pqueue_t *pq, char *sp, size_t bufsize);
+
+/*
+ * Return the smallest string of priority queue, without removing it.
+ * Return NULL if pq is NULL or empty.
+ */
+const char *pq_peek(pqueue_t *pq);
+
+/*
+ * Return number of elements in priority queue.
+ * Return 0 if pq is NULL or empty
+ */
+size_t pq_size(pqueue_t *pq);
+
+#endif /* LAB0_PQUEUE_H */
@@ -2,13 +2,16 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h> /* strcasecmp */
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
@@ -32,8 +35,15 @@
  */
 #include "queue.h"
 
+#include "bench.h"
 #include "console.h"
+#include "extsort.h"
 #include "report.h"
+#include "pqueue.h"
+#include "shqueue.h"
+#include "tqueue.h"
+#include "wal.h"
+#include "zygote.h"
 
 /* Settable parameters */
 
@@ -55,20 +65,86 @@ static queue_t *q = NULL;
 /* Number of elements in queue */
 static size_t qcnt = 0;
 
+/*
+ * Queues known by name. The one in use lives in q and qcnt, and gets stored
+ * back into its slot when another one is used.
+ */
+typedef struct {
+    char *name;
+    queue_t *q;
+    size_t cnt;
+} named_queue_t;
+
+static named_queue_t *queues = NULL;
+static size_t queue_cnt = 0, queue_cap = 0;
+static size_t current = 0, previous = 0;
+
 /* How many times can queue operations fail */
 static int fail_limit = BIG_QUEUE;
 static int fail_count = 0;
 
 static int string_length = MAXSTRING;
 
+/* Whether to call q_defrag after each sort */
+static int auto_defrag = 0;
+
+/* Most elements ih and it keep, dropping the oldest beyond it, or 0 */
+static int keep_limit = 0;
+
+/* Whether q_free hands queues over to a background thread */
+static int reclaim = 0;
+
+/* Memory budget of xsort, in KiB */
+static int xsort_budget = 64 << 10;
+
+/* Write-ahead log of one of the queues, and how it groups commits */
+static wal_t *wal = NULL;
+static int wal_interval = 1000;
+static int wal_batch = 4096;
+
+/*
+ * Socket the log ships to while serving a follower, the follower process
+ * forked for it if any, and whether the log only ships
+ */
+static bool repl_serving = false;
+static pid_t repl_child = 0;
+static bool repl_own_wal = false;
+
+/*
+ * Snapshots taken by the snap command, with the number of elements and the
+ * digest of the strings each had when taken
+ */
+#define MAXSNAPS 16
+static struct {
+    qsnap_t *s;
+    size_t cnt;
+    uint64_t digest;
+} snaps[MAXSNAPS];
+
+/* Tiered queue, driven by its own commands, and its number of elements */
+static tqueue_t *tq = NULL;
+static size_t tqcnt = 0;
+
+/* Priority queue, driven by its own commands, and its number of elements */
+static pqueue_t *pq = NULL;
+static size_t pqcnt = 0;
+
+/*
+ * Mapping of a queue in shared memory, driven by its own commands.
+ * Other processes change it too, so no count of its elements is kept.
+ */
+static shqueue_t *shq = NULL;
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
 
 /* Forward declarations */
 static bool show_queue(int vlevel);
+static bool defrag_queue();
 static bool do_new(int argc, char *argv[]);
 static bool do_free(int argc, char *argv[]);
+static bool do_sync(int argc, char *argv[]);
 static bool do_insert_head(int argc, char *argv[]);
 static bool do_insert_tail(int argc, char *argv[]);
 static bool do_remove_head(int argc, char *argv[]);
@@ -76,14 +152,160 @@ static bool do_remove_head_quiet(int argc, char *argv[]);
 static bool do_reverse(int argc, char *argv[]);
 static bool do_size(int argc, char *argv[]);
 static bool do_sort(int argc, char *argv[]);
+static bool do_sortk(int argc, char *argv[]);
+static bool do_unique(int argc, char *argv[]);
+static bool do_index(int argc, char *argv[]);
+static bool do_find(int argc, char *argv[]);
+static bool do_remove_value(int argc, char *argv[]);
+static bool do_ordered(int argc, char *argv[]);
+static bool do_insert_sorted(int argc, char *argv[]);
+static bool do_range(int argc, char *argv[]);
+static bool do_rank(int argc, char *argv[]);
+static bool do_positions(int argc, char *argv[]);
+static bool do_get(int argc, char *argv[]);
+static bool do_sample(int argc, char *argv[]);
+static bool do_insert_at(int argc, char *argv[]);
+static bool do_remove_at(int argc, char *argv[]);
+static bool do_compact(int argc, char *argv[]);
+static bool do_defrag(int argc, char *argv[]);
 static bool do_show(int argc, char *argv[]);
+static bool do_tier_new(int argc, char *argv[]);
+static bool do_tier_insert(int argc, char *argv[]);
+static bool do_tier_remove(int argc, char *argv[]);
+static bool do_tier_stats(int argc, char *argv[]);
+static bool do_tier_free(int argc, char *argv[]);
+static bool do_generate(int argc, char *argv[]);
+static bool do_xsort(int argc, char *argv[]);
+static bool do_merge(int argc, char *argv[]);
+static bool do_rotate(int argc, char *argv[]);
+static bool do_use(int argc, char *argv[]);
+static bool do_concat(int argc, char *argv[]);
+static bool do_split(int argc, char *argv[]);
+static bool do_stats(int argc, char *argv[]);
+static bool do_pq_new(int argc, char *argv[]);
+static bool do_pq_insert(int argc, char *argv[]);
+static bool do_pq_remove(int argc, char *argv[]);
+static bool do_pq_free(int argc, char *argv[]);
+static bool do_insert_ttl(int argc, char *argv[]);
+static bool do_tick(int argc, char *argv[]);
+static bool do_shm_new(int argc, char *argv[]);
+static bool do_shm_attach(int argc, char *argv[]);
+static bool do_shm_detach(int argc, char *argv[]);
+static bool do_shm_unlink(int argc, char *argv[]);
+static bool do_shm_insert(int argc, char *argv[]);
+static bool do_shm_remove(int argc, char *argv[]);
+static bool do_shm_stats(int argc, char *argv[]);
+static bool do_wal(int argc, char *argv[]);
+static bool do_repl(int argc, char *argv[]);
+static bool do_snap(int argc, char *argv[]);
 
 static void queue_init();
 
+/* Start or stop the background thread of q_free as reclaim changed */
+static void set_reclaim(int oldval)
+{
+    if (!q_free_async(reclaim)) {
+        report(1, "ERROR: Could not start thread to free queues");
+        reclaim = 0;
+    }
+}
+
+/* Return the index of the queue called name, or queue_cnt if there is none */
+static size_t find_queue(const char *name)
+{
+    size_t i = 0;
+    while (i < queue_cnt && strcmp(queues[i].name, name))
+        i++;
+    return i;
+}
+
+/* Return the index of the queue called name, adding it with no queue */
+static size_t add_queue(char *name)
+{
+    size_t i = find_queue(name);
+    if (i < queue_cnt)
+        return i;
+    if (queue_cnt == queue_cap) {
+        size_t cap = queue_cap ? 2 * queue_cap : 16;
+        named_queue_t *table =
+            calloc_or_fail(cap, sizeof(named_queue_t), "add_queue");
+        if (queue_cnt)
+            memcpy(table, queues, queue_cnt * sizeof(named_queue_t));
+        free_array(queues, queue_cap, sizeof(named_queue_t));
+        queues = table;
+        queue_cap = cap;
+    }
+    queues[i].name = strsave_or_fail(name, "add_queue");
+    queues[i].q = NULL;
+    queues[i].cnt = 0;
+    queue_cnt++;
+    return i;
+}
+
+/* Store the queue in use back into its slot, and use queue i instead */
+static void use_queue(size_t i)
+{
+    queues[current].q = q;
+    queues[current].cnt = qcnt;
+    current = i;
+    q = queues[i].q;
+    qcnt = queues[i].cnt;
+}
+
+/*
+ * Return the number of queues which exist, including the one in use, and of
+ * snapshots, which may hold elements of freed queues
+ */
+static size_t live_queues()
+{
+    size_t cnt = q ? 1 : 0;
+    for (size_t i = 0; i < queue_cnt; i++)
+        if (i != current && queues[i].q)
+            cnt++;
+    for (int i = 0; i < MAXSNAPS; i++)
+        if (snaps[i].s)
+            cnt++;
+    return cnt;
+}
+
+/* Use queue target while running cmd@target, see set_target_function */
+static bool select_target(char *target)
+{
+    if (!target) {
+        use_queue(previous);
+        return true;
+    }
+    size_t i = find_queue(target);
+    if (i == queue_cnt) {
+        report(1, "Unknown queue '%s'", target);
+        return false;
+    }
+    previous = current;
+    use_queue(i);
+    return true;
+}
+
 static void console_init()
 {
-    add_cmd("new", do_new, "                | Create new queue");
+    add_cmd("new", do_new,
+            " [name] [n]     | Create new queue, or n queues name0, name1, ... "
+            "and use the queue (default: name == current queue, n == 1)");
     add_cmd("free", do_free, "                | Delete queue");
+    add_cmd("use", do_use,
+            " name           | Use queue name, as cmd@name does for one "
+            "command (initially: name == main)");
+    add_cmd("concat", do_concat,
+            " name           | Move all elements of queue name to tail of "
+            "queue");
+    add_cmd("split", do_split,
+            " n name         | Move first n elements of queue to new queue "
+            "name");
+    add_cmd("stats", do_stats,
+            "                | Check all queues and show total elements, "
+            "allocated blocks and bytes");
+    add_cmd("sync", do_sync,
+            "                | Wait for queues freed in the background, then "
+            "check for leaks");
     add_cmd("ih", do_insert_head,
             " str [n]        | Insert string str at head of queue n times. "
             "Generate random string(s) if str equals RAND. (default: n == 1)");
@@ -98,28 +320,213 @@ static void console_init()
         "                | Remove from head of queue without reporting value.");
     add_cmd("reverse", do_reverse, "                | Reverse queue");
     add_cmd("sort", do_sort, "                | Sort queue in ascending order");
+    add_cmd("sortk", do_sortk,
+            " k              | Move k smallest elements to head in ascending "
+            "order, timed against full sort");
+    add_cmd("unique", do_unique,
+            " [first]        | Remove duplicate strings, keeping the first "
+            "(first == 1) or last (first == 0) occurrence (default: first == "
+            "1)");
+    add_cmd("index", do_index,
+            " [on]           | Build (on == 1) or drop (on == 0) hash index "
+            "of queue, or show its memory usage");
+    add_cmd("find", do_find,
+            " str [expect]   | Check whether str is in queue.  Optionally "
+            "compare to expected result (1 or 0)");
+    add_cmd("rmv", do_remove_value,
+            " str            | Remove one occurrence of str from queue");
+    add_cmd("ordered", do_ordered,
+            " [on]           | Keep queue sorted with a skip index (on == 1) "
+            "or drop it (on == 0)");
+    add_cmd("is", do_insert_sorted,
+            " str [n]        | Insert string str into sorted queue n times. "
+            "Generate random string(s) if str equals RAND. (default: n == 1)");
+    add_cmd("range", do_range,
+            " lo hi          | Show strings s of queue with lo <= s < hi");
+    add_cmd("rank", do_rank,
+            " str [expect]   | Count strings of queue less than str.  "
+            "Optionally compare to expected count");
+    add_cmd("positions", do_positions,
+            " [on]           | Build (on == 1) or drop (on == 0) skip index "
+            "over positions of queue");
+    add_cmd("get", do_get,
+            " i [str]        | Show string at index i.  Optionally compare to "
+            "expected value str");
+    add_cmd("sample", do_sample,
+            " k              | Show k strings at random indices of queue");
+    add_cmd("ia", do_insert_at,
+            " i str          | Insert string str at index i of queue");
+    add_cmd("ra", do_remove_at,
+            " i [str]        | Remove string at index i of queue.  Optionally "
+            "compare to expected value str");
+    add_cmd("compact", do_compact,
+            " [on]           | Front-code queue (on == 1) or decode it back "
+            "(on == 0), reporting memory use and decoding speed");
+    add_cmd("defrag", do_defrag,
+            "                | Copy queue into fresh memory in list order, "
+            "timing traversal before and after");
     add_cmd("size", do_size,
             " [n]            | Compute queue size n times (default: n == 1)");
     add_cmd("show", do_show, "                | Show queue contents");
+    add_cmd("tnew", do_tier_new,
+            " [limit]        | Create new tiered queue keeping limit bytes in "
+            "memory (default: limit == 1048576)");
+    add_cmd("tit", do_tier_insert,
+            " str [n]        | Insert string str at tail of tiered queue n "
+            "times. Generate random string(s) if str equals RAND");
+    add_cmd("trh", do_tier_remove,
+            " [str] [n]      | Remove from head of tiered queue n times.  "
+            "Optionally compare to expected value str, unless RAND");
+    add_cmd("tstat", do_tier_stats,
+            "                | Show counters of tiered queue");
+    add_cmd("tfree", do_tier_free, "                | Delete tiered queue");
+    add_cmd("itt", do_insert_ttl,
+            " str ms [n]     | Insert string str at tail of queue n times, "
+            "expiring ms milliseconds from now. Generate random string(s) if "
+            "str equals RAND");
+    add_cmd("tick", do_tick,
+            " ms [n]         | Move clock of queue ms milliseconds forward and "
+            "expire elements.  Optionally compare to expected number n of "
+            "expired elements");
+    add_cmd("pqnew", do_pq_new, "                | Create new priority queue");
+    add_cmd("pqi", do_pq_insert,
+            " str [n]        | Insert string str into priority queue n times. "
+            "Generate random string(s) if str equals RAND");
+    add_cmd("pqrm", do_pq_remove,
+            " [str] [n]      | Remove smallest string from priority queue n "
+            "times, checking their order.  Optionally compare first one to "
+            "expected value str, unless RAND");
+    add_cmd("pqfree", do_pq_free, "                | Delete priority queue");
+    add_cmd("snew", do_shm_new,
+            " name [bytes]   | Create shared memory region name of bytes bytes "
+            "holding an empty queue, and attach to it (default: bytes == "
+            "1048576)");
+    add_cmd("sattach", do_shm_attach,
+            " name           | Attach to queue in existing shared memory "
+            "region name");
+    add_cmd("sdetach", do_shm_detach,
+            "                | Detach from shared queue, which keeps existing");
+    add_cmd("sunlink", do_shm_unlink,
+            " name           | Remove shared memory region name");
+    add_cmd("sit", do_shm_insert,
+            " str [n]        | Insert string str at tail of shared queue n "
+            "times. Generate random string(s) if str equals RAND");
+    add_cmd("srh", do_shm_remove,
+            " [str] [n]      | Remove from head of shared queue n times.  "
+            "Optionally compare to expected value str, unless RAND");
+    add_cmd("sstat", do_shm_stats,
+            " [n]            | Show counters of shared queue.  Optionally "
+            "compare to expected size n");
+    add_cmd("wal", do_wal,
+            " open|close|sync|checkpoint|stats|unlink | 'open PATH' recovers "
+            "empty queue from log PATH and logs its changes, 'close' stops, "
+            "'sync' commits pending records, 'checkpoint' snapshots queue, "
+            "'stats' shows counters and commit latencies, 'unlink PATH' "
+            "removes log");
+    add_cmd("repl", do_repl,
+            " serve|stop|follow | 'serve PATH [fork]' ships changes of "
+            "queue to a follower connecting to socket PATH, or to a forked "
+            "one, 'stop' waits until the follower caught up, 'follow PATH' "
+            "replicates into empty queue");
+    add_cmd("snap", do_snap,
+            " take|show|check|free | 'take' snapshots queue sharing its "
+            "elements, 'show N' shows snapshot N, 'check' compares all "
+            "snapshots with queue contents when taken, 'free [N]' frees "
+            "snapshot N or all");
+    add_cmd("gen", do_generate,
+            " file bytes [seed] | Write random strings, one per line, to file "
+            "until it has bytes bytes");
+    add_cmd("xsort", do_xsort,
+            " in [out]       | Sort lines of file in within memory budget "
+            "xmem, writing them to file out or inserting them at tail of "
+            "queue");
+    add_cmd("rotate", do_rotate,
+            " n              | Move first n elements of queue to its tail by "
+            "splitting and concatenating");
+    add_cmd("merge", do_merge,
+            " k [n]          | Sort queue and merge k sorted queues of n "
+            "random strings into it (default: n == 1000)");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
               NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
+    add_param("defrag", &auto_defrag, "Whether to defrag queue after sort",
+              NULL);
+    add_param("keep", &keep_limit,
+              "Number of elements ih and it keep, removing the oldest one "
+              "beyond it, so that long runs stay within memory (0: all)",
+              NULL);
+    add_param("xmem", &xsort_budget, "Memory budget of xsort in KiB", NULL);
+    add_param("walus", &wal_interval,
+              "Microseconds write-ahead log records wait for a commit", NULL);
+    add_param("walbatch", &wal_batch,
+              "Number of write-ahead log records committed at once", NULL);
+    add_param("reclaim", &reclaim,
+              "Whether to free queues in a background thread", set_reclaim);
+    add_param("prefetch", &prefetch_distance,
+              "Number of elements prefetched ahead in list traversals", NULL);
+    add_param("timeout", &time_limit,
+              "Time limit in seconds for each queue operation", NULL);
 }
 
-static bool do_new(int argc, char *argv[])
+/*
+ * Decode compacted elements of the queue into list elements before any
+ * operation which would do so itself. Freeing the blocks of a big queue
+ * takes too long in cautious mode, and q_reverse and q_sort must not
+ * allocate at all.
+ */
+static void expand_queue()
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
-        return false;
-    }
+    if (!q || !q->packed)
+        return;
+    if (qcnt > big_queue_size)
+        set_cautious_mode(false);
+    if (exception_setup(true))
+        q_expand(q);
+    exception_cancel();
+    set_cautious_mode(true);
+}
+
+static bool stop_repl();
+
+/*
+ * Copy the elements of the queue shared with snapshots before q_reverse or
+ * q_sort, which would do so themselves but must not allocate
+ */
+static void unshare_queue()
+{
+    if (!q || !q_shared(q))
+        return;
+    if (exception_setup(true))
+        q_unshare(q);
+    exception_cancel();
+}
+
+/* Stop logging the changes of the queue in use */
+static bool close_wal()
+{
+    /* Let the follower catch up rather than cut it off */
+    if (repl_serving)
+        stop_repl();
+    if (!wal)
+        return true;
+    q_log(q, NULL);
+    bool ok = wal_close(wal);
+    wal = NULL;
+    if (!ok)
+        report(1, "ERROR: Write-ahead log failed to commit records");
+    return ok;
+}
 
+/* Replace the queue in use by a new one */
+static bool new_queue(char *argv[])
+{
     bool ok = true;
     if (q) {
         report(3, "Freeing old queue");
-        ok = do_free(argc, argv);
+        ok = do_free(1, argv);
     }
     error_check();
 
@@ -132,6 +539,39 @@ static bool do_new(int argc, char *argv[])
     return ok && !error_check();
 }
 
+static bool do_new(int argc, char *argv[])
+{
+    if (argc > 3) {
+        report(1, "%s takes 0-2 arguments", argv[0]);
+        return false;
+    }
+
+    long n = 1;
+    if (argc == 3 && (!get_long(argv[2], &n) || n < 1)) {
+        report(1, "Invalid number of queues '%s'", argv[2]);
+        return false;
+    }
+    if (argc == 1)
+        return new_queue(argv);
+    if (argc == 2) {
+        use_queue(add_queue(argv[1]));
+        return new_queue(argv);
+    }
+
+    bool ok = true;
+    for (long i = 0; ok && i < n; i++) {
+        char name[64];
+        if (snprintf(name, sizeof(name), "%s%ld", argv[1], i) >=
+            (int) sizeof(name)) {
+            report(1, "Queue name '%s' too long", argv[1]);
+            return false;
+        }
+        use_queue(add_queue(name));
+        ok = new_queue(argv);
+    }
+    return ok;
+}
+
 static bool do_free(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -142,6 +582,8 @@ static bool do_free(int argc, char *argv[])
     bool ok = true;
     if (!q)
         report(3, "Warning: Calling free on null queue");
+    else if (q->wal)
+        ok = close_wal();
     error_check();
 
     if (qcnt > big_queue_size)
@@ -155,7 +597,11 @@ static bool do_free(int argc, char *argv[])
     qcnt = 0;
     show_queue(3);
 
-    size_t bcnt = allocation_check();
+    /*
+     * Blocks freed in the background are checked by sync, and blocks of other
+     * queues by quit
+     */
+    size_t bcnt = reclaim || live_queues() ? 0 : allocation_check();
     if (bcnt > 0) {
         report(1, "ERROR: Freed queue, but %lu blocks are still allocated",
                bcnt);
@@ -164,12 +610,36 @@ static bool do_free(int argc, char *argv[])
 
     return ok && !error_check();
 }
+
+static bool do_sync(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    double t;
+    init_time(&t);
+    q_sync();
+    report(2, "Waited %.3f s for queues to be freed", delta_time(&t));
+
+    bool ok = true;
+    size_t bcnt = live_queues() ? 0 : allocation_check();
+    if (bcnt > 0) {
+        report(1, "ERROR: Freed queues, but %lu blocks are still allocated",
+               bcnt);
+        ok = false;
+    }
+    return ok && !error_check();
+}
 /*
  * TODO: Add a buf_size check of if the buf_size may be less
  * than MIN_RANDSTR_LEN.
  */
 static void fill_rand_string(char *buf, size_t buf_size)
 {
+    /* Jumping out of rand on the time limit would leave its lock held */
+    exception_hold();
     size_t len = 0;
     while (len < MIN_RANDSTR_LEN)
         len = rand() % buf_size;
@@ -178,13 +648,31 @@ static void fill_rand_string(char *buf, size_t buf_size)
         buf[n] = charset[rand() % (sizeof charset - 1)];
     }
     buf[len] = '\0';
+    exception_release();
+}
+
+/*
+ * Once the queue holds more than keep_limit elements, remove the oldest one,
+ * at the tail if insertions go to the head, or at the head otherwise.
+ */
+static bool keep_bounded(bool at_head)
+{
+    if (keep_limit <= 0 || qcnt <= (size_t) keep_limit)
+        return true;
+    if (at_head ? !q_remove_at(q, qcnt - 1, NULL, 0)
+                : !q_remove_head(q, NULL, 0)) {
+        report(1, "ERROR: Could not remove element beyond %d", keep_limit);
+        return false;
+    }
+    qcnt--;
+    return true;
 }
 
 static bool do_insert_head(int argc, char *argv[])
 {
     char *lasts = NULL;
     char randstr_buf[MAX_RANDSTR_LEN];
-    int reps = 1;
+    long reps = 1;
     bool ok = true, need_rand = false;
     if (argc != 2 && argc != 3) {
         report(1, "%s needs 1-2 arguments", argv[0]);
@@ -193,7 +681,7 @@ static bool do_insert_head(int argc, char *argv[])
 
     char *inserts = argv[1];
     if (argc == 3) {
-        if (!get_int(argv[2], &reps)) {
+        if (!get_long(argv[2], &reps)) {
             report(1, "Invalid number of insertions '%s'", argv[2]);
             return false;
         }
@@ -209,7 +697,7 @@ static bool do_insert_head(int argc, char *argv[])
     error_check();
 
     if (exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
+        for (long r = 0; ok && r < reps; r++) {
             if (need_rand)
                 fill_rand_string(randstr_buf, sizeof(randstr_buf));
             bool rval = q_insert_head(q, inserts);
@@ -232,6 +720,7 @@ static bool do_insert_head(int argc, char *argv[])
                     break;
                 }
                 lasts = q->head->value;
+                ok = ok && keep_bounded(true);
             } else {
                 fail_count++;
                 if (fail_count < fail_limit)
@@ -269,7 +758,7 @@ static bool do_insert_tail(int argc, char *argv[])
     }
 
     char randstr_buf[MAX_RANDSTR_LEN];
-    int reps = 1;
+    long reps = 1;
     bool ok = true, need_rand = false;
     if (argc != 2 && argc != 3) {
         report(1, "%s needs 1-2 arguments", argv[0]);
@@ -278,7 +767,7 @@ static bool do_insert_tail(int argc, char *argv[])
 
     char *inserts = argv[1];
     if (argc == 3) {
-        if (!get_int(argv[2], &reps)) {
+        if (!get_long(argv[2], &reps)) {
             report(1, "Invalid number of insertions '%s'", argv[2]);
             return false;
         }
@@ -294,16 +783,17 @@ static bool do_insert_tail(int argc, char *argv[])
     error_check();
 
     if (exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
+        for (long r = 0; ok && r < reps; r++) {
             if (need_rand)
                 fill_rand_string(randstr_buf, sizeof(randstr_buf));
             bool rval = q_insert_tail(q, inserts);
             if (rval) {
                 qcnt++;
-                if (!q->head->value) {
+                if (q->head && !q->head->value) {
                     report(1, "ERROR: Failed to save copy of string in list");
                     ok = false;
                 }
+                ok = ok && keep_bounded(false);
             } else {
                 fail_count++;
                 if (fail_count < fail_limit)
@@ -358,7 +848,7 @@ static bool do_remove_head(int argc, char *argv[])
 
     if (!q)
         report(3, "Warning: Calling remove head on null queue");
-    else if (!q->head)
+    else if (!q->size)
         report(3, "Warning: Calling remove head on empty queue");
     error_check();
 
@@ -424,7 +914,7 @@ static bool do_remove_head_quiet(int argc, char *argv[])
     bool ok = true;
     if (!q)
         report(3, "Warning: Calling remove head on null queue");
-    else if (!q->head)
+    else if (!q->size)
         report(3, "Warning: Calling remove head on empty queue");
     error_check();
 
@@ -461,6 +951,8 @@ static bool do_reverse(int argc, char *argv[])
         report(3, "Warning: Calling reverse on null queue");
     error_check();
 
+    expand_queue();
+    unshare_queue();
     set_noallocate_mode(true);
     if (exception_setup(true))
         q_reverse(q);
@@ -492,7 +984,7 @@ static bool do_size(int argc, char *argv[])
         return false;
     }
 
-    int reps = 1;
+    long reps = 1;
     bool ok = true;
     if (argc != 1 && argc != 2) {
         report(1, "%s needs 0-1 arguments", argv[0]);
@@ -500,18 +992,18 @@ static bool do_size(int argc, char *argv[])
     }
 
     if (argc == 2) {
-        if (!get_int(argv[1], &reps)) {
+        if (!get_long(argv[1], &reps)) {
             report(1, "Invalid number of calls to size '%s'", argv[2]);
         }
     }
 
-    int cnt = 0;
+    size_t cnt = 0;
     if (!q)
         report(3, "Warning: Calling size on null queue");
     error_check();
 
     if (exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
+        for (long r = 0; ok && r < reps; r++) {
             cnt = q_size(q);
             ok = ok && !error_check();
         }
@@ -520,11 +1012,12 @@ static bool do_size(int argc, char *argv[])
 
     if (ok) {
         if (qcnt == cnt) {
-            report(2, "Queue size = %d", cnt);
+            report(2, "Queue size = %lu", cnt);
         } else {
             report(1,
-                   "ERROR: Computed queue size as %d, but correct value is %d",
-                   cnt, (int) qcnt);
+                   "ERROR: Computed queue size as %lu, but correct value is "
+                   "%lu",
+                   cnt, qcnt);
             ok = false;
         }
     }
@@ -545,23 +1038,30 @@ bool do_sort(int argc, char *argv[])
         report(3, "Warning: Calling sort on null queue");
     error_check();
 
-    int cnt = q_size(q);
+    size_t cnt = q_size(q);
     if (cnt < 2)
         report(3, "Warning: Calling sort on single node");
     error_check();
 
+    expand_queue();
+    unshare_queue();
     set_noallocate_mode(true);
     if (exception_setup(true))
         q_sort(q);
     exception_cancel();
     set_noallocate_mode(false);
 
+    if (auto_defrag && !defrag_queue()) {
+        report(1, "ERROR: Defrag after sort failed");
+        return false;
+    }
+
     bool ok = true;
     if (q) {
         for (list_ele_t *e = q->head; e && --cnt; e = e->next) {
             /* Ensure each element in ascending order */
             /* FIXME: add an option to specify sorting order */
-            if (strcasecmp(e->value, e->next->value) > 0) {
+            if (strcmp(e->value, e->next->value) > 0) {
                 report(1, "ERROR: Not sorted in ascending order");
                 ok = false;
                 break;
@@ -573,220 +1073,2551 @@ bool do_sort(int argc, char *argv[])
     return ok && !error_check();
 }
 
-static bool show_queue(int vlevel)
+static bool do_sortk(int argc, char *argv[])
 {
-    bool ok = true;
-    if (verblevel < vlevel)
-        return true;
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
 
-    int cnt = 0;
-    if (!q) {
-        report(vlevel, "q = NULL");
-        return true;
+    long k;
+    if (!get_long(argv[1], &k) || k < 0) {
+        report(1, "Invalid number of elements '%s'", argv[1]);
+        return false;
     }
 
-    report_noreturn(vlevel, "q = [");
-    list_ele_t *e = q->head;
-    if (exception_setup(true)) {
-        while (ok && e && cnt < qcnt) {
-            if (cnt < big_queue_size)
-                report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
-            e = e->next;
-            cnt++;
-            ok = ok && !error_check();
-        }
+    if (!q)
+        report(3, "Warning: Calling sortk on null queue");
+    error_check();
+
+    expand_queue();
+
+    /* Fully sort an identical copy of the queue for timing comparison */
+    double full_time = -1;
+    if (q && exception_setup(true)) {
+        queue_t *copy = q_new();
+        bool copied = copy != NULL;
+        for (list_ele_t *e = q->head; copied && e; e = e->next)
+            copied = q_insert_tail(copy, e->value);
+        if (copied) {
+            init_time(&full_time);
+            q_sort(copy);
+            full_time = delta_time(&full_time);
+        } else
+            full_time = -1;
+        set_cautious_mode(false);
+        q_free(copy);
     }
     exception_cancel();
+    set_cautious_mode(true);
+    error_check();
 
-    if (!ok) {
-        report(vlevel, " ... ]");
-        return false;
+    bool ok = true;
+    bool rval = false;
+    double topk_time;
+    init_time(&topk_time);
+    if (exception_setup(true))
+        rval = q_sort_topk(q, k);
+    exception_cancel();
+    topk_time = delta_time(&topk_time);
+
+    if (q && !rval) {
+        fail_count++;
+        if (fail_count < fail_limit)
+            report(2, "Partial sort failed");
+        else {
+            report(1, "ERROR: Partial sort failed (%d failures total)",
+                   fail_count);
+            ok = false;
+        }
     }
 
-    if (!e) {
-        if (cnt <= big_queue_size)
-            report(vlevel, "]");
+    if (q && rval) {
+        /*
+         * The first k elements must be ascending and not exceed the rest,
+         * and nothing is to check when k is 0
+         */
+        long cnt = 1;
+        list_ele_t *e = k > 0 ? q->head : NULL;
+        for (; e && e->next && cnt < k; e = e->next, cnt++) {
+            if (strcmp(e->value, e->next->value) > 0) {
+                report(1, "ERROR: First %ld elements not in ascending order",
+                       k);
+                ok = false;
+                break;
+            }
+        }
+        for (list_ele_t *r = e ? e->next : NULL; ok && r; r = r->next) {
+            if (strcmp(e->value, r->value) > 0) {
+                report(1, "ERROR: %s is not among the %ld smallest elements",
+                       e->value, k);
+                ok = false;
+            }
+        }
+        if (full_time < 0)
+            report(2, "Partial sort of %ld elements: %.3f s", k, topk_time);
         else
-            report(vlevel, " ... ]");
-    } else {
-        report(vlevel, " ... ]");
-        report(
-            vlevel,
-            "ERROR:  Either list has cycle, or queue has more than %d elements",
-            qcnt);
-        ok = false;
+            report(2,
+                   "Partial sort of %ld elements: %.3f s, full sort: %.3f s", k,
+                   topk_time, full_time);
     }
 
-    return ok;
+    show_queue(3);
+    return ok && !error_check();
 }
 
-static bool do_show(int argc, char *argv[])
+static bool do_unique(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    if (argc != 1 && argc != 2) {
+        report(1, "%s needs 0-1 arguments", argv[0]);
         return false;
     }
-    return show_queue(0);
-}
-
-/* Signal handlers */
-static void sigsegvhandler(int sig)
-{
-    report(1,
-           "Segmentation fault occurred.  You dereferenced a NULL or invalid "
-           "pointer");
-    /* Raising a SIGABRT signal to produce a core dump for debugging. */
-    abort();
-}
 
-static void sigalrmhandler(int sig)
-{
-    trigger_exception(
-        "Time limit exceeded.  Either you are in an infinite loop, or your "
-        "code is too inefficient");
-}
+    int keep_first = 1;
+    if (argc == 2 && !get_int(argv[1], &keep_first)) {
+        report(1, "Invalid choice of occurrence to keep '%s'", argv[1]);
+        return false;
+    }
 
-static void queue_init()
-{
-    fail_count = 0;
-    q = NULL;
-    signal(SIGSEGV, sigsegvhandler);
-    signal(SIGALRM, sigalrmhandler);
-}
+    if (!q)
+        report(3, "Warning: Calling unique on null queue");
+    error_check();
+    expand_queue();
 
-static bool queue_quit(int argc, char *argv[])
-{
-    report(3, "Freeing queue");
+    long removed = -1;
+    double elapsed;
     if (qcnt > big_queue_size)
         set_cautious_mode(false);
-
+    init_time(&elapsed);
     if (exception_setup(true))
-        q_free(q);
+        removed = q_unique(q, keep_first);
     exception_cancel();
+    elapsed = delta_time(&elapsed);
     set_cautious_mode(true);
 
-    size_t bcnt = allocation_check();
-    if (bcnt > 0) {
-        report(1, "ERROR: Freed queue, but %lu blocks are still allocated",
-               bcnt);
-        return false;
+    bool ok = true;
+    if (removed < 0) {
+        fail_count++;
+        if (!q || fail_count < fail_limit)
+            report(2, "Removal of duplicates failed");
+        else {
+            report(1,
+                   "ERROR: Removal of duplicates failed (%d failures total)",
+                   fail_count);
+            ok = false;
+        }
+    } else {
+        report(2, "Removed %ld duplicate(s) in %.3f s", removed, elapsed);
+        qcnt -= removed;
     }
 
-    return true;
-}
+    /* Check for remaining duplicates when the queue is small enough */
+    if (q && qcnt <= big_queue_size) {
+        for (list_ele_t *e = q->head; ok && e; e = e->next) {
+            for (list_ele_t *f = e->next; f; f = f->next) {
+                if (!strcmp(e->value, f->value)) {
+                    report(1, "ERROR: Duplicate string %s still in queue",
+                           e->value);
+                    ok = false;
+                    break;
+                }
+            }
+        }
+    }
 
-static void usage(char *cmd)
-{
-    printf("Usage: %s [-h] [-f IFILE][-v VLEVEL][-l LFILE]\n", cmd);
-    printf("\t-h         Print this information\n");
-    printf("\t-f IFILE   Read commands from IFILE\n");
-    printf("\t-v VLEVEL  Set verbosity level\n");
-    printf("\t-l LFILE   Echo results to LFILE\n");
-    exit(0);
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_index(int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s needs 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    int enable = -1;
+    if (argc == 2 && !get_int(argv[1], &enable)) {
+        report(1, "Invalid index setting '%s'", argv[1]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling index on null queue");
+    error_check();
+    if (enable > 0)
+        expand_queue();
+
+    bool ok = true;
+    if (enable >= 0) {
+        bool rval = false;
+        if (exception_setup(true))
+            rval = q_index(q, enable);
+        exception_cancel();
+        if (q && !rval) {
+            fail_count++;
+            if (fail_count < fail_limit)
+                report(2, "Building index failed");
+            else {
+                report(1, "ERROR: Building index failed (%d failures total)",
+                       fail_count);
+                ok = false;
+            }
+        }
+    }
+
+    if (q) {
+        if (q->index)
+            report(2, "Index uses %lu bytes for %lu elements",
+                   q_index_memory(q), q_size(q));
+        else
+            report(2, "No index");
+    }
+    return ok && !error_check();
+}
+
+static bool do_find(int argc, char *argv[])
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    int expect = -1;
+    if (argc == 3 && !get_int(argv[2], &expect)) {
+        report(1, "Invalid expected result '%s'", argv[2]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling find on null queue");
+    error_check();
+
+    bool found = false;
+    if (exception_setup(true))
+        found = q_contains(q, argv[1]);
+    exception_cancel();
+
+    bool ok = true;
+    report(2, "%s is %sin queue", argv[1], found ? "" : "not ");
+    if (expect >= 0 && found != (expect != 0)) {
+        report(1, "ERROR: Expected %s %sto be in queue", argv[1],
+               expect ? "" : "not ");
+        ok = false;
+    }
+    return ok && !error_check();
+}
+
+static bool do_remove_value(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling remove value on null queue");
+    error_check();
+    expand_queue();
+
+    bool rval = false;
+    if (exception_setup(true))
+        rval = q_remove_value(q, argv[1]);
+    exception_cancel();
+
+    bool ok = true;
+    if (rval) {
+        report(2, "Removed %s from queue", argv[1]);
+        qcnt--;
+    } else {
+        fail_count++;
+        if (fail_count < fail_limit)
+            report(2, "Removal of %s failed", argv[1]);
+        else {
+            report(1, "ERROR: Removal of %s failed (%d failures total)",
+                   argv[1], fail_count);
+            ok = false;
+        }
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_ordered(int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s needs 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    int enable = 1;
+    if (argc == 2 && !get_int(argv[1], &enable)) {
+        report(1, "Invalid ordered setting '%s'", argv[1]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling ordered on null queue");
+    error_check();
+    if (enable > 0)
+        expand_queue();
+
+    bool ok = true;
+    bool rval = false;
+    if (qcnt > big_queue_size)
+        set_cautious_mode(false);
+    if (exception_setup(true))
+        rval = q_ordered(q, enable);
+    exception_cancel();
+    set_cautious_mode(true);
+    if (q && !rval) {
+        fail_count++;
+        if (fail_count < fail_limit)
+            report(2, "Building skip index failed");
+        else {
+            report(1, "ERROR: Building skip index failed (%d failures total)",
+                   fail_count);
+            ok = false;
+        }
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_insert_sorted(int argc, char *argv[])
+{
+    char randstr_buf[MAX_RANDSTR_LEN];
+    long reps = 1;
+    bool ok = true, need_rand = false;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    char *inserts = argv[1];
+    if (argc == 3) {
+        if (!get_long(argv[2], &reps)) {
+            report(1, "Invalid number of insertions '%s'", argv[2]);
+            return false;
+        }
+    }
+
+    if (!strcmp(inserts, "RAND")) {
+        need_rand = true;
+        inserts = randstr_buf;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling insert sorted on null queue");
+    error_check();
+    expand_queue();
+
+    if (exception_setup(true)) {
+        for (long r = 0; ok && r < reps; r++) {
+            if (need_rand)
+                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+            if (q_insert_sorted(q, inserts)) {
+                qcnt++;
+            } else {
+                fail_count++;
+                if (fail_count < fail_limit)
+                    report(2, "Insertion of %s failed", inserts);
+                else {
+                    report(1,
+                           "ERROR: Insertion of %s failed (%d failures total)",
+                           inserts, fail_count);
+                    ok = false;
+                }
+            }
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+
+    if (ok && q) {
+        for (list_ele_t *e = q->head; e && e->next; e = e->next) {
+            if (strcasecmp(e->value, e->next->value) > 0) {
+                report(1, "ERROR: Not sorted in ascending order");
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+/* Print one string found by q_range */
+static void report_range(const char *s, void *arg)
+{
+    size_t *cnt = arg;
+    if ((*cnt)++ < (size_t) big_queue_size)
+        report_noreturn(2, *cnt == 1 ? "%s" : " %s", s);
+}
+
+static bool do_range(int argc, char *argv[])
+{
+    if (argc != 3) {
+        report(1, "%s needs 2 arguments", argv[0]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling range on null queue");
+    error_check();
+
+    size_t cnt = 0, found = 0;
+    report_noreturn(2, "range = [");
+    if (exception_setup(true))
+        found = q_range(q, argv[1], argv[2], report_range, &cnt);
+    exception_cancel();
+    report(2, cnt > big_queue_size ? " ... ]" : "]");
+
+    bool ok = true;
+    if (found != cnt) {
+        report(1, "ERROR: Range visited %lu strings, but returned %lu", cnt,
+               found);
+        ok = false;
+    }
+    return ok && !error_check();
+}
+
+static bool do_rank(int argc, char *argv[])
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    long expect = -1;
+    if (argc == 3 && !get_long(argv[2], &expect)) {
+        report(1, "Invalid expected rank '%s'", argv[2]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling rank on null queue");
+    error_check();
+
+    size_t rank = 0;
+    if (exception_setup(true))
+        rank = q_rank(q, argv[1]);
+    exception_cancel();
+
+    bool ok = true;
+    report(2, "%lu strings are less than %s", rank, argv[1]);
+    if (expect >= 0 && rank != (size_t) expect) {
+        report(1, "ERROR: Expected %ld strings less than %s", expect, argv[1]);
+        ok = false;
+    }
+    return ok && !error_check();
+}
+
+static bool do_positions(int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s needs 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    int enable = 1;
+    if (argc == 2 && !get_int(argv[1], &enable)) {
+        report(1, "Invalid positions setting '%s'", argv[1]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling positions on null queue");
+    error_check();
+    if (enable > 0)
+        expand_queue();
+
+    bool ok = true;
+    bool rval = false;
+    if (qcnt > big_queue_size)
+        set_cautious_mode(false);
+    if (exception_setup(true))
+        rval = q_positions(q, enable);
+    exception_cancel();
+    set_cautious_mode(true);
+    if (q && !rval) {
+        fail_count++;
+        if (fail_count < fail_limit)
+            report(2, "Building skip index failed");
+        else {
+            report(1, "ERROR: Building skip index failed (%d failures total)",
+                   fail_count);
+            ok = false;
+        }
+    }
+    return ok && !error_check();
+}
+
+/*
+ * Copy the string at index i of queue into buf of string_length + 1 bytes,
+ * removing it if remove is true. Return whether it succeeded.
+ */
+static bool fetch_at(size_t i, char *buf, bool remove)
+{
+    bool rval = false;
+    if (exception_setup(true))
+        rval = remove ? q_remove_at(q, i, buf, string_length + 1)
+                      : q_get(q, i, buf, string_length + 1);
+    exception_cancel();
+    return rval;
+}
+
+static bool do_get_or_remove(int argc, char *argv[], bool remove)
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    long i;
+    if (!get_long(argv[1], &i) || i < 0) {
+        report(1, "Invalid index '%s'", argv[1]);
+        return false;
+    }
+
+    char *buf = malloc(string_length + 1);
+    if (!buf) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for string");
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling %s on null queue", argv[0]);
+    error_check();
+    expand_queue();
+
+    bool ok = true;
+    if (fetch_at(i, buf, remove)) {
+        report(2, "%s %s at index %ld", remove ? "Removed" : "Found", buf, i);
+        if (remove)
+            qcnt--;
+        if (argc == 3 && strcmp(buf, argv[2])) {
+            report(1, "ERROR: Value %s at index %ld != expected value %s", buf,
+                   i, argv[2]);
+            ok = false;
+        }
+    } else {
+        fail_count++;
+        if (fail_count < fail_limit)
+            report(2, "No element at index %ld", i);
+        else {
+            report(1, "ERROR: No element at index %ld (%d failures total)", i,
+                   fail_count);
+            ok = false;
+        }
+    }
+
+    if (remove)
+        show_queue(3);
+    free(buf);
+    return ok && !error_check();
+}
+
+static bool do_get(int argc, char *argv[])
+{
+    return do_get_or_remove(argc, argv, false);
+}
+
+static bool do_remove_at(int argc, char *argv[])
+{
+    return do_get_or_remove(argc, argv, true);
+}
+
+static bool do_sample(int argc, char *argv[])
+{
+    long k;
+    if (argc != 2 || !get_long(argv[1], &k) || k < 0) {
+        report(1, "%s needs a non-negative count", argv[0]);
+        return false;
+    }
+
+    char *buf = malloc(string_length + 1);
+    if (!buf) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for string");
+        return false;
+    }
+
+    if (!q || !qcnt) {
+        report(3, "Warning: Calling sample on empty queue");
+        k = 0;
+    }
+    error_check();
+    expand_queue();
+
+    bool ok = true;
+    for (long r = 0; ok && r < k; r++) {
+        size_t i = (((size_t) rand() << 31) ^ (size_t) rand()) % qcnt;
+        if (!fetch_at(i, buf, false)) {
+            report(1, "ERROR: No element at index %lu of %lu", i, qcnt);
+            ok = false;
+        } else {
+            report(2, "[%lu] %s", i, buf);
+        }
+        ok = ok && !error_check();
+    }
+
+    free(buf);
+    return ok;
+}
+
+static bool do_insert_at(int argc, char *argv[])
+{
+    if (argc != 3) {
+        report(1, "%s needs 2 arguments", argv[0]);
+        return false;
+    }
+
+    long i;
+    if (!get_long(argv[1], &i) || i < 0) {
+        report(1, "Invalid index '%s'", argv[1]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling insert at on null queue");
+    error_check();
+    expand_queue();
+
+    bool rval = false;
+    if (exception_setup(true))
+        rval = q_insert_at(q, i, argv[2]);
+    exception_cancel();
+
+    bool ok = true;
+    if (rval) {
+        qcnt++;
+    } else {
+        fail_count++;
+        if (fail_count < fail_limit)
+            report(2, "Insertion of %s at index %ld failed", argv[2], i);
+        else {
+            report(1,
+                   "ERROR: Insertion of %s at index %ld failed (%d failures "
+                   "total)",
+                   argv[2], i, fail_count);
+            ok = false;
+        }
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+/* Count strings decoded by q_foreach */
+static void count_string(const char *s, void *arg)
+{
+    (*(size_t *) arg)++;
+}
+
+static bool do_compact(int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s needs 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    int enable = 1;
+    if (argc == 2 && !get_int(argv[1], &enable)) {
+        report(1, "Invalid compact setting '%s'", argv[1]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling compact on null queue");
+    error_check();
+
+    size_t bytes = allocation_bytes(), blocks = allocation_check();
+    bool ok = true;
+    bool rval = false;
+    if (qcnt > big_queue_size)
+        set_cautious_mode(false);
+    if (exception_setup(true))
+        rval = enable ? q_compact_sorted(q) : q_expand(q);
+    exception_cancel();
+    set_cautious_mode(true);
+    if (q && !rval) {
+        fail_count++;
+        if (fail_count < fail_limit)
+            report(2, "Compaction failed");
+        else {
+            report(1, "ERROR: Compaction failed (%d failures total)",
+                   fail_count);
+            ok = false;
+        }
+    }
+    if (!q || !ok)
+        return ok && !error_check();
+
+    report(2, "Memory: %lu bytes in %lu blocks before, %lu bytes in %lu after",
+           bytes, blocks, allocation_bytes(), allocation_check());
+    if (qcnt)
+        report(2, "%.1f bytes per element after",
+               (double) allocation_bytes() / qcnt);
+
+    size_t decoded = 0;
+    double t;
+    init_time(&t);
+    if (exception_setup(true))
+        q_foreach(q, count_string, &decoded);
+    exception_cancel();
+    t = delta_time(&t);
+    if (decoded != qcnt) {
+        report(1, "ERROR: Visited %lu strings, but queue has %lu", decoded,
+               qcnt);
+        ok = false;
+    } else if (t > 0) {
+        report(2, "Visited %lu strings in %.3f s (%.1f M/s)", decoded, t,
+               decoded / t / 1e6);
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+/* Touch each string of the queue, as a traversal would */
+static void touch_string(const char *s, void *arg)
+{
+    *(size_t *) arg += (unsigned char) s[0];
+}
+
+/* Return the time taken to traverse the queue, or a negative value */
+static double traversal_time()
+{
+    size_t sum = 0;
+    double t = -1;
+    if (exception_setup(true)) {
+        init_time(&t);
+        q_foreach(q, touch_string, &sum);
+        t = delta_time(&t);
+    }
+    exception_cancel();
+    return t;
+}
+
+/* Call q_defrag on the queue and return whether it succeeded */
+static bool defrag_queue()
+{
+    bool rval = false;
+    if (qcnt > big_queue_size)
+        set_cautious_mode(false);
+    if (exception_setup(true))
+        rval = q_defrag(q);
+    exception_cancel();
+    set_cautious_mode(true);
+    return rval;
+}
+
+static bool do_defrag(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling defrag on null queue");
+    error_check();
+
+    bool ok = true;
+    double before = traversal_time();
+    if (!defrag_queue()) {
+        fail_count++;
+        if (fail_count < fail_limit)
+            report(2, "Defrag failed");
+        else {
+            report(1, "ERROR: Defrag failed (%d failures total)", fail_count);
+            ok = false;
+        }
+    } else if (q) {
+        report(2, "Traversal took %.3f s before, %.3f s after", before,
+               traversal_time());
+    }
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+struct show_arg {
+    int vlevel;
+    long skip; /* Number of strings already shown from list elements */
+    long cnt;
+};
+
+/* Print one string of a compacted queue, as show_queue does */
+static void show_string(const char *s, void *arg)
+{
+    struct show_arg *a = arg;
+    long cnt = a->cnt++;
+    if (cnt >= a->skip && cnt < big_queue_size)
+        report_noreturn(a->vlevel, cnt == 0 ? "%s" : " %s", s);
+}
+
+static bool show_queue(int vlevel)
+{
+    bool ok = true;
+    if (verblevel < vlevel)
+        return true;
+
+    long cnt = 0;
+    if (!q) {
+        report(vlevel, "q = NULL");
+        return true;
+    }
+
+    report_noreturn(vlevel, "q = [");
+    list_walker_t w;
+    list_ele_t *e = q->head;
+    if (exception_setup(true)) {
+        walk_init(&w, e, true);
+        while (ok && e && (size_t) cnt < qcnt) {
+            if (cnt < big_queue_size)
+                report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
+            walk_next(&w);
+            e = w.cur;
+            cnt++;
+            ok = ok && !error_check();
+        }
+        if (ok && !e && q->packed) {
+            /* Compacted elements follow the list */
+            struct show_arg arg = {vlevel, cnt, 0};
+            cnt = q_foreach(q, show_string, &arg);
+            ok = !error_check();
+        }
+    }
+    exception_cancel();
+
+    if (!ok) {
+        report(vlevel, " ... ]");
+        return false;
+    }
+
+    if (!e) {
+        if (cnt <= big_queue_size)
+            report(vlevel, "]");
+        else
+            report(vlevel, " ... ]");
+    } else {
+        report(vlevel, " ... ]");
+        report(
+            vlevel,
+            "ERROR:  Either list has cycle, or queue has more than %lu elements",
+            qcnt);
+        ok = false;
+    }
+
+    return ok;
+}
+
+static bool do_tier_free(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!tq)
+        report(3, "Warning: Calling free on null tiered queue");
+    error_check();
+
+    if (tqcnt > big_queue_size)
+        set_cautious_mode(false);
+    if (exception_setup(true))
+        tq_free(tq);
+    exception_cancel();
+    set_cautious_mode(true);
+    tq = NULL;
+    tqcnt = 0;
+    return !error_check();
+}
+
+static bool do_tier_new(int argc, char *argv[])
+{
+    long limit = 1 << 20;
+    if (argc > 2 || (argc == 2 && (!get_long(argv[1], &limit) || limit < 0))) {
+        report(1, "%s needs a non-negative limit of bytes", argv[0]);
+        return false;
+    }
+
+    bool ok = true;
+    if (tq)
+        ok = do_tier_free(1, argv);
+
+    if (exception_setup(true))
+        tq = tq_new(NULL, limit);
+    exception_cancel();
+    if (!tq) {
+        report(1, "ERROR: Could not create tiered queue");
+        ok = false;
+    }
+    return ok && !error_check();
+}
+
+static bool do_tier_insert(int argc, char *argv[])
+{
+    char randstr_buf[MAX_RANDSTR_LEN];
+    long reps = 1;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+    if (argc == 3 && !get_long(argv[2], &reps)) {
+        report(1, "Invalid number of insertions '%s'", argv[2]);
+        return false;
+    }
+
+    char *inserts = argv[1];
+    bool need_rand = !strcmp(inserts, "RAND");
+    if (need_rand)
+        inserts = randstr_buf;
+
+    if (!tq)
+        report(3, "Warning: Calling insert tail on null tiered queue");
+    error_check();
+
+    /* Spilling frees the oldest elements, which cautious mode finds last */
+    bool ok = true;
+    if (tqcnt + reps > big_queue_size)
+        set_cautious_mode(false);
+    if (exception_setup(true)) {
+        for (long r = 0; ok && r < reps; r++) {
+            if (need_rand)
+                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+            if (tq_insert_tail(tq, inserts)) {
+                tqcnt++;
+            } else {
+                fail_count++;
+                if (fail_count < fail_limit)
+                    report(2, "Insertion of %s failed", inserts);
+                else {
+                    report(1,
+                           "ERROR: Insertion of %s failed (%d failures total)",
+                           inserts, fail_count);
+                    ok = false;
+                }
+            }
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+    set_cautious_mode(true);
+    return ok;
+}
+
+static bool do_tier_remove(int argc, char *argv[])
+{
+    long reps = 1;
+    if (argc > 3 || (argc == 3 && !get_long(argv[2], &reps))) {
+        report(1, "%s needs 0-2 arguments", argv[0]);
+        return false;
+    }
+
+    char *removes = malloc(string_length + 1);
+    if (!removes) {
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for removed strings");
+        return false;
+    }
+
+    if (!tq)
+        report(3, "Warning: Calling remove head on null tiered queue");
+    error_check();
+
+    bool ok = true;
+    bool check = argc > 1 && strcmp(argv[1], "RAND");
+    if (tqcnt > big_queue_size)
+        set_cautious_mode(false);
+    for (long r = 0; ok && r < reps; r++) {
+        bool rval = false;
+        if (exception_setup(true))
+            rval = tq_remove_head(tq, removes, string_length + 1);
+        exception_cancel();
+
+        if (!rval) {
+            fail_count++;
+            if (fail_count < fail_limit) {
+                report(2, "Removal from tiered queue failed");
+            } else {
+                report(1,
+                       "ERROR: Removal from tiered queue failed (%d failures "
+                       "total)",
+                       fail_count);
+                ok = false;
+            }
+            continue;
+        }
+        tqcnt--;
+        if (reps == 1)
+            report(2, "Removed %s from tiered queue", removes);
+        if (check && strcmp(removes, argv[1])) {
+            report(1, "ERROR: Removed value %s != expected value %s", removes,
+                   argv[1]);
+            ok = false;
+        }
+        ok = ok && !error_check();
+    }
+    set_cautious_mode(true);
+
+    free(removes);
+    return ok;
+}
+
+static bool do_tier_stats(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!tq) {
+        report(1, "Warning: No tiered queue");
+        return true;
+    }
+
+    bool ok = true;
+    size_t cnt = tq_size(tq);
+    if (cnt != tqcnt) {
+        report(1, "ERROR: Tiered queue size is %lu, but should be %lu", cnt,
+               tqcnt);
+        ok = false;
+    }
+    report(1,
+           "%lu elements: %lu in memory (%lu bytes), %lu in spill file. "
+           "Spilled %lu segments (%lu elements), restored %lu (%lu elements)",
+           cnt, cnt - tq->on_disk, tq->mem_bytes, tq->on_disk, tq->spills,
+           tq->spilled, tq->restores, tq->restored);
+    return ok;
+}
+
+static bool do_generate(int argc, char *argv[])
+{
+    long bytes, seed = 1;
+    if (argc != 3 && argc != 4) {
+        report(1, "%s needs 2-3 arguments", argv[0]);
+        return false;
+    }
+    if (!get_long(argv[2], &bytes) || bytes < 0 ||
+        (argc == 4 && !get_long(argv[3], &seed))) {
+        report(1, "Invalid size or seed");
+        return false;
+    }
+
+    double t;
+    init_time(&t);
+    if (!extsort_generate(argv[1], bytes, seed)) {
+        report(1, "ERROR: Could not write %s", argv[1]);
+        return false;
+    }
+    report(2, "Wrote %ld bytes to %s in %.3f s", bytes, argv[1],
+           delta_time(&t));
+    return true;
+}
+
+static bool do_xsort(int argc, char *argv[])
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    char *out = argc == 3 ? argv[2] : NULL;
+    if (!out && !q) {
+        report(1, "ERROR: Need a queue or an output file to sort into");
+        return false;
+    }
+    error_check();
+    expand_queue();
+
+    extsort_stats_t st;
+    list_ele_t *last = q ? q->tail : NULL;
+    bool ok = false;
+    set_cautious_mode(false);
+    if (exception_setup(false))
+        ok = extsort(argv[1], out, q, (size_t) xsort_budget << 10, NULL, &st);
+    exception_cancel();
+    set_cautious_mode(true);
+    if (!out)
+        qcnt = ok ? qcnt + st.lines : q_size(q);
+
+    if (!ok) {
+        report(1, "ERROR: Sorting %s failed", argv[1]);
+        return false;
+    }
+    if (!out) {
+        /* Check that the inserted strings are in ascending order */
+        list_ele_t *e = last ? last->next : q->head;
+        for (; e && e->next; e = e->next) {
+            if (strcmp(e->value, e->next->value) > 0) {
+                report(1, "ERROR: Inserted strings not in ascending order");
+                return false;
+            }
+        }
+    }
+    report(2,
+           "Sorted %lu lines (%lu bytes): %lu runs in %.3f s, %lu merge "
+           "passes in %.3f s",
+           st.lines, st.bytes, st.runs, st.run_time, st.passes,
+           st.merge_time);
+    show_queue(3);
+    return !error_check();
+}
+
+static bool do_show(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    return show_queue(0);
+}
+
+/* Signal handlers */
+static void sigsegvhandler(int sig)
+{
+    report(1,
+           "Segmentation fault occurred.  You dereferenced a NULL or invalid "
+           "pointer");
+    /* Raising a SIGABRT signal to produce a core dump for debugging. */
+    abort();
+}
+
+static void sigalrmhandler(int sig)
+{
+    trigger_exception(
+        "Time limit exceeded.  Either you are in an infinite loop, or your "
+        "code is too inefficient");
+}
+
+static void queue_init()
+{
+    fail_count = 0;
+    q = NULL;
+    current = previous = add_queue("main");
+    set_target_function(select_target);
+    /* Tie harness modes to this thread, not to one freeing queues */
+    set_cautious_mode(true);
+    signal(SIGSEGV, sigsegvhandler);
+    signal(SIGALRM, sigalrmhandler);
+}
+
+static bool queue_quit(int argc, char *argv[])
+{
+    report(3, "Freeing queue");
+    if (q && q->wal)
+        close_wal();
+    use_queue(current);
+    for (size_t i = 0; wal && i < queue_cnt; i++) {
+        if (queues[i].q && queues[i].q->wal) {
+            use_queue(i);
+            close_wal();
+        }
+    }
+
+    if (exception_setup(true)) {
+        for (size_t i = 0; i < queue_cnt; i++) {
+            if (queues[i].cnt > big_queue_size)
+                set_cautious_mode(false);
+            q_free(queues[i].q);
+            queues[i].q = NULL;
+            set_cautious_mode(true);
+        }
+        for (int i = 0; i < MAXSNAPS; i++) {
+            q_snap_free(snaps[i].s);
+            snaps[i].s = NULL;
+        }
+        tq_free(tq);
+        shq_detach(shq);
+        if (pqcnt > big_queue_size)
+            set_cautious_mode(false);
+        pq_free(pq);
+    }
+    exception_cancel();
+    set_cautious_mode(true);
+    q_free_async(false);
+    q = NULL;
+
+    for (size_t i = 0; i < queue_cnt; i++)
+        free_string(queues[i].name);
+    free_array(queues, queue_cap, sizeof(named_queue_t));
+    queues = NULL;
+    queue_cnt = queue_cap = 0;
+
+    size_t bcnt = allocation_check();
+    if (bcnt > 0) {
+        report(1, "ERROR: Freed queue, but %lu blocks are still allocated",
+               bcnt);
+        return false;
+    }
+
+    return true;
+}
+
+static void usage(char *cmd)
+{
+    printf("Usage: %s [-h] [-f IFILE][-v VLEVEL][-l LFILE]\n", cmd);
+    printf("\t-h         Print this information\n");
+    printf("\t-f IFILE   Read commands from IFILE\n");
+    printf("\t-v VLEVEL  Set verbosity level\n");
+    printf("\t-l LFILE   Echo results to LFILE\n");
+    exit(0);
 }
 
 #define GIT_HOOK ".git/hooks/"
 static bool sanity_check()
 {
-    struct stat buf;
-    /* Directory .git not found */
-    if (stat(".git", &buf)) {
-        fprintf(stderr,
-                "FATAL: You should run qtest in the directory containing valid "
-                "git workspace.\n");
+    struct stat buf;
+    /* Directory .git not found */
+    if (stat(".git", &buf)) {
+        fprintf(stderr,
+                "FATAL: You should run qtest in the directory containing valid "
+                "git workspace.\n");
+        return false;
+    }
+    /* Expected pre-commit and pre-push hooks not found */
+    if (stat(GIT_HOOK "commit-msg", &buf) ||
+        stat(GIT_HOOK "pre-commit", &buf) || stat(GIT_HOOK "pre-push", &buf)) {
+        fprintf(stderr, "FATAL: Git hooks are not properly installed.\n");
+
+        /* Attempt to install Git hooks */
+        char *argv[] = {"sh", "-c", "scripts/install-git-hooks", NULL};
+        extern char **environ;
+        pid_t pid;
+        int status = posix_spawn(&pid, "/bin/sh", NULL, NULL, argv, environ);
+        if (status == 0) {
+            /* Finally, succeed */
+            if ((waitpid(pid, &status, 0) != -1) && (status == 0))
+                return true;
+            perror("waitpid");
+        }
+        return false;
+    }
+    return true;
+}
+
+
+#define BUFSIZE 256
+int main(int argc, char *argv[])
+{
+    /* sanity check for git hook integration */
+    if (!sanity_check())
+        return -1;
+
+    /* To hold input file name */
+    char buf[BUFSIZE];
+    char *infile_name = NULL;
+    char lbuf[BUFSIZE];
+    char *logfile_name = NULL;
+    int level = 4;
+    int c;
+
+    while ((c = getopt(argc, argv, "hv:f:l:")) != -1) {
+        switch (c) {
+        case 'h':
+            usage(argv[0]);
+            break;
+        case 'f':
+            strncpy(buf, optarg, BUFSIZE);
+            buf[BUFSIZE - 1] = '\0';
+            infile_name = buf;
+            break;
+        case 'v': {
+            char *endptr;
+            errno = 0;
+            level = strtol(optarg, &endptr, 10);
+            if (errno != 0 || endptr == optarg) {
+                fprintf(stderr, "Invalid verbosity level\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'l':
+            strncpy(lbuf, optarg, BUFSIZE);
+            buf[BUFSIZE - 1] = '\0';
+            logfile_name = lbuf;
+            break;
+        default:
+            printf("Unknown option '%c'\n", c);
+            usage(argv[0]);
+            break;
+        }
+    }
+
+    srand((unsigned int) (time(NULL)));
+    queue_init();
+    init_cmd();
+    console_init();
+    bench_init();
+    zygote_init();
+
+    /* Trigger call back function(auto completion) */
+    linenoiseSetCompletionCallback(completion);
+
+    linenoiseHistorySetMaxLen(HISTORY_LEN);
+    linenoiseHistoryLoad(HISTORY_FILE); /* Load the history at startup */
+    set_verblevel(level);
+    if (level > 1) {
+        set_echo(true);
+    }
+    if (logfile_name)
+        set_logfile(logfile_name);
+
+    add_quit_helper(queue_quit);
+
+    bool ok = true;
+    ok = ok && run_console(infile_name);
+    ok = ok && finish_cmd();
+
+    return ok ? 0 : 1;
+}
+
+static bool do_merge(int argc, char *argv[])
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    long k, n = 1000;
+    if (!get_long(argv[1], &k) || k < 0 || k >= INT_MAX) {
+        report(1, "Invalid number of queues '%s'", argv[1]);
+        return false;
+    }
+    if (argc == 3 && (!get_long(argv[2], &n) || n < 0)) {
+        report(1, "Invalid number of elements '%s'", argv[2]);
+        return false;
+    }
+    if (!q) {
+        report(3, "Warning: Calling merge on null queue");
+        return !error_check();
+    }
+    error_check();
+
+    /* Slot 0 is the current queue, followed by the k shards */
+    queue_t **qs = calloc(k + 1, sizeof(queue_t *));
+    if (!qs) {
+        report(1, "ERROR: Could not allocate %ld queues", k);
+        return false;
+    }
+    qs[0] = q;
+
+    bool ok = true;
+    char randstr_buf[MAX_RANDSTR_LEN];
+    if (qcnt + k * n > big_queue_size)
+        set_cautious_mode(false);
+    if (exception_setup(true)) {
+        q_sort(q);
+        for (long i = 1; ok && i <= k; i++) {
+            ok = (qs[i] = q_new()) != NULL;
+            for (long j = 0; ok && j < n; j++) {
+                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+                ok = q_insert_tail(qs[i], randstr_buf);
+            }
+            if (ok)
+                q_sort(qs[i]);
+        }
+    } else
+        ok = false;
+    exception_cancel();
+    if (!ok)
+        report(1, "ERROR: Could not build %ld sorted queues", k);
+
+    /* Merging a queue with itself must be refused */
+    queue_t *twice[] = {q, q};
+    if (ok && exception_setup(true) && q_merge_sorted(twice, 2)) {
+        report(1, "ERROR: Merged queue with itself");
+        ok = false;
+    }
+    exception_cancel();
+
+    double elapsed;
+    init_time(&elapsed);
+    if (ok && exception_setup(true))
+        ok = q_merge_sorted(qs, k + 1);
+    exception_cancel();
+    elapsed = delta_time(&elapsed);
+
+    if (ok) {
+        qcnt += k * n;
+        for (list_ele_t *e = q->head; e && e->next; e = e->next) {
+            if (strcmp(e->value, e->next->value) > 0) {
+                report(1, "ERROR: Merged queue not in ascending order");
+                ok = false;
+                break;
+            }
+        }
+        if (ok)
+            report(2, "Merged %ld sorted queues into %lu elements: %.3f s",
+                   k + 1, q_size(q), elapsed);
+    } else
+        qcnt = q_size(q);
+
+    for (long i = 1; i <= k; i++) {
+        if (ok && q_size(qs[i])) {
+            report(1, "ERROR: Queue %ld not empty after merge", i);
+            ok = false;
+        }
+        q_free(qs[i]);
+    }
+    free(qs);
+    set_cautious_mode(true);
+
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_rotate(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    long n;
+    if (!get_long(argv[1], &n) || n < 0) {
+        report(1, "Invalid number of elements '%s'", argv[1]);
+        return false;
+    }
+    if (!q) {
+        report(3, "Warning: Calling rotate on null queue");
+        return !error_check();
+    }
+    error_check();
+    expand_queue();
+
+    /*
+     * Remember which elements should end up at head and tail. Splitting
+     * copies the elements it moves if they are shared with snapshots, and
+     * may free those then, so remember their strings instead.
+     */
+    bool shared = q_shared(q) > 0;
+    list_ele_t *head = q->head, *tail = q->tail;
+    for (long i = 0; i < n && head; i++) {
+        tail = head;
+        head = head->next;
+    }
+    if (!head)
+        head = q->head;
+    char *head_value = NULL, *tail_value = NULL;
+    if (shared) {
+        head_value = strdup(head->value);
+        tail_value = strdup(tail->value);
+        if (!head_value || !tail_value) {
+            report(1, "INTERNAL ERROR.  Could not allocate space for string");
+            free(head_value);
+            free(tail_value);
+            return false;
+        }
+    }
+
+    bool ok = false;
+    double split_time, concat_time;
+    if (qcnt > big_queue_size)
+        set_cautious_mode(false);
+    if (exception_setup(true)) {
+        init_time(&split_time);
+        queue_t *front = q_split(q, n);
+        split_time = delta_time(&split_time);
+        if (front) {
+            init_time(&concat_time);
+            ok = q_concat(q, front);
+            concat_time = delta_time(&concat_time);
+            q_free(front);
+        } else if ((size_t) n <= qcnt) {
+            report(1, "ERROR: Could not split queue");
+        }
+    }
+    exception_cancel();
+    set_cautious_mode(true);
+
+    if (!ok) {
+        if ((size_t) n > qcnt)
+            report(1, "ERROR: Queue has only %lu elements", qcnt);
+        qcnt = q_size(q);
+        free(head_value);
+        free(tail_value);
+        return false;
+    }
+    if (q_size(q) != qcnt ||
+        (shared ? strcmp(q->head->value, head_value) ||
+                      strcmp(q->tail->value, tail_value)
+                : q->head != head || q->tail != tail)) {
+        report(1, "ERROR: Queue not rotated by %ld elements", n);
+        ok = false;
+    }
+    free(head_value);
+    free(tail_value);
+    report(2, "Split: %.6f s, concatenate: %.6f s", split_time, concat_time);
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_use(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    size_t i = find_queue(argv[1]);
+    if (i == queue_cnt) {
+        report(1, "Unknown queue '%s'", argv[1]);
+        return false;
+    }
+    use_queue(i);
+    show_queue(3);
+    return !error_check();
+}
+
+static bool do_concat(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    size_t i = find_queue(argv[1]);
+    if (i == queue_cnt || i == current || !queues[i].q) {
+        report(1, "No other queue '%s' to concatenate", argv[1]);
+        return false;
+    }
+    if (!q)
+        report(3, "Warning: Calling concat on null queue");
+    error_check();
+    expand_queue();
+
+    bool ok = false;
+    queue_t *src = queues[i].q;
+    if (exception_setup(true))
+        ok = q_concat(q, src);
+    exception_cancel();
+
+    if (ok) {
+        qcnt += queues[i].cnt;
+        queues[i].cnt = 0;
+    } else if (q) {
+        report(1, "ERROR: Could not concatenate queue '%s'", argv[1]);
+    }
+    if (ok && q_size(src)) {
+        report(1, "ERROR: Queue '%s' not empty after concatenation", argv[1]);
+        ok = false;
+    }
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_split(int argc, char *argv[])
+{
+    if (argc != 3) {
+        report(1, "%s needs 2 arguments", argv[0]);
+        return false;
+    }
+
+    long n;
+    if (!get_long(argv[1], &n) || n < 0) {
+        report(1, "Invalid number of elements '%s'", argv[1]);
+        return false;
+    }
+    size_t i = find_queue(argv[2]);
+    if (i < queue_cnt && (i == current || queues[i].q)) {
+        report(1, "Queue '%s' exists already", argv[2]);
+        return false;
+    }
+    if (!q) {
+        report(3, "Warning: Calling split on null queue");
+        return !error_check();
+    }
+    if ((size_t) n > qcnt) {
+        report(1, "Queue has only %lu elements", qcnt);
+        return false;
+    }
+    error_check();
+    expand_queue();
+
+    queue_t *front = NULL;
+    if (exception_setup(true))
+        front = q_split(q, n);
+    exception_cancel();
+
+    if (!front) {
+        report(1, "ERROR: Could not split queue");
+        qcnt = q_size(q);
+        return false;
+    }
+    i = add_queue(argv[2]);
+    queues[i].q = front;
+    queues[i].cnt = n;
+    qcnt -= n;
+
+    bool ok = true;
+    if (q_size(front) != (size_t) n || q_size(q) != qcnt) {
+        report(1, "ERROR: Queue not split after %ld elements", n);
+        ok = false;
+    }
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_stats(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    bool ok = true;
+    size_t live = 0, total = 0;
+    use_queue(current);
+    for (size_t i = 0; i < queue_cnt; i++) {
+        queue_t *nq = queues[i].q;
+        if (!nq)
+            continue;
+        /* Count list elements, and compacted ones which follow them */
+        size_t cnt = 0;
+        if (exception_setup(true)) {
+            for (list_ele_t *e = nq->head; e && cnt <= queues[i].cnt;
+                 e = e->next)
+                cnt++;
+            if (nq->packed)
+                cnt = q_size(nq);
+        }
+        exception_cancel();
+        if (cnt != queues[i].cnt || q_size(nq) != queues[i].cnt) {
+            report(1, "ERROR: Queue '%s' has %lu elements, but should have %lu",
+                   queues[i].name, cnt, queues[i].cnt);
+            ok = false;
+        }
+        report(3, "%s: %lu elements", queues[i].name, queues[i].cnt);
+        live++;
+        total += queues[i].cnt;
+    }
+
+    size_t blocks = allocation_check(), bytes = allocation_bytes();
+    report(1, "%lu queues, %lu elements, %lu blocks, %lu bytes", live, total,
+           blocks, bytes);
+    if (total)
+        report(2, "%.1f bytes per element", (double) bytes / total);
+    return ok && !error_check();
+}
+
+static bool do_pq_free(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!pq)
+        report(3, "Warning: Calling free on null priority queue");
+    error_check();
+
+    if (pqcnt > big_queue_size)
+        set_cautious_mode(false);
+    if (exception_setup(true))
+        pq_free(pq);
+    exception_cancel();
+    set_cautious_mode(true);
+    pq = NULL;
+    pqcnt = 0;
+    return !error_check();
+}
+
+static bool do_pq_new(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    bool ok = true;
+    if (pq)
+        ok = do_pq_free(argc, argv);
+
+    if (exception_setup(true))
+        pq = pq_new();
+    exception_cancel();
+    if (!pq) {
+        report(1, "ERROR: Could not create priority queue");
+        ok = false;
+    }
+    return ok && !error_check();
+}
+
+static bool do_pq_insert(int argc, char *argv[])
+{
+    char randstr_buf[MAX_RANDSTR_LEN];
+    long reps = 1;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+    if (argc == 3 && !get_long(argv[2], &reps)) {
+        report(1, "Invalid number of insertions '%s'", argv[2]);
+        return false;
+    }
+
+    char *inserts = argv[1];
+    bool need_rand = !strcmp(inserts, "RAND");
+    if (need_rand)
+        inserts = randstr_buf;
+
+    if (!pq)
+        report(3, "Warning: Calling insert on null priority queue");
+    error_check();
+
+    bool ok = true;
+    double elapsed;
+    init_time(&elapsed);
+    if (exception_setup(true)) {
+        for (long r = 0; ok && r < reps; r++) {
+            if (need_rand)
+                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+            if (pq_insert(pq, inserts)) {
+                pqcnt++;
+            } else {
+                fail_count++;
+                if (fail_count < fail_limit)
+                    report(2, "Insertion of %s failed", inserts);
+                else {
+                    report(1,
+                           "ERROR: Insertion of %s failed (%d failures total)",
+                           inserts, fail_count);
+                    ok = false;
+                }
+            }
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+    if (reps > 1)
+        report(3, "Inserted %ld strings: %.3f s", reps, delta_time(&elapsed));
+    return ok;
+}
+
+static bool do_pq_remove(int argc, char *argv[])
+{
+    long reps = 1;
+    if (argc > 3 || (argc == 3 && !get_long(argv[2], &reps))) {
+        report(1, "%s needs 0-2 arguments", argv[0]);
+        return false;
+    }
+
+    /* Keep the previous string around to check the order of removals */
+    char *removes = malloc(2 * (string_length + 1));
+    if (!removes) {
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for removed strings");
+        return false;
+    }
+    char *prev = removes + string_length + 1;
+
+    if (!pq)
+        report(3, "Warning: Calling remove on null priority queue");
+    error_check();
+
+    bool ok = true;
+    bool check = argc > 1 && strcmp(argv[1], "RAND");
+    long removed = 0;
+    double elapsed;
+    if (pqcnt > big_queue_size)
+        set_cautious_mode(false);
+    init_time(&elapsed);
+    for (long r = 0; ok && r < reps; r++) {
+        bool rval = false;
+        if (exception_setup(true))
+            rval = pq_remove_min(pq, removes, string_length + 1);
+        exception_cancel();
+
+        if (!rval) {
+            fail_count++;
+            if (fail_count < fail_limit) {
+                report(2, "Removal from priority queue failed");
+            } else {
+                report(1,
+                       "ERROR: Removal from priority queue failed (%d "
+                       "failures total)",
+                       fail_count);
+                ok = false;
+            }
+            continue;
+        }
+        pqcnt--;
+        if (reps == 1)
+            report(2, "Removed %s from priority queue", removes);
+        if (check && removed == 0 && strcmp(removes, argv[1])) {
+            report(1, "ERROR: Removed value %s != expected value %s", removes,
+                   argv[1]);
+            ok = false;
+        }
+        if (removed++ > 0 && strcmp(prev, removes) > 0) {
+            report(1, "ERROR: Removed %s after %s", removes, prev);
+            ok = false;
+        }
+        char *t = prev;
+        prev = removes;
+        removes = t;
+        ok = ok && !error_check();
+    }
+    set_cautious_mode(true);
+    if (reps > 1)
+        report(3, "Removed %ld strings: %.3f s", reps, delta_time(&elapsed));
+
+    free(removes < prev ? removes : prev);
+    return ok;
+}
+
+static bool do_insert_ttl(int argc, char *argv[])
+{
+    char randstr_buf[MAX_RANDSTR_LEN];
+    long ms, reps = 1;
+    if (argc != 3 && argc != 4) {
+        report(1, "%s needs 2-3 arguments", argv[0]);
+        return false;
+    }
+    if (!get_long(argv[2], &ms) || ms <= 0) {
+        report(1, "Invalid number of milliseconds '%s'", argv[2]);
+        return false;
+    }
+    if (argc == 4 && !get_long(argv[3], &reps)) {
+        report(1, "Invalid number of insertions '%s'", argv[3]);
+        return false;
+    }
+
+    char *inserts = argv[1];
+    bool need_rand = !strcmp(inserts, "RAND");
+    if (need_rand)
+        inserts = randstr_buf;
+
+    if (!q)
+        report(3, "Warning: Calling insert tail on null queue");
+    error_check();
+    expand_queue();
+
+    bool ok = true;
+    if (exception_setup(true)) {
+        for (long r = 0; ok && r < reps; r++) {
+            if (need_rand)
+                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+            if (q_insert_tail_ttl(q, inserts, ms)) {
+                qcnt++;
+            } else {
+                fail_count++;
+                if (fail_count < fail_limit)
+                    report(2, "Insertion of %s failed", inserts);
+                else {
+                    report(1,
+                           "ERROR: Insertion of %s failed (%d failures total)",
+                           inserts, fail_count);
+                    ok = false;
+                }
+            }
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+    show_queue(3);
+    return ok;
+}
+
+static bool do_tick(int argc, char *argv[])
+{
+    long ms, expect = -1;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+    if (!get_long(argv[1], &ms) || ms < 0) {
+        report(1, "Invalid number of milliseconds '%s'", argv[1]);
+        return false;
+    }
+    if (argc == 3 && (!get_long(argv[2], &expect) || expect < 0)) {
+        report(1, "Invalid number of elements '%s'", argv[2]);
+        return false;
+    }
+
+    if (!q)
+        report(3, "Warning: Calling tick on null queue");
+    error_check();
+
+    size_t expired = 0;
+    long now = q_clock(q) + ms;
+    double elapsed;
+    if (qcnt > big_queue_size)
+        set_cautious_mode(false);
+    init_time(&elapsed);
+    if (exception_setup(true))
+        expired = q_expire(q, now);
+    exception_cancel();
+    elapsed = delta_time(&elapsed);
+    set_cautious_mode(true);
+    qcnt -= expired;
+
+    bool ok = true;
+    if (q && q_clock(q) != now && q->ttl) {
+        report(1, "ERROR: Clock at %ld, but should be at %ld", q_clock(q),
+               now);
+        ok = false;
+    }
+    if (expect >= 0 && expired != (size_t) expect) {
+        report(1, "ERROR: Expired %lu elements, but should have expired %ld",
+               expired, expect);
+        ok = false;
+    }
+    report(2, "Expired %lu elements at %ld ms: %.6f s", expired, now,
+           elapsed);
+    show_queue(3);
+    return ok && !error_check();
+}
+
+static bool do_shm_detach(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!shq)
+        report(3, "Warning: Calling detach on null shared queue");
+    error_check();
+
+    if (exception_setup(true))
+        shq_detach(shq);
+    exception_cancel();
+    shq = NULL;
+    return !error_check();
+}
+
+static bool do_shm_new(int argc, char *argv[])
+{
+    long bytes = 1 << 20;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+    if (argc == 3 && (!get_long(argv[2], &bytes) || bytes <= 0)) {
+        report(1, "Invalid number of bytes '%s'", argv[2]);
+        return false;
+    }
+
+    bool ok = true;
+    if (shq)
+        ok = do_shm_detach(1, argv);
+
+    if (exception_setup(true))
+        shq = shq_create(argv[1], bytes);
+    exception_cancel();
+    if (!shq) {
+        report(1, "ERROR: Could not create shared queue %s", argv[1]);
+        ok = false;
+    }
+    return ok && !error_check();
+}
+
+static bool do_shm_attach(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    bool ok = true;
+    if (shq)
+        ok = do_shm_detach(1, argv);
+
+    if (exception_setup(true))
+        shq = shq_attach(argv[1]);
+    exception_cancel();
+    if (!shq) {
+        report(1, "ERROR: Could not attach to shared queue %s", argv[1]);
+        ok = false;
+    }
+    return ok && !error_check();
+}
+
+static bool do_shm_unlink(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!shq_unlink(argv[1])) {
+        report(1, "ERROR: Could not remove shared memory region %s", argv[1]);
+        return false;
+    }
+    return true;
+}
+
+static bool do_shm_insert(int argc, char *argv[])
+{
+    char randstr_buf[MAX_RANDSTR_LEN];
+    long reps = 1;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+    if (argc == 3 && !get_long(argv[2], &reps)) {
+        report(1, "Invalid number of insertions '%s'", argv[2]);
+        return false;
+    }
+
+    char *inserts = argv[1];
+    bool need_rand = !strcmp(inserts, "RAND");
+    if (need_rand)
+        inserts = randstr_buf;
+
+    if (!shq)
+        report(3, "Warning: Calling insert tail on null shared queue");
+    error_check();
+
+    bool ok = true;
+    if (exception_setup(true)) {
+        for (long r = 0; ok && r < reps; r++) {
+            if (need_rand)
+                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+            if (!shq_insert_tail(shq, inserts)) {
+                fail_count++;
+                if (fail_count < fail_limit)
+                    report(2, "Insertion of %s failed", inserts);
+                else {
+                    report(1,
+                           "ERROR: Insertion of %s failed (%d failures total)",
+                           inserts, fail_count);
+                    ok = false;
+                }
+            }
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+    return ok;
+}
+
+static bool do_shm_remove(int argc, char *argv[])
+{
+    long reps = 1;
+    if (argc > 3 || (argc == 3 && !get_long(argv[2], &reps))) {
+        report(1, "%s needs 0-2 arguments", argv[0]);
         return false;
     }
-    /* Expected pre-commit and pre-push hooks not found */
-    if (stat(GIT_HOOK "commit-msg", &buf) ||
-        stat(GIT_HOOK "pre-commit", &buf) || stat(GIT_HOOK "pre-push", &buf)) {
-        fprintf(stderr, "FATAL: Git hooks are not properly installed.\n");
 
-        /* Attempt to install Git hooks */
-        char *argv[] = {"sh", "-c", "scripts/install-git-hooks", NULL};
-        extern char **environ;
-        pid_t pid;
-        int status = posix_spawn(&pid, "/bin/sh", NULL, NULL, argv, environ);
-        if (status == 0) {
-            /* Finally, succeed */
-            if ((waitpid(pid, &status, 0) != -1) && (status == 0))
-                return true;
-            perror("waitpid");
+    char *removes = malloc(string_length + 1);
+    if (!removes) {
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for removed strings");
+        return false;
+    }
+
+    if (!shq)
+        report(3, "Warning: Calling remove head on null shared queue");
+    error_check();
+
+    bool ok = true;
+    bool check = argc > 1 && strcmp(argv[1], "RAND");
+    for (long r = 0; ok && r < reps; r++) {
+        bool rval = false;
+        if (exception_setup(true))
+            rval = shq_remove_head(shq, removes, string_length + 1);
+        exception_cancel();
+
+        if (!rval) {
+            fail_count++;
+            if (fail_count < fail_limit) {
+                report(2, "Removal from shared queue failed");
+            } else {
+                report(1,
+                       "ERROR: Removal from shared queue failed (%d failures "
+                       "total)",
+                       fail_count);
+                ok = false;
+            }
+            continue;
+        }
+        if (reps == 1)
+            report(2, "Removed %s from shared queue", removes);
+        if (check && strcmp(removes, argv[1])) {
+            report(1, "ERROR: Removed value %s != expected value %s", removes,
+                   argv[1]);
+            ok = false;
+        }
+        ok = ok && !error_check();
+    }
+
+    free(removes);
+    return ok;
+}
+
+static bool do_shm_stats(int argc, char *argv[])
+{
+    long expect = -1;
+    if (argc > 2 ||
+        (argc == 2 && (!get_long(argv[1], &expect) || expect < 0))) {
+        report(1, "%s needs a non-negative expected size", argv[0]);
+        return false;
+    }
+
+    if (!shq) {
+        report(1, "Warning: No shared queue");
+        return true;
+    }
+
+    bool ok = true;
+    size_t cnt = shq_size(shq);
+    if (expect >= 0 && cnt != (size_t) expect) {
+        report(1, "ERROR: Shared queue size is %lu, but should be %ld", cnt,
+               expect);
+        ok = false;
+    }
+    shq_header_t *h = shq->hdr;
+    report(1,
+           "%lu elements in %lu bytes of blocks. Region of %lu bytes, %lu "
+           "never used. Recovered from %lu dead processes",
+           cnt, (size_t) h->used, (size_t) h->bytes,
+           (size_t) (h->bytes - h->brk), (size_t) h->recoveries);
+    return ok;
+}
+
+static bool do_wal(int argc, char *argv[])
+{
+    if (argc == 3 && !strcmp(argv[1], "open")) {
+        if (wal) {
+            report(1, "ERROR: A queue is logged already");
+            return false;
+        }
+        if (!q || q_size(q)) {
+            report(1, "ERROR: Need an empty queue to recover");
+            return false;
+        }
+        if (wal_interval < 0 || wal_batch <= 0) {
+            report(1, "ERROR: Invalid walus %d or walbatch %d", wal_interval,
+                   wal_batch);
+            return false;
+        }
+        error_check();
+        set_cautious_mode(false);
+        if (exception_setup(true))
+            wal = wal_open(argv[2], q, wal_interval, wal_batch);
+        exception_cancel();
+        set_cautious_mode(true);
+        qcnt = q_size(q);
+        if (!wal) {
+            report(1, "ERROR: Could not recover queue from log %s", argv[2]);
+            return false;
         }
+        q_log(q, wal);
+        wal_stats_t st;
+        wal_stats(wal, &st);
+        report(2, "Recovered %lu elements from %lu records", qcnt,
+               (size_t) st.recovered);
+        show_queue(3);
+        return !error_check();
+    }
+
+    if (argc == 3 && !strcmp(argv[1], "unlink")) {
+        if (!wal_unlink(argv[2]))
+            report(3, "Warning: No log %s", argv[2]);
+        return true;
+    }
+
+    if (argc != 2 || (strcmp(argv[1], "close") && strcmp(argv[1], "sync") &&
+                      strcmp(argv[1], "checkpoint") &&
+                      strcmp(argv[1], "stats"))) {
+        report(1,
+               "Usage: %s open PATH | close | sync | checkpoint | stats | "
+               "unlink PATH",
+               argv[0]);
+        return false;
+    }
+    if (!wal) {
+        report(1, "ERROR: No queue is logged");
         return false;
     }
+
+    if (!strcmp(argv[1], "close")) {
+        /* The logged queue may not be the one in use */
+        size_t saved = current;
+        for (size_t i = 0; !(q && q->wal) && i < queue_cnt; i++)
+            use_queue(i);
+        bool ok = close_wal();
+        use_queue(saved);
+        return ok;
+    }
+
+    if (!strcmp(argv[1], "sync")) {
+        wal_stats_t st;
+        wal_stats(wal, &st);
+        double t;
+        init_time(&t);
+        if (!wal_commit(wal, st.records, true)) {
+            report(1, "ERROR: Write-ahead log failed to commit records");
+            return false;
+        }
+        report(2, "Committed records in %.6f s", delta_time(&t));
+        return true;
+    }
+
+    if (!strcmp(argv[1], "checkpoint")) {
+        if (!q || q->wal != wal) {
+            report(1, "ERROR: Queue in use is not the logged one");
+            return false;
+        }
+        double t;
+        init_time(&t);
+        if (!wal_checkpoint(wal, q)) {
+            report(1, "ERROR: Could not checkpoint queue");
+            return false;
+        }
+        report(2, "Wrote snapshot of %lu elements in %.6f s", q_size(q),
+               delta_time(&t));
+        return true;
+    }
+
+    wal_stats_t st;
+    wal_stats(wal, &st);
+    report(1,
+           "%lu records in %lu commits (%lu bytes), %.0f records/s, %lu "
+           "recovered",
+           (size_t) st.records, (size_t) st.commits, (size_t) st.bytes,
+           st.seconds > 0 ? st.records / st.seconds : 0,
+           (size_t) st.recovered);
+    report(1,
+           "Commit latency: p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 "
+           "%.1f us, max %.1f us",
+           st.p50, st.p90, st.p99, st.p999, st.max);
     return true;
 }
 
+/* Fill addr with Unix socket path, return false if it is too long */
+static bool socket_addr(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        report(1, "ERROR: Socket path %s is too long", path);
+        return false;
+    }
+    strcpy(addr->sun_path, path);
+    return true;
+}
 
-#define BUFSIZE 256
-int main(int argc, char *argv[])
+/*
+ * Connect to the primary listening at socket path, waiting up to 5 seconds
+ * for it to start. Return the socket, or -1 if could not connect.
+ */
+static int connect_primary(const char *path)
 {
-    /* sanity check for git hook integration */
-    if (!sanity_check())
+    struct sockaddr_un addr;
+    if (!socket_addr(path, &addr))
         return -1;
+    for (int tries = 0; tries < 100; tries++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            break;
+        if (!connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+            return fd;
+        close(fd);
+        usleep(50000);
+    }
+    report(1, "ERROR: Could not connect to primary at %s", path);
+    return -1;
+}
 
-    /* To hold input file name */
-    char buf[BUFSIZE];
-    char *infile_name = NULL;
-    char lbuf[BUFSIZE];
-    char *logfile_name = NULL;
-    int level = 4;
-    int c;
+/* Replicate into empty queue r from socket fd, reporting how it went */
+static bool follow(int fd, queue_t *r)
+{
+    wal_stats_t st;
+    bool ok = wal_follow(fd, r, &st);
+    close(fd);
+    report(1,
+           "Follower applied %lu records in %lu frames (%lu bytes), %.0f "
+           "records/s",
+           (size_t) st.records, (size_t) st.commits, (size_t) st.bytes,
+           st.seconds > 0 ? st.records / st.seconds : 0);
+    report(1,
+           "Follower lag: p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f "
+           "us, max %.1f us",
+           st.p50, st.p90, st.p99, st.p999, st.max);
+    if (!ok)
+        report(1, "ERROR: Replica differs from primary, or primary went away");
+    return ok;
+}
 
-    while ((c = getopt(argc, argv, "hv:f:l:")) != -1) {
-        switch (c) {
-        case 'h':
-            usage(argv[0]);
-            break;
-        case 'f':
-            strncpy(buf, optarg, BUFSIZE);
-            buf[BUFSIZE - 1] = '\0';
-            infile_name = buf;
-            break;
-        case 'v': {
-            char *endptr;
-            errno = 0;
-            level = strtol(optarg, &endptr, 10);
-            if (errno != 0 || endptr == optarg) {
-                fprintf(stderr, "Invalid verbosity level\n");
-                exit(EXIT_FAILURE);
-            }
-            break;
+/*
+ * Stop shipping to the follower once it caught up, reporting how it went,
+ * and wait for the follower process, if forked.
+ */
+static bool stop_repl()
+{
+    repl_serving = false;
+    size_t saved = current;
+    for (size_t i = 0; !(q && q->wal) && i < queue_cnt; i++)
+        use_queue(i);
+    double t;
+    init_time(&t);
+    bool ok = wal_unship(wal, q);
+    wal_stats_t st;
+    wal_stats(wal, &st);
+    report(2, "Follower caught up in %.6f s", delta_time(&t));
+    report(1,
+           "Primary shipped through record %lu, %lu frames (%lu bytes) "
+           "committed, follower at most %lu records behind",
+           (size_t) st.shipped, (size_t) st.commits, (size_t) st.bytes,
+           (size_t) st.max_lag);
+    if (repl_own_wal) {
+        repl_own_wal = false;
+        ok = close_wal() && ok;
+    }
+    use_queue(saved);
+    if (repl_child > 0) {
+        int status;
+        ok = waitpid(repl_child, &status, 0) == repl_child &&
+             WIFEXITED(status) && !WEXITSTATUS(status) && ok;
+        repl_child = 0;
+    }
+    if (!ok)
+        report(1, "ERROR: Follower failed to replicate queue");
+    return ok;
+}
+
+/*
+ * Listen at socket path, optionally forking a follower to connect to it,
+ * and ship the queue in use to the first follower which does
+ */
+static bool serve_repl(const char *path, bool forked)
+{
+    if (repl_serving) {
+        report(1, "ERROR: Serving a follower already");
+        return false;
+    }
+    if (!q || (wal && q->wal != wal)) {
+        report(1, "ERROR: Need a queue, logged unless no queue is");
+        return false;
+    }
+    struct sockaddr_un addr;
+    if (!socket_addr(path, &addr))
+        return false;
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) ||
+        listen(lfd, 1)) {
+        if (lfd >= 0)
+            close(lfd);
+        report(1, "ERROR: Could not listen at %s", path);
+        return false;
+    }
+
+    if (forked) {
+        /* Keep buffered output from being written twice */
+        fflush(NULL);
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(lfd);
+            int fd = connect_primary(path);
+            queue_t *r = fd < 0 ? NULL : q_new();
+            bool ok = r && follow(fd, r);
+            fflush(NULL);
+            _exit(ok ? 0 : 1);
         }
-        case 'l':
-            strncpy(lbuf, optarg, BUFSIZE);
-            buf[BUFSIZE - 1] = '\0';
-            logfile_name = lbuf;
-            break;
-        default:
-            printf("Unknown option '%c'\n", c);
-            usage(argv[0]);
-            break;
+        if (pid < 0) {
+            close(lfd);
+            unlink(path);
+            report(1, "ERROR: Could not fork follower process");
+            return false;
         }
+        repl_child = pid;
     }
 
-    srand((unsigned int) (time(NULL)));
-    queue_init();
-    init_cmd();
-    console_init();
+    report(2, "Waiting for follower at %s", path);
+    int fd = accept(lfd, NULL, NULL);
+    close(lfd);
+    unlink(path);
+    if (fd >= 0 && !wal) {
+        wal = wal_open(NULL, q, wal_interval, wal_batch);
+        repl_own_wal = wal != NULL;
+        q_log(q, wal);
+    }
+    if (fd < 0 || !wal || !wal_ship(wal, fd, q)) {
+        if (fd >= 0)
+            close(fd);
+        report(1, "ERROR: Could not ship queue to follower");
+        if (repl_own_wal) {
+            repl_own_wal = false;
+            close_wal();
+        }
+        if (repl_child > 0)
+            waitpid(repl_child, NULL, 0);
+        repl_child = 0;
+        return false;
+    }
+    repl_serving = true;
+    report(2, "Shipping %lu elements and their changes to follower", qcnt);
+    return true;
+}
 
-    /* Trigger call back function(auto completion) */
-    linenoiseSetCompletionCallback(completion);
+static bool do_repl(int argc, char *argv[])
+{
+    if (argc == 3 && !strcmp(argv[1], "follow")) {
+        if (!q || q_size(q) || q->wal) {
+            report(1, "ERROR: Need an empty queue, not logged");
+            return false;
+        }
+        int fd = connect_primary(argv[2]);
+        if (fd < 0)
+            return false;
+        error_check();
+        set_cautious_mode(false);
+        bool ok = false;
+        /* Replication runs as long as the primary ships */
+        if (exception_setup(false))
+            ok = follow(fd, q);
+        exception_cancel();
+        set_cautious_mode(true);
+        qcnt = q_size(q);
+        show_queue(3);
+        return ok && !error_check();
+    }
 
-    linenoiseHistorySetMaxLen(HISTORY_LEN);
-    linenoiseHistoryLoad(HISTORY_FILE); /* Load the history at startup */
-    set_verblevel(level);
-    if (level > 1) {
-        set_echo(true);
+    if ((argc == 3 || argc == 4) && !strcmp(argv[1], "serve")) {
+        if (argc == 4 && strcmp(argv[3], "fork")) {
+            report(1, "Usage: %s serve PATH [fork]", argv[0]);
+            return false;
+        }
+        return serve_repl(argv[2], argc == 4);
     }
-    if (logfile_name)
-        set_logfile(logfile_name);
 
-    add_quit_helper(queue_quit);
+    if (argc != 2 || strcmp(argv[1], "stop")) {
+        report(1, "Usage: %s serve PATH [fork] | stop | follow PATH", argv[0]);
+        return false;
+    }
+    if (!repl_serving) {
+        report(1, "ERROR: Not serving a follower");
+        return false;
+    }
+    return stop_repl();
+}
 
-    bool ok = true;
-    ok = ok && run_console(infile_name);
-    ok = ok && finish_cmd();
+/* Hash string s into the FNV-1a digest at arg */
+static void digest_string(const char *s, void *arg)
+{
+    uint64_t *h = arg;
+    do {
+        *h ^= (unsigned char) *s;
+        *h *= 1099511628211ULL;
+    } while (*s++);
+}
 
-    return ok ? 0 : 1;
+/* Parse the number of a taken snapshot */
+static bool get_snap(char *arg, int *n)
+{
+    if (!get_int(arg, n) || *n < 0 || *n >= MAXSNAPS || !snaps[*n].s) {
+        report(1, "ERROR: No snapshot '%s'", arg);
+        return false;
+    }
+    return true;
+}
+
+/* Free snapshot n, which may be the last one holding a big queue */
+static void free_snap(int n)
+{
+    if (snaps[n].cnt > big_queue_size)
+        set_cautious_mode(false);
+    if (exception_setup(true))
+        q_snap_free(snaps[n].s);
+    exception_cancel();
+    set_cautious_mode(true);
+    snaps[n].s = NULL;
+}
+
+static bool do_snap(int argc, char *argv[])
+{
+    if (argc == 2 && !strcmp(argv[1], "take")) {
+        if (!q) {
+            report(1, "ERROR: No queue to snapshot");
+            return false;
+        }
+        int n = 0;
+        while (n < MAXSNAPS && snaps[n].s)
+            n++;
+        if (n == MAXSNAPS) {
+            report(1, "ERROR: Cannot hold more than %d snapshots", MAXSNAPS);
+            return false;
+        }
+        error_check();
+        uint64_t digest = 14695981039346656037ULL;
+        qsnap_t *s = NULL;
+        double t = 0;
+        if (exception_setup(true)) {
+            q_foreach(q, digest_string, &digest);
+            init_time(&t);
+            s = q_clone(q);
+            t = delta_time(&t);
+        }
+        exception_cancel();
+        if (!s) {
+            report(1, "ERROR: Could not snapshot queue");
+            return false;
+        }
+        snaps[n].s = s;
+        snaps[n].cnt = qcnt;
+        snaps[n].digest = digest;
+        report(2, "Snapshot %d of %lu elements in %.6f s", n, qcnt, t);
+        return !error_check();
+    }
+
+    if (argc == 3 && !strcmp(argv[1], "show")) {
+        int n;
+        if (!get_snap(argv[2], &n))
+            return false;
+        struct show_arg arg = {1, 0, 0};
+        report_noreturn(1, "s%d = [", n);
+        if (exception_setup(true))
+            q_snap_foreach(snaps[n].s, show_string, &arg);
+        exception_cancel();
+        report(1, arg.cnt > big_queue_size ? " ... ]" : "]");
+        return !error_check();
+    }
+
+    if (argc == 2 && !strcmp(argv[1], "check")) {
+        bool ok = true;
+        int cnt = 0;
+        for (int n = 0; n < MAXSNAPS; n++) {
+            if (!snaps[n].s)
+                continue;
+            uint64_t digest = 14695981039346656037ULL;
+            size_t size = 0;
+            if (exception_setup(true))
+                size = q_snap_foreach(snaps[n].s, digest_string, &digest);
+            exception_cancel();
+            if (size != snaps[n].cnt || digest != snaps[n].digest) {
+                report(1,
+                       "ERROR: Snapshot %d has %lu elements, or changed "
+                       "strings, but had %lu",
+                       n, size, snaps[n].cnt);
+                ok = false;
+            }
+            cnt++;
+        }
+        report(1, "%d snapshots checked, queue shares %lu of %lu elements",
+               cnt, q_shared(q), q_size(q));
+        return ok && !error_check();
+    }
+
+    if ((argc == 2 || argc == 3) && !strcmp(argv[1], "free")) {
+        int n;
+        if (argc == 3 && !get_snap(argv[2], &n))
+            return false;
+        for (int i = 0; i < MAXSNAPS; i++)
+            if (snaps[i].s && (argc == 2 || i == n))
+                free_snap(i);
+        return !error_check();
+    }
+
+    report(1, "Usage: %s take | show N | check | free [N]", argv[0]);
+    return false;
 }
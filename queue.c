@@ -1,188 +1,2791 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "harness.h"
+#include "losertree.h"
 #include "queue.h"
+#include "wal.h"
 
 #define min(a, b)     \
     {                 \
         a < b ? a : b \
     }
 
+int prefetch_distance = 4;
+
+/* Append a record of a change of q to its write-ahead log, if any */
+static inline void q_record(queue_t *q, wal_op_t op, long arg, const char *s)
+{
+    if (q->wal)
+        wal_append(q->wal, op, arg, s);
+}
+
+/* FNV-1a hash of string s */
+static inline uint32_t str_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Hash index from strings to the elements holding them.
+ * Each distinct string owns a slot of an open-addressing table, which heads
+ * a doubly-linked chain of the entries of all elements holding the string.
+ * Another open-addressing table, keyed by element address, finds the entry
+ * of a given element. Thus removing any element takes expected O(1) time,
+ * however many duplicates of its string there are.
+ * Entries live in a pool array and refer to each other by position, where
+ * position 0 stands for none.
+ */
+typedef struct {
+    list_ele_t *node;
+    uint32_t prev, next; /* Neighbours in the chain of the same string */
+} hentry_t;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t first; /* First entry of the chain, 0 if the slot is empty */
+} hslot_t;
+
+struct HINDEX {
+    hentry_t *entries; /* Pool of entries, entries[0] is unused */
+    size_t pool_size;  /* Number of entries ever taken from the pool */
+    size_t pool_cap;
+    uint32_t free_entry; /* Freed entries, linked through next */
+    hslot_t *strs;       /* Table of distinct strings */
+    size_t str_count, str_cap;
+    uint32_t *nodes; /* Table of entries keyed by element address */
+    size_t node_count, node_cap;
+};
+
+/* Hash of element address, for the nodes table */
+static inline uint32_t ptr_hash(const list_ele_t *e)
+{
+    uint64_t x = (uintptr_t) e;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (uint32_t) x;
+}
+
+/* Return position of the slot of string s, or of the empty slot for it */
+static size_t index_str_pos(const hindex_t *idx, const char *s, uint32_t hash)
+{
+    size_t mask = idx->str_cap - 1;
+    size_t i = hash & mask;
+    while (idx->strs[i].first &&
+           (idx->strs[i].hash != hash ||
+            strcmp(idx->entries[idx->strs[i].first].node->value, s)))
+        i = (i + 1) & mask;
+    return i;
+}
+
+/* Return position of the nodes slot of element e, or of the empty slot */
+static size_t index_node_pos(const hindex_t *idx, const list_ele_t *e)
+{
+    size_t mask = idx->node_cap - 1;
+    size_t i = ptr_hash(e) & mask;
+    while (idx->nodes[i] && idx->entries[idx->nodes[i]].node != e)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/* Slot j may fill the hole at i unless its home k lies cyclically in (i, j] */
+static inline bool probe_may_move(size_t i, size_t j, size_t k)
+{
+    return i <= j ? (k <= i || j < k) : (k <= i && j < k);
+}
+
+/* Delete slot i of strs, shifting back later slots of its probe sequence */
+static void index_str_delete(hindex_t *idx, size_t i)
+{
+    size_t mask = idx->str_cap - 1;
+    for (size_t j = (i + 1) & mask; idx->strs[j].first; j = (j + 1) & mask) {
+        if (probe_may_move(i, j, idx->strs[j].hash & mask)) {
+            idx->strs[i] = idx->strs[j];
+            i = j;
+        }
+    }
+    idx->strs[i].first = 0;
+    idx->str_count--;
+}
+
+/* Delete slot i of nodes, shifting back later slots of its probe sequence */
+static void index_node_delete(hindex_t *idx, size_t i)
+{
+    size_t mask = idx->node_cap - 1;
+    for (size_t j = (i + 1) & mask; idx->nodes[j]; j = (j + 1) & mask) {
+        size_t k = ptr_hash(idx->entries[idx->nodes[j]].node) & mask;
+        if (probe_may_move(i, j, k)) {
+            idx->nodes[i] = idx->nodes[j];
+            i = j;
+        }
+    }
+    idx->nodes[i] = 0;
+    idx->node_count--;
+}
+
+/* Rebuild the strs table with capacity slots */
+static bool index_str_resize(hindex_t *idx, size_t capacity)
+{
+    hslot_t *slots = malloc(sizeof(hslot_t) * capacity);
+    if (!slots)
+        return false;
+    memset(slots, 0, sizeof(hslot_t) * capacity);
+    hslot_t *old = idx->strs;
+    size_t old_cap = idx->str_cap;
+    idx->strs = slots;
+    idx->str_cap = capacity;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i].first) {
+            size_t j = old[i].hash & (capacity - 1);
+            while (slots[j].first)
+                j = (j + 1) & (capacity - 1);
+            slots[j] = old[i];
+        }
+    }
+    free(old);
+    return true;
+}
+
+/* Rebuild the nodes table with capacity slots */
+static bool index_node_resize(hindex_t *idx, size_t capacity)
+{
+    uint32_t *slots = malloc(sizeof(uint32_t) * capacity);
+    if (!slots)
+        return false;
+    memset(slots, 0, sizeof(uint32_t) * capacity);
+    uint32_t *old = idx->nodes;
+    size_t old_cap = idx->node_cap;
+    idx->nodes = slots;
+    idx->node_cap = capacity;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i]) {
+            size_t j = ptr_hash(idx->entries[old[i]].node) & (capacity - 1);
+            while (slots[j])
+                j = (j + 1) & (capacity - 1);
+            slots[j] = old[i];
+        }
+    }
+    free(old);
+    return true;
+}
+
+/* Move the entry pool into an array with room for capacity entries */
+static bool index_pool_resize(hindex_t *idx, size_t capacity)
+{
+    hentry_t *entries = malloc(sizeof(hentry_t) * (capacity + 1));
+    if (!entries)
+        return false;
+    if (idx->entries)
+        memcpy(entries, idx->entries,
+               sizeof(hentry_t) * (idx->pool_size + 1));
+    free(idx->entries);
+    idx->entries = entries;
+    idx->pool_cap = capacity;
+    return true;
+}
+
+/*
+ * Make sure idx can take one more element, keeping the load factor of both
+ * tables at most 1/2. Return false if could not allocate space.
+ */
+static bool index_reserve(hindex_t *idx)
+{
+    /* Entries are numbered with 32 bits */
+    if (!idx->free_entry && idx->pool_size == idx->pool_cap &&
+        (idx->pool_cap >= UINT32_MAX / 2 ||
+         !index_pool_resize(idx, idx->pool_cap * 2)))
+        return false;
+    if (2 * (idx->node_count + 1) > idx->node_cap &&
+        !index_node_resize(idx, idx->node_cap * 2))
+        return false;
+    if (2 * (idx->str_count + 1) > idx->str_cap &&
+        !index_str_resize(idx, idx->str_cap * 2))
+        return false;
+    return true;
+}
+
+/* Add element e with string hash to idx, which must have room for it */
+static void index_put(hindex_t *idx, list_ele_t *e, uint32_t hash)
+{
+    uint32_t id = idx->free_entry;
+    if (id)
+        idx->free_entry = idx->entries[id].next;
+    else
+        id = ++idx->pool_size;
+    hentry_t *entry = &idx->entries[id];
+    entry->node = e;
+    entry->prev = 0;
+
+    size_t i = index_str_pos(idx, e->value, hash);
+    if (idx->strs[i].first) {
+        entry->next = idx->strs[i].first;
+        idx->entries[entry->next].prev = id;
+    } else {
+        entry->next = 0;
+        idx->strs[i].hash = hash;
+        idx->str_count++;
+    }
+    idx->strs[i].first = id;
+
+    idx->nodes[index_node_pos(idx, e)] = id;
+    idx->node_count++;
+}
+
+/* Return any element holding string s, or NULL if there is none */
+static list_ele_t *index_find(const hindex_t *idx, const char *s)
+{
+    size_t i = index_str_pos(idx, s, str_hash(s));
+    return idx->strs[i].first ? idx->entries[idx->strs[i].first].node : NULL;
+}
+
+/* Remove element e, which must be indexed, from the index of q */
+static void index_remove(queue_t *q, list_ele_t *e)
+{
+    hindex_t *idx = q->index;
+    if (!idx)
+        return;
+    size_t pos = index_node_pos(idx, e);
+    uint32_t id = idx->nodes[pos];
+    index_node_delete(idx, pos);
+
+    hentry_t *entry = &idx->entries[id];
+    if (entry->prev) {
+        idx->entries[entry->prev].next = entry->next;
+    } else {
+        size_t i = index_str_pos(idx, e->value, str_hash(e->value));
+        if (entry->next)
+            idx->strs[i].first = entry->next;
+        else
+            index_str_delete(idx, i);
+    }
+    if (entry->next)
+        idx->entries[entry->next].prev = entry->prev;
+    entry->node = NULL;
+    entry->next = idx->free_entry;
+    idx->free_entry = id;
+}
+
+/* Record that the string held by element from now lives in element to */
+static void index_move(queue_t *q, list_ele_t *from, list_ele_t *to)
+{
+    hindex_t *idx = q->index;
+    if (!idx)
+        return;
+    size_t pos = index_node_pos(idx, from);
+    uint32_t id = idx->nodes[pos];
+    index_node_delete(idx, pos);
+    idx->entries[id].node = to;
+    idx->nodes[index_node_pos(idx, to)] = id;
+    idx->node_count++;
+}
+
+/*
+ * Skip index over the elements of a queue.
+ * The linked list itself is the bottom level. An element promoted to upper
+ * levels gets a tower linking it to the next tower at each of its levels,
+ * together with the number of list positions that link spans. Elements are
+ * numbered from 1 at the head, the header standing at position 0, so spans
+ * give the position of every tower on the way down, and the bottom level is
+ * walked for just a few elements from the closest tower.
+ */
+#define SKIP_MAXLEVEL 16
+
+struct SKIPLEVEL {
+    struct SKIPNODE *next;
+    size_t span; /* Meaningless if next is NULL */
+};
+
+typedef struct SKIPNODE {
+    list_ele_t *ele; /* NULL for the header */
+    struct SKIPLEVEL lv[];
+} skipnode_t;
+
+struct SKIPLIST {
+    skipnode_t *header; /* Has all SKIP_MAXLEVEL levels */
+    int level;          /* Number of levels in use */
+    bool ordered;       /* Whether elements are kept in ascending order */
+};
+
+/* Draw the number of upper levels of a new element, 1/4 going one level up */
+static int skip_random_level()
+{
+    static uint32_t seed = 2463534242u;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    int level = seed ? __builtin_ctz(seed) / 2 : SKIP_MAXLEVEL;
+    return level < SKIP_MAXLEVEL ? level : SKIP_MAXLEVEL;
+}
+
+/*
+ * Allocate the tower of a new element, if it gets promoted at all.
+ * Return false if could not allocate space.
+ */
+static bool skip_tower_new(skipnode_t **tower, int *level)
+{
+    *level = skip_random_level();
+    *tower = NULL;
+    if (!*level)
+        return true;
+    *tower = malloc(sizeof(skipnode_t) + sizeof(struct SKIPLEVEL) * *level);
+    return *tower != NULL;
+}
+
+/* Free the skip index of q */
+static void skip_free(queue_t *q)
+{
+    if (!q->skip)
+        return;
+    skipnode_t *t = q->skip->header;
+    while (t) {
+        skipnode_t *next = t->lv[0].next;
+        free(t);
+        t = next;
+    }
+    free(q->skip);
+    q->skip = NULL;
+}
+
+/* Return whether q has a skip index keeping its elements in order */
+static bool skip_ordered(queue_t *q)
+{
+    return q->skip && q->skip->ordered;
+}
+
+/*
+ * Build a skip index over the elements of q.
+ * Return false if could not allocate space.
+ */
+static bool skip_build(queue_t *q, bool ordered)
+{
+    skiplist_t *sk = malloc(sizeof(skiplist_t));
+    if (!sk)
+        return false;
+    sk->header = malloc(sizeof(skipnode_t) +
+                        sizeof(struct SKIPLEVEL) * SKIP_MAXLEVEL);
+    if (!sk->header) {
+        free(sk);
+        return false;
+    }
+    sk->header->ele = NULL;
+    for (int i = 0; i < SKIP_MAXLEVEL; i++)
+        sk->header->lv[i].next = NULL;
+    sk->level = 0;
+    sk->ordered = ordered;
+    q->skip = sk;
+
+    skipnode_t *last[SKIP_MAXLEVEL];
+    size_t last_pos[SKIP_MAXLEVEL];
+    for (int i = 0; i < SKIP_MAXLEVEL; i++) {
+        last[i] = sk->header;
+        last_pos[i] = 0;
+    }
+    size_t pos = 1;
+    for (list_ele_t *e = q->head; e; e = e->next, pos++) {
+        int level;
+        skipnode_t *t;
+        if (!skip_tower_new(&t, &level)) {
+            for (int i = 0; i < SKIP_MAXLEVEL; i++)
+                last[i]->lv[i].next = NULL;
+            skip_free(q);
+            return false;
+        }
+        if (!t)
+            continue;
+        t->ele = e;
+        for (int i = 0; i < level; i++) {
+            last[i]->lv[i].next = t;
+            last[i]->lv[i].span = pos - last_pos[i];
+            last[i] = t;
+            last_pos[i] = pos;
+        }
+        if (level > sk->level)
+            sk->level = level;
+    }
+    for (int i = 0; i < SKIP_MAXLEVEL; i++)
+        last[i]->lv[i].next = NULL;
+    return true;
+}
+
+/*
+ * Find at each level the last tower before position pos, storing it in
+ * update and its position in rank.
+ */
+static void skip_descend(skiplist_t *sk,
+                         size_t pos,
+                         skipnode_t **update,
+                         size_t *rank)
+{
+    skipnode_t *x = sk->header;
+    size_t r = 0;
+    for (int i = sk->level - 1; i >= 0; i--) {
+        while (x->lv[i].next && r + x->lv[i].span < pos) {
+            r += x->lv[i].span;
+            x = x->lv[i].next;
+        }
+        update[i] = x;
+        rank[i] = r;
+    }
+}
+
+/*
+ * Add tower t with level levels, or nothing if t is NULL, to the skip index
+ * of q for element e just linked into the list at position pos.
+ */
+static void skip_link(queue_t *q,
+                      list_ele_t *e,
+                      size_t pos,
+                      skipnode_t *t,
+                      int level)
+{
+    skiplist_t *sk = q->skip;
+    skipnode_t *update[SKIP_MAXLEVEL];
+    size_t rank[SKIP_MAXLEVEL];
+    for (; sk->level < level; sk->level++)
+        sk->header->lv[sk->level].next = NULL;
+    skip_descend(sk, pos, update, rank);
+    for (int i = 0; i < level; i++) {
+        t->lv[i].next = update[i]->lv[i].next;
+        t->lv[i].span = update[i]->lv[i].span + rank[i] + 1 - pos;
+        update[i]->lv[i].next = t;
+        update[i]->lv[i].span = pos - rank[i];
+    }
+    for (int i = level; i < sk->level; i++)
+        update[i]->lv[i].span++;
+    if (t)
+        t->ele = e;
+}
+
+/*
+ * Remove from the skip index of q the element at position pos, before it
+ * gets unlinked from the list.
+ */
+static void skip_unlink(queue_t *q, size_t pos)
+{
+    skiplist_t *sk = q->skip;
+    skipnode_t *update[SKIP_MAXLEVEL];
+    size_t rank[SKIP_MAXLEVEL];
+    skip_descend(sk, pos, update, rank);
+    skipnode_t *t = NULL;
+    if (sk->level && update[0]->lv[0].next &&
+        rank[0] + update[0]->lv[0].span == pos)
+        t = update[0]->lv[0].next;
+    for (int i = 0; i < sk->level; i++) {
+        if (t && update[i]->lv[i].next == t) {
+            update[i]->lv[i].span += t->lv[i].span - 1;
+            update[i]->lv[i].next = t->lv[i].next;
+        } else {
+            update[i]->lv[i].span--;
+        }
+    }
+    free(t);
+    while (sk->level && !sk->header->lv[sk->level - 1].next)
+        sk->level--;
+}
+
+/*
+ * Return the last element holding a string less than s, or not greater
+ * than s if strict is false, in the ordered queue q. Store its position in
+ * *pos. Return NULL and store 0 if there is no such element.
+ */
+static list_ele_t *skip_find(queue_t *q,
+                             const char *s,
+                             bool strict,
+                             size_t *pos)
+{
+    skiplist_t *sk = q->skip;
+    skipnode_t *x = sk->header;
+    size_t r = 0;
+    for (int i = sk->level - 1; i >= 0; i--) {
+        while (x->lv[i].next) {
+            int cmp = strcmp(x->lv[i].next->ele->value, s);
+            if (cmp > 0 || (strict && cmp == 0))
+                break;
+            r += x->lv[i].span;
+            x = x->lv[i].next;
+        }
+    }
+    list_ele_t *e = x->ele;
+    for (list_ele_t *next = e ? e->next : q->head; next; next = next->next) {
+        int cmp = strcmp(next->value, s);
+        if (cmp > 0 || (strict && cmp == 0))
+            break;
+        e = next;
+        r++;
+    }
+    *pos = r;
+    return e;
+}
+
+/*
+ * Return the element at position pos - 1 of q, which has a skip index, or
+ * NULL if pos is 1.
+ */
+static list_ele_t *skip_before(queue_t *q, size_t pos)
+{
+    skiplist_t *sk = q->skip;
+    skipnode_t *x = sk->header;
+    size_t r = 0;
+    for (int i = sk->level - 1; i >= 0; i--) {
+        while (x->lv[i].next && r + x->lv[i].span < pos) {
+            r += x->lv[i].span;
+            x = x->lv[i].next;
+        }
+    }
+    list_ele_t *e = x->ele;
+    for (; r + 1 < pos; r++)
+        e = e ? e->next : q->head;
+    return e;
+}
+
+/*
+ * Point the towers of q up to position upto back at the elements at their
+ * positions, after the list got rearranged without changing its size.
+ */
+static void skip_refresh(queue_t *q, size_t upto)
+{
+    skipnode_t *t = q->skip->header->lv[0].next;
+    size_t next_pos = q->skip->header->lv[0].span;
+    size_t pos = 1;
+    for (list_ele_t *e = q->head; t && e && pos <= upto; e = e->next, pos++) {
+        if (pos == next_pos) {
+            t->ele = e;
+            next_pos += t->lv[0].span;
+            t = t->lv[0].next;
+        }
+    }
+}
+
+/*
+ * Get the skip index of q ready for a new element holding string s, to be
+ * linked between prev and next (either one NULL at the head or the tail).
+ * An ordered index stops being ordered if s would break the order. The
+ * tower of the new element is allocated.
+ * Return false if could not allocate space.
+ */
+static bool skip_prepare(queue_t *q,
+                         const char *s,
+                         list_ele_t *prev,
+                         list_ele_t *next,
+                         skipnode_t **tower,
+                         int *level)
+{
+    *tower = NULL;
+    *level = 0;
+    if (!q->skip)
+        return true;
+    if (q->skip->ordered && ((prev && strcmp(prev->value, s) > 0) ||
+                             (next && strcmp(s, next->value) > 0)))
+        q->skip->ordered = false;
+    return skip_tower_new(tower, level);
+}
+
+/*
+ * Front-coded store of the elements following the tail of a compacted queue.
+ * Each string is encoded as the length of the prefix it shares with the
+ * previous string, the length of the rest and the rest itself, both lengths
+ * as LEB128 varints. Entries are appended to the last of a list of blocks and
+ * decoded from the front, the string before the front being kept decoded.
+ */
+#define FC_BLOCK_SIZE 4096
+
+typedef struct FCBLOCK {
+    struct FCBLOCK *next;
+    size_t used; /* Bytes of data holding entries */
+    size_t cap;
+    unsigned char data[];
+} fcblock_t;
+
+struct FCSTORE {
+    fcblock_t *first, *last;
+    size_t read;    /* Offset of the next entry to decode in first */
+    size_t count;   /* Number of entries */
+    size_t max_len; /* Length of the longest string ever stored */
+    char *front;    /* The string before the next entry to decode */
+    char *back;     /* The last string appended */
+    size_t back_len;
+};
+
+static size_t varint_put(unsigned char *p, size_t v)
+{
+    size_t n = 0;
+    for (; v >= 0x80; v >>= 7)
+        p[n++] = (unsigned char) (v | 0x80);
+    p[n++] = (unsigned char) v;
+    return n;
+}
+
+static size_t varint_get(const unsigned char *p, size_t *v)
+{
+    size_t n = 0;
+    *v = 0;
+    for (int shift = 0;; shift += 7) {
+        unsigned char c = p[n++];
+        *v |= (size_t) (c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return n;
+    }
+}
+
+/* Free store st and all of its blocks */
+static void fc_free(fcstore_t *st)
+{
+    if (!st)
+        return;
+    while (st->first) {
+        fcblock_t *next = st->first->next;
+        free(st->first);
+        st->first = next;
+    }
+    free(st->front);
+    free(st->back);
+    free(st);
+}
+
+/*
+ * Replace buffer *buf, holding a string, with one of size bytes.
+ * Return false if could not allocate space.
+ */
+static bool fc_grow(char **buf, size_t size)
+{
+    char *p = malloc(size);
+    if (!p)
+        return false;
+    strcpy(p, *buf);
+    free(*buf);
+    *buf = p;
+    return true;
+}
+
+/* Return a new empty store, or NULL if could not allocate space */
+static fcstore_t *fc_new()
+{
+    fcstore_t *st = malloc(sizeof(fcstore_t));
+    if (!st)
+        return NULL;
+    memset(st, 0, sizeof(fcstore_t));
+    st->front = malloc(1);
+    st->back = malloc(1);
+    if (!st->front || !st->back) {
+        fc_free(st);
+        return NULL;
+    }
+    st->front[0] = st->back[0] = '\0';
+    return st;
+}
+
+/*
+ * Append string s to store st.
+ * Return false if could not allocate space, leaving st unchanged.
+ */
+static bool fc_append(fcstore_t *st, const char *s)
+{
+    size_t len = strlen(s);
+    if (len > st->max_len) {
+        /* Decoding from the front must never need to allocate */
+        if (!fc_grow(&st->front, len + 1) || !fc_grow(&st->back, len + 1))
+            return false;
+        st->max_len = len;
+    }
+
+    size_t prefix = 0;
+    while (prefix < st->back_len && st->back[prefix] == s[prefix])
+        prefix++;
+    unsigned char head[2 * sizeof(size_t) + 4];
+    size_t n = varint_put(head, prefix);
+    n += varint_put(head + n, len - prefix);
+
+    fcblock_t *b = st->last;
+    if (!b || b->cap - b->used < n + len - prefix) {
+        size_t cap = FC_BLOCK_SIZE - sizeof(fcblock_t);
+        if (cap < n + len - prefix)
+            cap = n + len - prefix;
+        b = malloc(sizeof(fcblock_t) + cap);
+        if (!b)
+            return false;
+        b->next = NULL;
+        b->used = 0;
+        b->cap = cap;
+        if (st->last)
+            st->last->next = b;
+        else
+            st->first = b;
+        st->last = b;
+    }
+    memcpy(b->data + b->used, head, n);
+    memcpy(b->data + b->used + n, s + prefix, len - prefix);
+    b->used += n + len - prefix;
+    memcpy(st->back + prefix, s + prefix, len - prefix + 1);
+    st->back_len = len;
+    st->count++;
+    return true;
+}
+
+/*
+ * Decode the entry at offset *off of block *b into buf, which holds the
+ * string before it, and move past the entry.
+ */
+static void fc_decode(fcblock_t **b, size_t *off, char *buf)
+{
+    size_t prefix, rest;
+    const unsigned char *p = (*b)->data + *off;
+    size_t n = varint_get(p, &prefix);
+    n += varint_get(p + n, &rest);
+    memcpy(buf + prefix, p + n, rest);
+    buf[prefix + rest] = '\0';
+    *off += n + rest;
+    if (*off == (*b)->used) {
+        *b = (*b)->next;
+        *off = 0;
+    }
+}
+
+/*
+ * Remove the first string of store st and return it, decoded into a buffer
+ * of st which stays valid until st changes. The caller must free st with
+ * fc_free once it is empty.
+ */
+static const char *fc_pop(fcstore_t *st)
+{
+    fcblock_t *b = st->first;
+    fc_decode(&st->first, &st->read, st->front);
+    if (st->first != b) {
+        free(b);
+        if (!st->first)
+            st->last = NULL;
+    }
+    st->count--;
+    return st->front;
+}
+
+/* Return the length of the first string of store st */
+static size_t fc_peek_len(fcstore_t *st)
+{
+    size_t prefix, rest;
+    const unsigned char *p = st->first->data + st->read;
+    varint_get(p + varint_get(p, &prefix), &rest);
+    return prefix + rest;
+}
+
+/* Cursor walking the strings of a store without removing them */
+typedef struct {
+    fcblock_t *b;
+    size_t off;
+    size_t left;
+    char *buf;
+} fccursor_t;
+
+/*
+ * Set cursor c at the first string of store st.
+ * Return false if could not allocate space.
+ */
+static bool fc_cursor(fcstore_t *st, fccursor_t *c)
+{
+    c->b = st->first;
+    c->off = st->read;
+    c->left = st->count;
+    c->buf = malloc(st->max_len + 1);
+    if (!c->buf)
+        return false;
+    strcpy(c->buf, st->front);
+    return true;
+}
+
+/* Return the next string of cursor c, or NULL past the last one */
+static const char *fc_next(fccursor_t *c)
+{
+    if (!c->left)
+        return NULL;
+    fc_decode(&c->b, &c->off, c->buf);
+    c->left--;
+    return c->buf;
+}
+
+/*
+ * Hierarchical timing wheel holding the deadlines of elements.
+ * Level l has TTL_SLOTS slots, each spanning 2^(TTL_BITS * l) milliseconds
+ * of the clock. A deadline goes to the lowest level at which it lies less
+ * than TTL_SLOTS slots past the current one, and deadlines beyond the top
+ * level wait in its farthest slot. Once the clock reaches the start of a
+ * slot above level 0, its entries move down to lower levels, and those at
+ * level 0 expire. Each slot holds a circular doubly-linked list of entries,
+ * which live in a pool array and refer to each other by position, where
+ * position 0 stands for none. As for the hash index, a table keyed by
+ * element address finds the entry of a given element.
+ */
+#define TTL_BITS 6
+#define TTL_SLOTS (1 << TTL_BITS)
+#define TTL_LEVELS 4
+
+typedef struct {
+    list_ele_t *node;
+    uint64_t deadline;
+    uint32_t prev, next; /* Neighbours in the list of a slot */
+    uint8_t level, slot;
+} tentry_t;
+
+struct TTLWHEEL {
+    tentry_t *entries; /* Pool of entries, entries[0] is unused */
+    size_t pool_size;  /* Number of entries ever taken from the pool */
+    size_t pool_cap;
+    uint32_t free_entry; /* Freed entries, linked through next */
+    uint32_t *nodes;     /* Table of entries keyed by element address */
+    size_t node_count, node_cap;
+    uint32_t slots[TTL_LEVELS][TTL_SLOTS]; /* First entry of each slot */
+    uint64_t occupied[TTL_LEVELS];         /* Bit i set if slot i is used */
+    uint64_t now;
+};
+
+/* Return position of the nodes slot of element e, or of the empty slot */
+static size_t ttl_node_pos(const ttlwheel_t *w, const list_ele_t *e)
+{
+    size_t mask = w->node_cap - 1;
+    size_t i = ptr_hash(e) & mask;
+    while (w->nodes[i] && w->entries[w->nodes[i]].node != e)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/* Delete slot i of nodes, shifting back later slots of its probe sequence */
+static void ttl_node_delete(ttlwheel_t *w, size_t i)
+{
+    size_t mask = w->node_cap - 1;
+    for (size_t j = (i + 1) & mask; w->nodes[j]; j = (j + 1) & mask) {
+        size_t k = ptr_hash(w->entries[w->nodes[j]].node) & mask;
+        if (probe_may_move(i, j, k)) {
+            w->nodes[i] = w->nodes[j];
+            i = j;
+        }
+    }
+    w->nodes[i] = 0;
+    w->node_count--;
+}
+
+/* Rebuild the nodes table with capacity slots */
+static bool ttl_node_resize(ttlwheel_t *w, size_t capacity)
+{
+    uint32_t *slots = malloc(sizeof(uint32_t) * capacity);
+    if (!slots)
+        return false;
+    memset(slots, 0, sizeof(uint32_t) * capacity);
+    uint32_t *old = w->nodes;
+    size_t old_cap = w->node_cap;
+    w->nodes = slots;
+    w->node_cap = capacity;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i]) {
+            size_t j = ptr_hash(w->entries[old[i]].node) & (capacity - 1);
+            while (slots[j])
+                j = (j + 1) & (capacity - 1);
+            slots[j] = old[i];
+        }
+    }
+    free(old);
+    return true;
+}
+
+/* Move the entry pool into an array with room for capacity entries */
+static bool ttl_pool_resize(ttlwheel_t *w, size_t capacity)
+{
+    tentry_t *entries = malloc(sizeof(tentry_t) * (capacity + 1));
+    if (!entries)
+        return false;
+    if (w->entries)
+        memcpy(entries, w->entries, sizeof(tentry_t) * (w->pool_size + 1));
+    free(w->entries);
+    w->entries = entries;
+    w->pool_cap = capacity;
+    return true;
+}
+
+/*
+ * Make sure w can take one more deadline, keeping the load factor of the
+ * nodes table at most 1/2. Return false if could not allocate space.
+ */
+static bool ttl_reserve(ttlwheel_t *w)
+{
+    if (!w->free_entry && w->pool_size == w->pool_cap &&
+        (w->pool_cap >= UINT32_MAX / 2 ||
+         !ttl_pool_resize(w, w->pool_cap * 2)))
+        return false;
+    if (2 * (w->node_count + 1) > w->node_cap &&
+        !ttl_node_resize(w, w->node_cap * 2))
+        return false;
+    return true;
+}
+
+/* Append entry id to the circular list starting at *first */
+static void ttl_append(tentry_t *entries, uint32_t *first, uint32_t id)
+{
+    tentry_t *t = &entries[id];
+    if (!*first) {
+        t->prev = t->next = id;
+        *first = id;
+        return;
+    }
+    uint32_t last = entries[*first].prev;
+    t->prev = last;
+    t->next = *first;
+    entries[last].next = id;
+    entries[*first].prev = id;
+}
+
+/* Remove entry id from the circular list starting at *first */
+static void ttl_detach(tentry_t *entries, uint32_t *first, uint32_t id)
+{
+    tentry_t *t = &entries[id];
+    if (t->next == id) {
+        *first = 0;
+        return;
+    }
+    entries[t->prev].next = t->next;
+    entries[t->next].prev = t->prev;
+    if (*first == id)
+        *first = t->next;
+}
+
+/* Put entry id, whose deadline lies past the clock, into its slot */
+static void ttl_link(ttlwheel_t *w, uint32_t id)
+{
+    tentry_t *t = &w->entries[id];
+    int top = TTL_BITS * (TTL_LEVELS - 1);
+    uint64_t key = t->deadline;
+    uint64_t limit = ((w->now >> top) + TTL_SLOTS) << top;
+    if (key >= limit)
+        key = limit - 1;
+    int level = 0;
+    while (level < TTL_LEVELS - 1 && (key >> (TTL_BITS * level)) -
+                                             (w->now >> (TTL_BITS * level)) >=
+                                         TTL_SLOTS)
+        level++;
+    t->level = level;
+    t->slot = (key >> (TTL_BITS * level)) & (TTL_SLOTS - 1);
+    ttl_append(w->entries, &w->slots[level][t->slot], id);
+    w->occupied[level] |= 1ULL << t->slot;
+}
+
+/* Take entry id out of its slot */
+static void ttl_unlink(ttlwheel_t *w, uint32_t id)
+{
+    tentry_t *t = &w->entries[id];
+    uint32_t *first = &w->slots[t->level][t->slot];
+    ttl_detach(w->entries, first, id);
+    if (!*first)
+        w->occupied[t->level] &= ~(1ULL << t->slot);
+}
+
+/* Return entry id, which must be in no list, to the pool */
+static void ttl_release(ttlwheel_t *w, uint32_t id)
+{
+    size_t pos = ttl_node_pos(w, w->entries[id].node);
+    ttl_node_delete(w, pos);
+    w->entries[id].node = NULL;
+    w->entries[id].next = w->free_entry;
+    w->free_entry = id;
+}
+
+/* Give element e the deadline, w having room for it */
+static void ttl_put(ttlwheel_t *w, list_ele_t *e, uint64_t deadline)
+{
+    uint32_t id = w->free_entry;
+    if (id)
+        w->free_entry = w->entries[id].next;
+    else
+        id = ++w->pool_size;
+    w->entries[id].node = e;
+    w->entries[id].deadline = deadline;
+    w->nodes[ttl_node_pos(w, e)] = id;
+    w->node_count++;
+    ttl_link(w, id);
+}
+
+/* Drop the deadline of element e of q, if it has one */
+static void ttl_cancel(queue_t *q, list_ele_t *e)
+{
+    ttlwheel_t *w = q->ttl;
+    if (!w)
+        return;
+    uint32_t id = w->nodes[ttl_node_pos(w, e)];
+    if (!id)
+        return;
+    ttl_unlink(w, id);
+    ttl_release(w, id);
+}
+
+/* Record that the element from, if it has a deadline, is now element to */
+static void ttl_move(queue_t *q, list_ele_t *from, list_ele_t *to)
+{
+    ttlwheel_t *w = q->ttl;
+    if (!w)
+        return;
+    size_t pos = ttl_node_pos(w, from);
+    uint32_t id = w->nodes[pos];
+    if (!id)
+        return;
+    ttl_node_delete(w, pos);
+    w->entries[id].node = to;
+    w->nodes[ttl_node_pos(w, to)] = id;
+    w->node_count++;
+}
+
+/* Drop the deadlines of all elements of q */
+static void ttl_free(queue_t *q)
+{
+    if (!q->ttl)
+        return;
+    free(q->ttl->entries);
+    free(q->ttl->nodes);
+    free(q->ttl);
+    q->ttl = NULL;
+}
+
+/* Drop the deadlines of q as a change of its contents, which gets logged */
+static void ttl_drop(queue_t *q)
+{
+    if (q->ttl)
+        q_record(q, WAL_DROP_TTL, 0, NULL);
+    ttl_free(q);
+}
+
+/*
+ * Return the time at which the clock reaches the next slot holding entries,
+ * or UINT64_MAX if there is none
+ */
+static uint64_t ttl_next(const ttlwheel_t *w)
+{
+    uint64_t next = UINT64_MAX;
+    for (int l = 0; l < TTL_LEVELS; l++) {
+        uint64_t occ = w->occupied[l];
+        if (!occ)
+            continue;
+        int shift = TTL_BITS * l;
+        unsigned cur = (w->now >> shift) & (TTL_SLOTS - 1);
+        /* Rotate slot cur + 1 down to bit 0, the slot at cur being empty */
+        uint64_t rot = (occ >> ((cur + 1) & 63)) | (occ << ((63 - cur) & 63));
+        uint64_t t = ((w->now >> shift) + __builtin_ctzll(rot) + 1) << shift;
+        if (t < next)
+            next = t;
+    }
+    return next;
+}
+
+/*
+ * Elements shared by a queue and snapshots of it.
+ * A snapshot holds the size elements linked from head. They never change
+ * while shared, except for the link out of the last one, which the queue
+ * sets when inserting at its tail, and which snapshots therefore never
+ * follow. If parent is not NULL, the hole_len elements from position
+ * hole_pos on belong to parent, the older snapshot the queue was sharing
+ * when this one got taken. The others belong to this snapshot, and get freed
+ * once neither the queue nor any handle holds it.
+ *
+ * A queue with snapshot snap holds the last snap_len elements of snap,
+ * following snap_pos elements of its own and followed by more of its own.
+ */
+struct QSNAP {
+    long refs; /* Handles and queue holding it, changed atomically */
+    list_ele_t *head;
+    size_t size;
+    qsnap_t *parent;
+    size_t hole_pos, hole_len;
+};
+
+void q_snap_free(qsnap_t *s)
+{
+    /* Dropping the last reference to a snapshot drops one to its parent */
+    while (s && !__atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL)) {
+        list_ele_t *e = s->head;
+        for (size_t pos = 0; pos < s->size; pos++) {
+            list_ele_t *next = pos + 1 < s->size ? e->next : NULL;
+            if (!s->parent || pos < s->hole_pos ||
+                pos - s->hole_pos >= s->hole_len) {
+                free(e->value);
+                free(e);
+            }
+            e = next;
+        }
+        qsnap_t *parent = s->parent;
+        free(s);
+        s = parent;
+    }
+}
+
+/* Stop sharing elements of q, which it holds none of anymore */
+static void snap_release(queue_t *q)
+{
+    q_snap_free(q->snap);
+    q->snap = NULL;
+    q->snap_pos = q->snap_len = 0;
+}
+
+/* Whether the element at position pos of q, from 0, is shared */
+static inline bool snap_shares(const queue_t *q, size_t pos)
+{
+    return q->snap && pos >= q->snap_pos && pos - q->snap_pos < q->snap_len;
+}
+
+/*
+ * Copy the shared elements among the first n of q, which q may then relink
+ * or free, and stop sharing once q holds none. Copies take over the hash
+ * index entries, deadlines and towers of the elements they replace.
+ * Return false if could not allocate space, leaving the queue unchanged.
+ */
+static bool snap_copy(queue_t *q, size_t n)
+{
+    if (!q->snap || n <= q->snap_pos)
+        return true;
+    size_t m = n - q->snap_pos;
+    if (m > q->snap_len)
+        m = q->snap_len;
+    list_ele_t *prev = NULL;
+    for (size_t pos = 0; pos < q->snap_pos; pos++)
+        prev = prev ? prev->next : q->head;
+    list_ele_t *first = prev ? prev->next : q->head;
+
+    /* All copies are allocated before relinking any, as in q_defrag */
+    list_ele_t *head = NULL, *tail = NULL, *e = first;
+    for (size_t i = 0; i < m; i++, e = e->next) {
+        list_ele_t *c = malloc(sizeof(list_ele_t));
+        if (!c)
+            goto fail;
+        c->value = strdup(e->value);
+        if (!c->value) {
+            free(c);
+            goto fail;
+        }
+        c->next = NULL;
+        if (tail)
+            tail->next = c;
+        else
+            head = c;
+        tail = c;
+    }
+
+    /* The link out of the last shared element is the queue's own */
+    tail->next = e;
+    if (prev)
+        prev->next = head;
+    else
+        q->head = head;
+    if (!e)
+        q->tail = tail;
+    for (list_ele_t *c = head; c != e; c = c->next, first = first->next) {
+        index_move(q, first, c);
+        ttl_move(q, first, c);
+    }
+    if (q->skip)
+        skip_refresh(q, q->snap_pos + m);
+    q->snap_pos += m;
+    q->snap_len -= m;
+    if (!q->snap_len)
+        snap_release(q);
+    return true;
+
+fail:
+    while (head) {
+        list_ele_t *c = head;
+        head = c->next;
+        free(c->value);
+        free(c);
+    }
+    return false;
+}
+
+bool q_unshare(queue_t *q)
+{
+    return q && snap_copy(q, q->size);
+}
+
+/*
+ * Free the elements of q except the shared ones, which q stops sharing.
+ * Indexes and deadlines are left to the caller.
+ */
+static void free_elements(queue_t *q)
+{
+    list_walker_t w;
+    walk_init(&w, q->head, true);
+    size_t pos = 0;
+    for (list_ele_t *temp; (temp = walk_next(&w)); pos++) {
+        if (snap_shares(q, pos))
+            continue;
+        free(temp->value);
+        free(temp);
+    }
+    q->head = q->tail = NULL;
+    snap_release(q);
+}
+
+/*
+ * Create empty queue.
+ * Return NULL if could not allocate space.
+ */
+queue_t *q_new()
+{
+    queue_t *q = malloc(sizeof(queue_t));
+    if (!q)
+        return NULL;
+    q->head = NULL;
+    q->tail = NULL;
+    q->size = 0;
+    q->index = NULL;
+    q->skip = NULL;
+    q->packed = NULL;
+    q->ttl = NULL;
+    q->wal = NULL;
+    q->snap = NULL;
+    q->snap_pos = q->snap_len = 0;
+    return q;
+}
+
+/* Free all storage used by queue in the calling thread */
+static void free_queue(queue_t *q)
+{
+    free_elements(q);
+    q_index(q, false);
+    skip_free(q);
+    ttl_free(q);
+    fc_free(q->packed);
+    free(q);
+}
+
+/* Queues handed over by q_free to a thread freeing them, see q_free_async */
+#define RECLAIM_SLOTS 64
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work; /* Signaled when a queue is handed over or on stop */
+    pthread_cond_t idle; /* Signaled when all handed over queues are freed */
+    queue_t *pending[RECLAIM_SLOTS];
+    int first, cnt;
+    bool busy;    /* Thread is freeing a queue taken from pending */
+    bool running; /* Thread is started and not asked to stop */
+    pthread_t thread;
+} reclaim = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+             PTHREAD_COND_INITIALIZER};
+
+/* Free handed over queues until asked to stop with none left */
+static void *reclaim_main(void *arg)
+{
+    pthread_mutex_lock(&reclaim.lock);
+    while (reclaim.running || reclaim.cnt) {
+        if (!reclaim.cnt) {
+            pthread_cond_wait(&reclaim.work, &reclaim.lock);
+            continue;
+        }
+        queue_t *q = reclaim.pending[reclaim.first];
+        reclaim.first = (reclaim.first + 1) % RECLAIM_SLOTS;
+        reclaim.cnt--;
+        reclaim.busy = true;
+        pthread_mutex_unlock(&reclaim.lock);
+        free_queue(q);
+        pthread_mutex_lock(&reclaim.lock);
+        reclaim.busy = false;
+        if (!reclaim.cnt)
+            pthread_cond_broadcast(&reclaim.idle);
+    }
+    pthread_mutex_unlock(&reclaim.lock);
+    return NULL;
+}
+
+/*
+ * A forked child only gets the calling thread, so wait for the reclaiming
+ * thread to go idle before forking, and have the child free synchronously.
+ */
+static void reclaim_prepare_fork()
+{
+    exception_hold();
+    pthread_mutex_lock(&reclaim.lock);
+    while (reclaim.cnt || reclaim.busy)
+        pthread_cond_wait(&reclaim.idle, &reclaim.lock);
+}
+
+static void reclaim_parent_fork()
+{
+    pthread_mutex_unlock(&reclaim.lock);
+    exception_release();
+}
+
+static void reclaim_child_fork()
+{
+    reclaim.running = false;
+    pthread_mutex_init(&reclaim.lock, NULL);
+    pthread_cond_init(&reclaim.work, NULL);
+    pthread_cond_init(&reclaim.idle, NULL);
+    exception_release();
+}
+
+bool q_free_async(bool enable)
+{
+    static bool fork_handlers = false;
+    exception_hold();
+    pthread_mutex_lock(&reclaim.lock);
+    bool running = reclaim.running;
+    if (running && !enable) {
+        reclaim.running = false;
+        pthread_cond_signal(&reclaim.work);
+    }
+    pthread_mutex_unlock(&reclaim.lock);
+    exception_release();
+    if (running == enable)
+        return true;
+    if (!enable)
+        return !pthread_join(reclaim.thread, NULL);
+
+    if (!fork_handlers) {
+        if (pthread_atfork(reclaim_prepare_fork, reclaim_parent_fork,
+                           reclaim_child_fork))
+            return false;
+        fork_handlers = true;
+    }
+    /* Leave signals such as the alarm of the harness to the caller */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    reclaim.running = true;
+    if (pthread_create(&reclaim.thread, NULL, reclaim_main, NULL))
+        reclaim.running = false;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return reclaim.running;
+}
+
+void q_sync()
+{
+    exception_hold();
+    pthread_mutex_lock(&reclaim.lock);
+    while (reclaim.cnt || reclaim.busy)
+        pthread_cond_wait(&reclaim.idle, &reclaim.lock);
+    pthread_mutex_unlock(&reclaim.lock);
+    exception_release();
+}
+
+/* Free all storage used by queue */
+void q_free(queue_t *q)
+{
+    if (!q)  // prevent doubly free
+        return;
+    /* Jumping out on the time limit must not leave the lock held */
+    exception_hold();
+    pthread_mutex_lock(&reclaim.lock);
+    if (reclaim.running && reclaim.cnt < RECLAIM_SLOTS) {
+        reclaim.pending[(reclaim.first + reclaim.cnt++) % RECLAIM_SLOTS] = q;
+        pthread_cond_signal(&reclaim.work);
+        q = NULL;
+    }
+    pthread_mutex_unlock(&reclaim.lock);
+    exception_release();
+    if (q)
+        free_queue(q);
+    // we should not set q to NULL since it has no effect outside the function
+}
+
+/*
+ * Attempt to insert element at head of queue.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * Argument s points to the string to be stored.
+ * The function must explicitly allocate space and copy the string into it.
+ */
+bool q_insert_head(queue_t *q, char *s)
+{
+    skipnode_t *tower;
+    int level;
+    if (!q || (q->index && !index_reserve(q->index)) ||
+        !skip_prepare(q, s, NULL, q->head, &tower, &level))
+        return false;
+    list_ele_t *newh = (list_ele_t *) malloc(sizeof(list_ele_t));
+    if (!newh) {
+        free(tower);
+        return false;
+    }
+    size_t s_size = strlen(s) + 1;  // strlen() may not be safe without '\0'
+    char *s_in_ele = (char *) malloc(sizeof(char) * s_size);
+    if (!s_in_ele) {
+        free(newh);
+        free(tower);
+        return false;
+    }
+    for (size_t i = 0; i < s_size; i++)  // copy the string including '/0'
+        s_in_ele[i] = s[i];
+    newh->value = s_in_ele;
+    newh->next = q->head;
+    q->head = newh;
+    if (!q->tail)  // if newh is the only element
+        q->tail = newh;
+    q->size++;
+    if (q->snap)
+        q->snap_pos++;
+    if (q->index)
+        index_put(q->index, newh, str_hash(newh->value));
+    if (q->skip)
+        skip_link(q, newh, 1, tower, level);
+    q_record(q, WAL_INSERT_HEAD, 0, s);
+    return true;
+}
+
+/*
+ * Attempt to insert element at tail of queue.
+ * Return true if successful.
+ * Return false if q is false or could not allocate space.
+ * Argument s points to the string to be stored.
+ * The function must explicitly allocate space and copy the string into it.
+ */
+bool q_insert_tail(queue_t *q, char *s)
+{
+    if (q && q->packed) {
+        /* Compacted elements follow the tail, so s goes after them */
+        if (!fc_append(q->packed, s))
+            return false;
+        q->size++;
+        q_record(q, WAL_INSERT_TAIL, 0, s);
+        return true;
+    }
+    skipnode_t *tower;
+    int level;
+    if (!q || (q->index && !index_reserve(q->index)) ||
+        !skip_prepare(q, s, q->tail, NULL, &tower, &level))
+        return false;
+    list_ele_t *newt = (list_ele_t *) malloc(sizeof(list_ele_t));
+    if (!newt) {
+        free(tower);
+        return false;
+    }
+    size_t s_size = strlen(s) + 1;
+    char *s_in_ele = (char *) malloc(sizeof(char) * s_size);
+    if (!s_in_ele) {
+        free(newt);
+        free(tower);
+        return false;
+    }
+    for (size_t i = 0; i < s_size; i++)  // copy the string including '/0'
+        s_in_ele[i] = s[i];
+    newt->value = s_in_ele;
+    newt->next = NULL;
+    if (q->tail)
+        q->tail->next = newt;
+    q->tail = newt;
+    if (!q->head)  // if newt is the only element
+        q->head = newt;
+    q->size++;
+    if (q->index)
+        index_put(q->index, newt, str_hash(newt->value));
+    if (q->skip)
+        skip_link(q, newt, q->size, tower, level);
+    q_record(q, WAL_INSERT_TAIL, 0, s);
+    return true;
+}
+
+/*
+ * Attempt to remove element from head of queue.
+ * Return true if successful.
+ * Return false if queue is NULL or empty.
+ * If sp is non-NULL and an element is removed, copy the removed string to *sp
+ * (up to a maximum of bufsize-1 characters, plus a null terminator.)
+ * The space used by the list element and the string should be freed.
+ */
+bool q_remove_head(queue_t *q, char *sp, size_t bufsize)
+{
+    if (!q || !q->size)
+        return false;
+    if (!q->head) {
+        const char *s = fc_pop(q->packed);
+        if (sp) {
+            strncpy(sp, s, bufsize - 1);
+            sp[bufsize - 1] = '\0';
+        }
+        if (!q->packed->count) {
+            fc_free(q->packed);
+            q->packed = NULL;
+        }
+        q->size--;
+        q_record(q, WAL_REMOVE_HEAD, 1, NULL);
+        return true;
+    }
+    size_t sp_size = min(strlen(q->head->value), bufsize - 1);
+    sp_size = sp_size + 1;
+    if (sp) {                                     // if sp is non-NULL
+        for (size_t i = 0; i < sp_size - 1; i++)  // copy the string
+            sp[i] = q->head->value[i];
+        sp[sp_size - 1] = '\0';
+    }
+    index_remove(q, q->head);
+    ttl_cancel(q, q->head);
+    if (q->skip)
+        skip_unlink(q, 1);
+    list_ele_t *toDelete = q->head;
+    q->head = q->head->next;
+    if (snap_shares(q, 0)) {
+        /* The snapshots free it */
+        if (!--q->snap_len)
+            snap_release(q);
+    } else {
+        if (q->snap)
+            q->snap_pos--;
+        free(toDelete->value);
+        free(toDelete);
+    }
+    if (!q->head)
+        q->tail = NULL;
+    q->size--;
+    q_record(q, WAL_REMOVE_HEAD, 1, NULL);
+    return true;
+}
+
+/*
+ * Return number of elements in queue.
+ * Return 0 if q is NULL or empty
+ */
+size_t q_size(queue_t *q)
+{
+    if (!q)
+        return 0;
+    return q->size;
+}
+
+/*
+ * Reverse elements in queue
+ * No effect if q is NULL or empty
+ * This function should not allocate or free any list elements
+ * (e.g., by calling q_insert_head, q_insert_tail, or q_remove_head).
+ * It should rearrange the existing ones.
+ */
+void q_reverse(queue_t *q)
+{
+    if (!q || q->size == 0 || q->size == 1 || (q->packed && !q_expand(q)) ||
+        !q_unshare(q))
+        return;
+    list_walker_t w;
+    walk_init(&w, q->head, false);
+    q->tail = q->head;
+    list_ele_t *prev = NULL;
+    for (list_ele_t *temp; (temp = walk_next(&w));) {
+        temp->next = prev;
+        prev = temp;
+    }
+    q->head = prev;
+    if (q->skip) {
+        skip_refresh(q, q->size);
+        q->skip->ordered = false;
+    }
+    q_record(q, WAL_REVERSE, 0, NULL);
+}
+
+/*
+ * Sort elements of queue in ascending order
+ * No effect if q is NULL or empty. In addition, if q has only one
+ * element, do nothing.
+ */
+void q_sort(queue_t *q)
+{
+    if (!q || !q->size || skip_ordered(q) || (q->packed && !q_expand(q)) ||
+        !q_unshare(q))
+        return;
+    q->head = sortList(q->head, strcmp);
+    list_walker_t w;
+    walk_init(&w, q->head, false);
+    while (w.cur->next)
+        walk_next(&w);
+    q->tail = w.cur;
+    if (q->skip) {
+        skip_refresh(q, q->size);
+        q->skip->ordered = true;
+    }
+    q_record(q, WAL_SORT, 0, NULL);
+}
+
+/* Move heap[i] up until its parent is not smaller (max-heap by value) */
+static void heap_sift_up(list_ele_t **heap, size_t i)
+{
+    list_ele_t *e = heap[i];
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (strcmp(heap[parent]->value, e->value) >= 0)
+            break;
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = e;
+}
+
+/* Move heap[i] down until no child of it is larger (max-heap by value) */
+static void heap_sift_down(list_ele_t **heap, size_t n, size_t i)
+{
+    list_ele_t *e = heap[i];
+    while (2 * i + 1 < n) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < n &&
+            strcmp(heap[child + 1]->value, heap[child]->value) > 0)
+            child++;
+        if (strcmp(heap[child]->value, e->value) <= 0)
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = e;
+}
+
+/*
+ * Move the k smallest elements of queue to its head in ascending order
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * The remaining elements follow them in unspecified order.
+ * It takes O(n log k) time with a bounded heap of k element pointers.
+ * If k is not less than the size of queue, this is the same as q_sort.
+ */
+bool q_sort_topk(queue_t *q, size_t k)
+{
+    if (!q)
+        return false;
+    if (!k || q->size < 2)
+        return true;
+    if (q->packed && !q_expand(q))
+        return false;
+    if (skip_ordered(q))
+        return true;
+    if (k >= q->size) {
+        q_sort(q);
+        return true;
+    }
+    if (!q_unshare(q))
+        return false;
+
+    list_ele_t **heap = malloc(sizeof(list_ele_t *) * k);
+    if (!heap)
+        return false;
+
+    /*
+     * Keep the k smallest elements seen so far in a max-heap. Every element
+     * which is not admitted, or is evicted by a smaller one, is appended to
+     * the rest list right away.
+     */
+    size_t n = 0;
+    list_ele_t *rest = NULL, *rest_tail = NULL;
+    list_ele_t *next;
+    for (list_ele_t *it = q->head; it; it = next) {
+        next = it->next;
+        list_ele_t *out = it;
+        if (n < k) {
+            heap[n] = it;
+            heap_sift_up(heap, n++);
+            continue;
+        }
+        if (strcmp(it->value, heap[0]->value) < 0) {
+            out = heap[0];
+            heap[0] = it;
+            heap_sift_down(heap, k, 0);
+        }
+        if (rest_tail)
+            rest_tail->next = out;
+        else
+            rest = out;
+        rest_tail = out;
+    }
+    rest_tail->next = NULL;
+
+    /* Heap sort the selected elements, then relink them in front of rest */
+    for (size_t i = k - 1; i > 0; i--) {
+        list_ele_t *max = heap[0];
+        heap[0] = heap[i];
+        heap[i] = max;
+        heap_sift_down(heap, i, 0);
+    }
+    for (size_t i = 0; i < k - 1; i++)
+        heap[i]->next = heap[i + 1];
+    heap[k - 1]->next = rest;
+    q->head = heap[0];
+    q->tail = rest_tail;
+    free(heap);
+    if (q->skip)
+        skip_refresh(q, q->size);
+    q_record(q, WAL_SORT_TOPK, k, NULL);
+    return true;
+}
+
+/* Slot of the open-addressing string set used by q_unique */
+typedef struct {
+    char *value; /* NULL if the slot is empty */
+    uint32_t hash;
+    uint32_t count;
+} dedup_slot_t;
+
+/*
+ * Find the slot holding string s, or the empty slot where it belongs.
+ * mask is the table capacity minus one, the capacity being a power of 2.
+ */
+static dedup_slot_t *dedup_find(dedup_slot_t *table,
+                                size_t mask,
+                                const char *s,
+                                uint32_t hash)
+{
+    size_t i = hash & mask;
+    while (table[i].value &&
+           (table[i].hash != hash || strcmp(table[i].value, s)))
+        i = (i + 1) & mask;
+    return &table[i];
+}
+
+/*
+ * Unlink the element after prev (or the head if prev is NULL) and free it.
+ * pos is the position of that element, or 0 if unknown, in which case the
+ * skip index is released.
+ */
+static void unlink_next(queue_t *q, list_ele_t *prev, size_t pos)
+{
+    list_ele_t *victim = prev ? prev->next : q->head;
+    if (pos && q->skip)
+        skip_unlink(q, pos);
+    else
+        skip_free(q);
+    if (prev)
+        prev->next = victim->next;
+    else
+        q->head = victim->next;
+    if (q->tail == victim)
+        q->tail = prev;
+    index_remove(q, victim);
+    ttl_cancel(q, victim);
+    free(victim->value);
+    free(victim);
+    q->size--;
+}
+
+/*
+ * Remove duplicate strings from queue, preserving the order of the rest.
+ * Keep the first occurrence of each string if keep_first is true, or the
+ * last one otherwise. The space used by removed elements is freed.
+ * Return the number of elements removed.
+ * Return -1 if q is NULL or could not allocate space.
+ */
+long q_unique(queue_t *q, bool keep_first)
+{
+    if (!q || (q->packed && !q_expand(q)))
+        return -1;
+    size_t old_size = q->size;
+    if (old_size < 2)
+        return 0;
+    if (!q_unshare(q))
+        return -1;
+
+    /*
+     * Duplicates are adjacent in a sorted queue, so comparing neighbours is
+     * enough. Equal strings may still differ in their deadlines, so the run
+     * of each string keeps its first or last element as keep_first says.
+     */
+    list_ele_t *it;
+    for (it = q->head; it->next; it = it->next)
+        if (strcmp(it->value, it->next->value) > 0)
+            break;
+    if (!it->next) {
+        list_ele_t *prev = NULL;
+        size_t pos = 1;
+        for (it = q->head; it->next;) {
+            if (strcmp(it->value, it->next->value)) {
+                prev = it;
+                it = it->next;
+                pos++;
+            } else if (keep_first) {
+                unlink_next(q, it, pos + 1);
+            } else {
+                it = it->next;
+                unlink_next(q, prev, pos);
+            }
+        }
+        if (q->size < old_size)
+            q_record(q, WAL_UNIQUE, keep_first, NULL);
+        return old_size - q->size;
+    }
+
+    /* Keep the load factor of the string set at most 1/2 */
+    size_t capacity = 1;
+    while (capacity < old_size * 2)
+        capacity <<= 1;
+    dedup_slot_t *table = malloc(sizeof(dedup_slot_t) * capacity);
+    if (!table)
+        return -1;
+    memset(table, 0, sizeof(dedup_slot_t) * capacity);
+    size_t mask = capacity - 1;
+
+    if (keep_first) {
+        /* Drop every element whose string is already in the set */
+        list_ele_t *prev = NULL;
+        size_t pos = 1;
+        while (prev ? prev->next : q->head) {
+            list_ele_t *e = prev ? prev->next : q->head;
+            uint32_t hash = str_hash(e->value);
+            dedup_slot_t *slot = dedup_find(table, mask, e->value, hash);
+            if (slot->value) {
+                unlink_next(q, prev, pos);
+            } else {
+                slot->value = e->value;
+                slot->hash = hash;
+                prev = e;
+                pos++;
+            }
+        }
+    } else {
+        /*
+         * Count occurrences, then drop all but the last of each string.
+         * Slots refer to the last occurrence, which is the one never freed.
+         */
+        for (it = q->head; it; it = it->next) {
+            uint32_t hash = str_hash(it->value);
+            dedup_slot_t *slot = dedup_find(table, mask, it->value, hash);
+            slot->value = it->value;
+            slot->hash = hash;
+            slot->count++;
+        }
+        list_ele_t *prev = NULL;
+        size_t pos = 1;
+        while (prev ? prev->next : q->head) {
+            list_ele_t *e = prev ? prev->next : q->head;
+            dedup_slot_t *slot =
+                dedup_find(table, mask, e->value, str_hash(e->value));
+            if (--slot->count) {
+                unlink_next(q, prev, pos);
+            } else {
+                prev = e;
+                pos++;
+            }
+        }
+    }
+
+    free(table);
+    if (q->size < old_size)
+        q_record(q, WAL_UNIQUE, keep_first, NULL);
+    return old_size - q->size;
+}
+
+/*
+ * Build (enable is true) or drop (enable is false) a hash index from the
+ * strings of queue to the elements holding them.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ */
+bool q_index(queue_t *q, bool enable)
+{
+    if (!q)
+        return false;
+    if (!enable) {
+        if (q->index) {
+            free(q->index->entries);
+            free(q->index->strs);
+            free(q->index->nodes);
+            free(q->index);
+            q->index = NULL;
+        }
+        return true;
+    }
+    if (q->index)
+        return true;
+    if (q->size >= UINT32_MAX / 4 || (q->packed && !q_expand(q)))
+        return false;
+
+    hindex_t *idx = malloc(sizeof(hindex_t));
+    if (!idx)
+        return false;
+    memset(idx, 0, sizeof(hindex_t));
+    size_t capacity = 16;
+    while (capacity < 2 * (size_t) q->size)
+        capacity <<= 1;
+    if (!index_pool_resize(idx, capacity / 2) ||
+        !index_node_resize(idx, capacity) ||
+        !index_str_resize(idx, capacity)) {
+        free(idx->entries);
+        free(idx->nodes);
+        free(idx->strs);
+        free(idx);
+        return false;
+    }
+    for (list_ele_t *e = q->head; e; e = e->next)
+        index_put(idx, e, str_hash(e->value));
+    q->index = idx;
+    return true;
+}
+
+/*
+ * Return number of bytes used by the hash index of queue.
+ * Return 0 if q is NULL or has no index.
+ */
+size_t q_index_memory(queue_t *q)
+{
+    if (!q || !q->index)
+        return 0;
+    hindex_t *idx = q->index;
+    return sizeof(hindex_t) + sizeof(hentry_t) * (idx->pool_cap + 1) +
+           sizeof(hslot_t) * idx->str_cap + sizeof(uint32_t) * idx->node_cap;
+}
+
+/*
+ * Return whether queue holds an element with string s.
+ * Return false if q is NULL or empty.
+ */
+bool q_contains(queue_t *q, const char *s)
+{
+    if (!q)
+        return false;
+    if (q->index)
+        return index_find(q->index, s) != NULL;
+    for (list_ele_t *e = q->head; e; e = e->next)
+        if (!strcmp(e->value, s))
+            return true;
+    fccursor_t c;
+    if (!q->packed || !fc_cursor(q->packed, &c))
+        return false;
+    const char *v;
+    while ((v = fc_next(&c)) && strcmp(v, s))
+        ;
+    free(c.buf);
+    return v != NULL;
+}
+
+/*
+ * Remove element e of q, which has no skip index and shares no elements,
+ * and free it. The caller logs the change.
+ */
+static void remove_element(queue_t *q, list_ele_t *e)
+{
+    if (e == q->head) {
+        unlink_next(q, NULL, 0);
+        return;
+    }
+    if (e == q->tail) {
+        /* Only the tail needs its predecessor, found by walking the list */
+        list_ele_t *prev = q->head;
+        while (prev->next != e)
+            prev = prev->next;
+        unlink_next(q, prev, 0);
+        return;
+    }
+
+    /*
+     * Without a link to its predecessor, e cannot be unlinked. Instead, its
+     * successor moves into it and the successor gets unlinked.
+     */
+    list_ele_t *next = e->next;
+    index_remove(q, e);
+    ttl_cancel(q, e);
+    free(e->value);
+    e->value = next->value;
+    e->next = next->next;
+    if (q->tail == next)
+        q->tail = e;
+    index_move(q, next, e);
+    ttl_move(q, next, e);
+    free(next);
+    q->size--;
+}
+
+/*
+ * Attempt to remove one element holding string s from queue.
+ * Return true if successful.
+ * Return false if q is NULL or no element holds s.
+ * The space used by the list element and the string is freed.
+ */
+bool q_remove_value(queue_t *q, const char *s)
+{
+    if (!q || !q->size || (q->packed && !q_expand(q)) || !q_unshare(q))
+        return false;
+    if (skip_ordered(q)) {
+        size_t pos;
+        list_ele_t *prev = skip_find(q, s, true, &pos);
+        list_ele_t *e = prev ? prev->next : q->head;
+        if (!e || strcmp(e->value, s))
+            return false;
+        unlink_next(q, prev, pos + 1);
+        q_record(q, WAL_REMOVE_VALUE, 0, s);
+        return true;
+    }
+    /* Positions of the skip index are found by walking the list anyway */
+    if (!q->index || q->skip) {
+        list_ele_t *prev = NULL;
+        size_t pos = 1;
+        for (list_ele_t *e = q->head; e; prev = e, e = e->next, pos++) {
+            if (!strcmp(e->value, s)) {
+                unlink_next(q, prev, pos);
+                q_record(q, WAL_REMOVE_VALUE, 0, s);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    list_ele_t *e = index_find(q->index, s);
+    if (!e)
+        return false;
+    hindex_t *idx = q->index;
+    uint32_t next = idx->entries[idx->nodes[index_node_pos(idx, e)]].next;
+    bool duplicates = next != 0;
+    if (e == q->tail && e != q->head && duplicates) {
+        /* Prefer a duplicate which is not the tail */
+        e = idx->entries[next].node;
+    }
+
+    /*
+     * Replaying the log removes the first element holding s, which may not
+     * be e if s has duplicates, so log the position of e then.
+     */
+    size_t pos = 0;
+    if (q->wal && duplicates)
+        for (list_ele_t *x = q->head; x != e; x = x->next)
+            pos++;
+    remove_element(q, e);
+    if (q->wal && duplicates)
+        q_record(q, WAL_REMOVE_AT, pos, NULL);
+    else
+        q_record(q, WAL_REMOVE_VALUE, 0, s);
+    return true;
+}
+
+/*
+ * Keep queue sorted in ascending order with a skip index (enable is true),
+ * or drop the skip index (enable is false). Enabling it sorts the queue.
+ * Inserting a string out of order, or q_reverse, makes the index fall back
+ * to positions only, as with q_positions.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ */
+bool q_ordered(queue_t *q, bool enable)
+{
+    if (!q)
+        return false;
+    if (!enable) {
+        skip_free(q);
+        return true;
+    }
+    if (q->packed && !q_expand(q))
+        return false;
+    q_sort(q);
+    if (q->skip) {
+        q->skip->ordered = true;
+        return true;
+    }
+    return skip_build(q, true);
+}
+
+/*
+ * Build (enable is true) or drop (enable is false) a skip index over the
+ * positions of queue, unless it has one already.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ */
+bool q_positions(queue_t *q, bool enable)
+{
+    if (!q)
+        return false;
+    if (!enable) {
+        skip_free(q);
+        return true;
+    }
+    if (q->packed && !q_expand(q))
+        return false;
+    return q->skip || skip_build(q, false);
+}
+
+/* Return the element at position pos - 1 of q, or NULL if pos is 1 */
+static list_ele_t *element_before(queue_t *q, size_t pos)
+{
+    if (q->skip)
+        return skip_before(q, pos);
+    list_ele_t *e = NULL;
+    for (size_t r = 1; r < pos; r++)
+        e = e ? e->next : q->head;
+    return e;
+}
+
 /*
- * Create empty queue.
- * Return NULL if could not allocate space.
+ * Attempt to copy the string of the element at index i of queue, counting
+ * from 0 at the head, to *sp (up to a maximum of bufsize-1 characters, plus
+ * a null terminator), if sp is non-NULL.
+ * Return true if successful.
+ * Return false if q is NULL or i is out of range.
  */
-queue_t *q_new()
+bool q_get(queue_t *q, size_t i, char *sp, size_t bufsize)
 {
-    queue_t *q = malloc(sizeof(queue_t));
-    if (!q)
-        return NULL;
-    q->head = NULL;
-    q->tail = NULL;
-    q->size = 0;
-    return q;
+    if (!q || i >= q->size || (q->packed && !q_expand(q)))
+        return false;
+    list_ele_t *prev = element_before(q, i + 1);
+    list_ele_t *e = prev ? prev->next : q->head;
+    if (sp) {
+        strncpy(sp, e->value, bufsize - 1);
+        sp[bufsize - 1] = '\0';
+    }
+    return true;
 }
 
-/* Free all storage used by queue */
-void q_free(queue_t *q)
+/*
+ * Attempt to remove the element at index i of queue, counting from 0 at the
+ * head, copying its string to *sp as q_remove_head does.
+ * Return true if successful.
+ * Return false if q is NULL or i is out of range.
+ * The space used by the list element and the string is freed.
+ */
+bool q_remove_at(queue_t *q, size_t i, char *sp, size_t bufsize)
 {
-    if (!q)  // prevent doubly free
-        return;
-    while (q->head) {
-        list_ele_t *temp = q->head;
-        q->head = q->head->next;
-        free(temp->value);
-        free(temp);
+    if (!q || i >= q->size || (q->packed && !q_expand(q)) ||
+        (snap_shares(q, i) && !snap_copy(q, i + 1)))
+        return false;
+    list_ele_t *prev = element_before(q, i + 1);
+    list_ele_t *e = prev ? prev->next : q->head;
+    if (sp) {
+        strncpy(sp, e->value, bufsize - 1);
+        sp[bufsize - 1] = '\0';
     }
-    free(q);
-    // we should not set q to NULL since it has no effect outside the function
+    unlink_next(q, prev, i + 1);
+    if (q->snap && i < q->snap_pos)
+        q->snap_pos--;
+    q_record(q, WAL_REMOVE_AT, i, NULL);
+    return true;
 }
 
 /*
- * Attempt to insert element at head of queue.
+ * Attempt to insert element holding string s at index i of queue, counting
+ * from 0 at the head, so that i equal to the size of queue inserts at tail.
  * Return true if successful.
- * Return false if q is NULL or could not allocate space.
- * Argument s points to the string to be stored.
+ * Return false if q is NULL, i is out of range or could not allocate space.
  * The function must explicitly allocate space and copy the string into it.
  */
-bool q_insert_head(queue_t *q, char *s)
+bool q_insert_at(queue_t *q, size_t i, char *s)
 {
-    if (!q)
+    /* The link out of the last shared element is the queue's own */
+    if (!q || i > q->size || (q->packed && !q_expand(q)) ||
+        (snap_shares(q, i) && !snap_copy(q, i)) ||
+        (q->index && !index_reserve(q->index)))
         return false;
-    list_ele_t *newh = (list_ele_t *) malloc(sizeof(list_ele_t));
-    if (!newh)
+    list_ele_t *prev = element_before(q, i + 1);
+    list_ele_t *next = prev ? prev->next : q->head;
+    skipnode_t *tower;
+    int level;
+    if (!skip_prepare(q, s, prev, next, &tower, &level))
         return false;
-    int s_size = strlen(s) + 1;  // strlen() may not be safe if there is no '\0'
-    char *s_in_ele = (char *) malloc(sizeof(char) * s_size);
-    if (!s_in_ele) {
-        free(newh);
+    list_ele_t *newe = malloc(sizeof(list_ele_t));
+    if (!newe) {
+        free(tower);
         return false;
     }
-    for (int i = 0; i < s_size; i++)  // copy the string including '/0'
-        s_in_ele[i] = s[i];
-    newh->value = s_in_ele;
-    newh->next = q->head;
-    q->head = newh;
-    if (!q->tail)  // if newh is the only element
-        q->tail = newh;
+    newe->value = strdup(s);
+    if (!newe->value) {
+        free(newe);
+        free(tower);
+        return false;
+    }
+
+    newe->next = next;
+    if (prev)
+        prev->next = newe;
+    else
+        q->head = newe;
+    if (!next)
+        q->tail = newe;
     q->size++;
+    if (q->snap && i <= q->snap_pos)
+        q->snap_pos++;
+    if (q->index)
+        index_put(q->index, newe, str_hash(newe->value));
+    if (q->skip)
+        skip_link(q, newe, i + 1, tower, level);
+    q_record(q, WAL_INSERT_AT, i, s);
     return true;
 }
 
 /*
- * Attempt to insert element at tail of queue.
+ * Attempt to insert element holding string s into sorted queue, after any
+ * element holding an equal string. The skip index keeping queue sorted is
+ * built first if there is none, which sorts the queue.
  * Return true if successful.
- * Return false if q is false or could not allocate space.
- * Argument s points to the string to be stored.
+ * Return false if q is NULL or could not allocate space.
  * The function must explicitly allocate space and copy the string into it.
  */
-bool q_insert_tail(queue_t *q, char *s)
+bool q_insert_sorted(queue_t *q, char *s)
 {
-    if (!q)
+    if (!q || !q_ordered(q, true) ||
+        (q->index && !index_reserve(q->index)))
         return false;
-    list_ele_t *newt = (list_ele_t *) malloc(sizeof(list_ele_t));
-    if (!newt)
+    skipnode_t *tower;
+    int level;
+    if (!skip_tower_new(&tower, &level))
         return false;
-    int s_size = strlen(s) + 1;
-    char *s_in_ele = (char *) malloc(sizeof(char) * s_size);
-    if (!s_in_ele) {
-        free(newt);
+    list_ele_t *newe = malloc(sizeof(list_ele_t));
+    if (!newe) {
+        free(tower);
         return false;
     }
-    for (int i = 0; i < s_size; i++)  // copy the string including '/0'
-        s_in_ele[i] = s[i];
-    newt->value = s_in_ele;
-    newt->next = NULL;
-    if (q->tail)
-        q->tail->next = newt;
-    q->tail = newt;
-    if (!q->head)  // if newt is the only element
-        q->head = newt;
+    newe->value = strdup(s);
+    if (!newe->value) {
+        free(newe);
+        free(tower);
+        return false;
+    }
+
+    size_t pos;
+    list_ele_t *prev = skip_find(q, s, false, &pos);
+    if (snap_shares(q, pos)) {
+        if (!snap_copy(q, pos)) {
+            free(newe->value);
+            free(newe);
+            free(tower);
+            return false;
+        }
+        prev = skip_find(q, s, false, &pos);
+    }
+    if (prev) {
+        newe->next = prev->next;
+        prev->next = newe;
+    } else {
+        newe->next = q->head;
+        q->head = newe;
+    }
+    if (q->tail == prev)
+        q->tail = newe;
     q->size++;
+    if (q->snap && pos <= q->snap_pos)
+        q->snap_pos++;
+    if (q->index)
+        index_put(q->index, newe, str_hash(newe->value));
+    skip_link(q, newe, pos + 1, tower, level);
+    q_record(q, WAL_INSERT_SORTED, 0, s);
     return true;
 }
 
+struct range_arg {
+    const char *lo, *hi;
+    void (*visit)(const char *s, void *arg);
+    void *arg;
+    size_t count;
+};
+
+static void range_visit(const char *s, void *arg)
+{
+    struct range_arg *r = arg;
+    if (strcmp(s, r->lo) >= 0 && strcmp(s, r->hi) < 0) {
+        r->visit(s, r->arg);
+        r->count++;
+    }
+}
+
 /*
- * Attempt to remove element from head of queue.
+ * Call visit with arg on every string s of queue, lo <= s < hi, in queue order.
+ * It is a sequential scan unless queue is kept sorted by q_ordered.
+ * Return the number of visited strings, 0 if q is NULL.
+ */
+size_t q_range(queue_t *q,
+               const char *lo,
+               const char *hi,
+               void (*visit)(const char *s, void *arg),
+               void *arg)
+{
+    if (!q)
+        return 0;
+    size_t count = 0;
+    if (skip_ordered(q)) {
+        size_t pos;
+        list_ele_t *prev = skip_find(q, lo, true, &pos);
+        for (list_ele_t *e = prev ? prev->next : q->head;
+             e && strcmp(e->value, hi) < 0; e = e->next) {
+            visit(e->value, arg);
+            count++;
+        }
+        return count;
+    }
+    struct range_arg r = {lo, hi, visit, arg, 0};
+    q_foreach(q, range_visit, &r);
+    return r.count;
+}
+
+struct rank_arg {
+    const char *s;
+    size_t rank;
+};
+
+static void rank_visit(const char *s, void *arg)
+{
+    struct rank_arg *r = arg;
+    if (strcmp(s, r->s) < 0)
+        r->rank++;
+}
+
+/*
+ * Return the number of strings of queue less than s, which is the position
+ * s would get in sorted queue, counting from 0.
+ * It is a sequential scan unless queue is kept sorted by q_ordered.
+ * Return 0 if q is NULL.
+ */
+size_t q_rank(queue_t *q, const char *s)
+{
+    if (!q)
+        return 0;
+    if (skip_ordered(q)) {
+        size_t pos;
+        skip_find(q, s, true, &pos);
+        return pos;
+    }
+    struct rank_arg r = {s, 0};
+    q_foreach(q, rank_visit, &r);
+    return r.rank;
+}
+
+/*
+ * Re-encode all elements of queue into front-coded blocks, which pays off
+ * when neighbouring strings share prefixes as in a sorted queue. Any hash or
+ * skip index of queue is dropped. Strings are decoded again one at a time by
+ * q_remove_head, and q_insert_tail appends to the blocks. Other operations
+ * which need list elements call q_expand first.
  * Return true if successful.
- * Return false if queue is NULL or empty.
- * If sp is non-NULL and an element is removed, copy the removed string to *sp
- * (up to a maximum of bufsize-1 characters, plus a null terminator.)
- * The space used by the list element and the string should be freed.
+ * Return false if q is NULL or could not allocate space.
  */
-bool q_remove_head(queue_t *q, char *sp, size_t bufsize)
+bool q_compact_sorted(queue_t *q)
 {
-    if (!q || !q->size)
+    if (!q || (q->packed && !q_expand(q)))
         return false;
-    size_t sp_size = min(strlen(q->head->value), bufsize - 1);
-    sp_size = sp_size + 1;
-    if (sp) {                                     // if sp is non-NULL
-        for (size_t i = 0; i < sp_size - 1; i++)  // copy the string
-            sp[i] = q->head->value[i];
-        sp[sp_size - 1] = '\0';
-    }
-    free(q->head->value);
-    list_ele_t *toDelete = q->head;
-    q->head = q->head->next;
-    free(toDelete);
     if (!q->head)
-        q->tail = NULL;
-    q->size--;
+        return true;
+    fcstore_t *st = fc_new();
+    if (!st)
+        return false;
+    for (list_ele_t *e = q->head; e; e = e->next) {
+        if (!fc_append(st, e->value)) {
+            fc_free(st);
+            return false;
+        }
+    }
+
+    q_index(q, false);
+    skip_free(q);
+    ttl_drop(q);
+    free_elements(q);
+    q->packed = st;
     return true;
 }
 
 /*
- * Return number of elements in queue.
- * Return 0 if q is NULL or empty
+ * Decode all compacted elements of queue back into list elements.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space, in which case the
+ * elements decoded so far stay in the list.
  */
-int q_size(queue_t *q)
+bool q_expand(queue_t *q)
+{
+    if (!q)
+        return false;
+    while (q->packed) {
+        fcstore_t *st = q->packed;
+        list_ele_t *e = malloc(sizeof(list_ele_t));
+        if (!e)
+            return false;
+        e->value = malloc(fc_peek_len(st) + 1);
+        if (!e->value) {
+            free(e);
+            return false;
+        }
+        strcpy(e->value, fc_pop(st));
+        e->next = NULL;
+        if (q->tail)
+            q->tail->next = e;
+        else
+            q->head = e;
+        q->tail = e;
+        if (!st->count) {
+            fc_free(st);
+            q->packed = NULL;
+        }
+    }
+    return true;
+}
+
+/*
+ * Call visit with arg on every string of queue in order, decoding compacted
+ * elements one at a time.
+ * Return the number of visited strings, 0 if q is NULL, or -1 if could not
+ * allocate space.
+ */
+long q_foreach(queue_t *q,
+               void (*visit)(const char *s, void *arg),
+               void *arg)
 {
     if (!q)
         return 0;
-    return q->size;
+    long count = 0;
+    for (list_ele_t *e = q->head; e; e = e->next, count++)
+        visit(e->value, arg);
+    fccursor_t c;
+    if (!q->packed)
+        return count;
+    if (!fc_cursor(q->packed, &c))
+        return -1;
+    for (const char *s; (s = fc_next(&c)); count++)
+        visit(s, arg);
+    free(c.buf);
+    return count;
 }
 
 /*
- * Reverse elements in queue
- * No effect if q is NULL or empty
- * This function should not allocate or free any list elements
- * (e.g., by calling q_insert_head, q_insert_tail, or q_remove_head).
- * It should rearrange the existing ones.
+ * Copy list elements and their strings into fresh memory in list order, so
+ * that walking the queue touches memory sequentially again, as after a run
+ * of q_insert_tail. The old elements are freed. All copies are allocated
+ * before any old element gets freed, so they do not land in the holes left
+ * behind.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space, leaving the queue
+ * unchanged.
  */
-void q_reverse(queue_t *q)
+bool q_defrag(queue_t *q)
 {
-    if (!q || q->size == 0 || q->size == 1)
-        return;
-    q->tail = q->head;
-    list_ele_t *prev = q->head;
-    list_ele_t *temp = q->head->next->next;
-    q->head = q->head->next;
-    q->head->next = prev;
-    while (temp) {
-        prev = q->head;
-        q->head = temp;
-        temp = temp->next;
-        q->head->next = prev;
+    if (!q || !q_unshare(q))
+        return false;
+    list_ele_t *head = NULL, *tail = NULL;
+    for (list_ele_t *e = q->head; e; e = e->next) {
+        list_ele_t *c = malloc(sizeof(list_ele_t));
+        if (!c)
+            goto fail;
+        c->value = strdup(e->value);
+        if (!c->value) {
+            free(c);
+            goto fail;
+        }
+        c->next = NULL;
+        if (tail)
+            tail->next = c;
+        else
+            head = c;
+        tail = c;
+    }
+
+    list_ele_t *c = head;
+    while (q->head) {
+        list_ele_t *e = q->head;
+        q->head = e->next;
+        index_move(q, e, c);
+        ttl_move(q, e, c);
+        free(e->value);
+        free(e);
+        c = c->next;
+    }
+    q->head = head;
+    q->tail = tail;
+    if (q->skip)
+        skip_refresh(q, q->size);
+    return true;
+
+fail:
+    while (head) {
+        list_ele_t *e = head;
+        head = e->next;
+        free(e->value);
+        free(e);
     }
-    q->tail->next = NULL;
+    return false;
+}
+
+/* Most queues merged by one loser tree, see q_merge_sorted */
+#define MERGE_FANIN 64
+
+/* Current elements of the queues being merged, NULL once a queue is done */
+static bool merge_less(int a, int b, void *arg)
+{
+    list_ele_t **cur = arg;
+    if (!cur[a])
+        return false;
+    if (!cur[b])
+        return true;
+    int c = strcmp(cur[a]->value, cur[b]->value);
+    return c < 0 || (c == 0 && a < b);
 }
 
 /*
- * Sort elements of queue in ascending order
- * No effect if q is NULL or empty. In addition, if q has only one
- * element, do nothing.
+ * Merge the n <= MERGE_FANIN queues qs[0], qs[stride], qs[2 * stride], ...
+ * into qs[0] by relinking their elements.
  */
-void q_sort(queue_t *q)
+static void merge_group(queue_t **qs, int n, int stride)
 {
-    if (!q || !q->size)
-        return;
-    q->head = sortList(q->head, strcmp);
-    list_ele_t *it;
-    for (it = q->head; it->next; it = it->next)
-        ;
-    q->tail = it;
+    list_ele_t *cur[MERGE_FANIN];
+    int node[MERGE_FANIN];
+    size_t size = 0;
+    for (int i = 0; i < n; i++) {
+        queue_t *q = qs[i * stride];
+        cur[i] = q->head;
+        size += q->size;
+        q->head = q->tail = NULL;
+        q->size = 0;
+    }
+
+    losertree_t lt;
+    lt_init(&lt, node, n, merge_less, cur);
+    list_ele_t *head = NULL, **link = &head, *last = NULL;
+    for (int w = lt_winner(&lt); cur[w]; w = lt_winner(&lt)) {
+        last = *link = cur[w];
+        link = &last->next;
+        cur[w] = last->next;
+        lt_replay(&lt);
+    }
+    qs[0]->head = head;
+    qs[0]->tail = last;
+    qs[0]->size = size;
+}
+
+bool q_merge_sorted(queue_t **qs, int k)
+{
+    if (!qs || k < 1)
+        return false;
+    /* Relinking a queue into itself would corrupt it */
+    for (int i = 0; i < k; i++) {
+        if (!qs[i])
+            return false;
+        for (int j = 0; j < i; j++)
+            if (qs[j] == qs[i])
+                return false;
+    }
+    for (int i = 0; i < k; i++)
+        if ((qs[i]->packed && !q_expand(qs[i])) || !q_unshare(qs[i]))
+            return false;
+    for (int i = 0; i < k; i++) {
+        q_index(qs[i], false);
+        skip_free(qs[i]);
+        ttl_drop(qs[i]);
+    }
+    if (qs[0]->wal) {
+        /* Logged as appending the other elements, then sorting */
+        for (int i = 1; i < k; i++)
+            for (list_ele_t *e = qs[i]->head; e; e = e->next)
+                q_record(qs[0], WAL_INSERT_TAIL, 0, e->value);
+        q_record(qs[0], WAL_SORT, 0, NULL);
+    }
+    for (int i = 1; i < k; i++)
+        if (qs[i]->size)
+            q_record(qs[i], WAL_REMOVE_HEAD, qs[i]->size, NULL);
+
+    /* Merge groups into their first queue, then groups of those, ... */
+    for (int stride = 1; stride < k; stride *= MERGE_FANIN) {
+        for (int i = 0; i < k; i += stride * MERGE_FANIN) {
+            int n = (k - i + stride - 1) / stride;
+            if (n > 1)
+                merge_group(qs + i, n < MERGE_FANIN ? n : MERGE_FANIN,
+                            stride);
+        }
+    }
+    return true;
+}
+
+/*
+ * Drop the indexes and deadlines of queue and decode it, before relinking
+ * its elements
+ */
+static bool detach_indexes(queue_t *q)
+{
+    if (q->packed && !q_expand(q))
+        return false;
+    q_index(q, false);
+    skip_free(q);
+    ttl_drop(q);
+    return true;
+}
+
+bool q_concat(queue_t *dst, queue_t *src)
+{
+    if (!dst || !src || dst == src || !q_unshare(src) ||
+        !detach_indexes(dst) || !detach_indexes(src))
+        return false;
+    if (!src->head)
+        return true;
+    if (dst->wal)
+        for (list_ele_t *e = src->head; e; e = e->next)
+            q_record(dst, WAL_INSERT_TAIL, 0, e->value);
+    q_record(src, WAL_REMOVE_HEAD, src->size, NULL);
+    if (dst->tail)
+        dst->tail->next = src->head;
+    else
+        dst->head = src->head;
+    dst->tail = src->tail;
+    dst->size += src->size;
+    src->head = src->tail = NULL;
+    src->size = 0;
+    return true;
+}
+
+queue_t *q_split(queue_t *q, size_t n)
+{
+    if (!q || n > q->size)
+        return NULL;
+    queue_t *front = q_new();
+    if (!front)
+        return NULL;
+    if (!snap_copy(q, n) || !detach_indexes(q)) {
+        q_free(front);
+        return NULL;
+    }
+    if (n == 0)
+        return front;
+
+    list_walker_t w;
+    walk_init(&w, q->head, false);
+    list_ele_t *last = NULL;
+    for (size_t i = 0; i < n; i++)
+        last = walk_next(&w);
+    front->head = q->head;
+    front->tail = last;
+    front->size = n;
+    q->head = last->next;
+    if (!q->head)
+        q->tail = NULL;
+    q->size -= n;
+    if (q->snap)
+        q->snap_pos -= n;
+    last->next = NULL;
+    q_record(q, WAL_REMOVE_HEAD, n, NULL);
+    return front;
+}
+
+bool q_insert_tail_ttl(queue_t *q, char *s, long ms)
+{
+    if (!q || ms <= 0 || (q->packed && !q_expand(q)))
+        return false;
+    if (!q->ttl) {
+        ttlwheel_t *w = malloc(sizeof(ttlwheel_t));
+        if (!w)
+            return false;
+        memset(w, 0, sizeof(ttlwheel_t));
+        if (!ttl_pool_resize(w, 16) || !ttl_node_resize(w, 32)) {
+            free(w->entries);
+            free(w);
+            return false;
+        }
+        q->ttl = w;
+    }
+    /* Logged as a whole rather than as an insertion without deadline */
+    wal_t *wal = q->wal;
+    q->wal = NULL;
+    bool ok = ttl_reserve(q->ttl) && q_insert_tail(q, s);
+    q->wal = wal;
+    if (!ok)
+        return false;
+    ttl_put(q->ttl, q->tail, q->ttl->now + ms);
+    q_record(q, WAL_INSERT_TTL, ms, s);
+    return true;
+}
+
+size_t q_expire(queue_t *q, long now)
+{
+    if (!q || !q->ttl || now < 0 || !q_unshare(q))
+        return 0;
+    ttlwheel_t *w = q->ttl;
+    size_t expired = 0;
+    for (uint64_t t; (t = ttl_next(w)) <= (uint64_t) now;) {
+        /* Move entries of slots starting at t down, collecting due ones */
+        w->now = t;
+        uint32_t due = 0;
+        for (int l = TTL_LEVELS - 1; l >= 0; l--) {
+            int shift = TTL_BITS * l;
+            unsigned slot = (t >> shift) & (TTL_SLOTS - 1);
+            uint32_t first = w->slots[l][slot];
+            if (!first || (t & ((1ULL << shift) - 1)))
+                continue;
+            w->slots[l][slot] = 0;
+            w->occupied[l] &= ~(1ULL << slot);
+            for (uint32_t id = first, next;; id = next) {
+                next = w->entries[id].next;
+                if (w->entries[id].deadline <= t)
+                    ttl_append(w->entries, &due, id);
+                else
+                    ttl_link(w, id);
+                if (next == first)
+                    break;
+            }
+        }
+
+        while (due) {
+            uint32_t id = due;
+            ttl_detach(w->entries, &due, id);
+            list_ele_t *e = w->entries[id].node;
+            ttl_release(w, id);
+            if (q->skip) {
+                /* Positions of the skip index are found by walking the list */
+                list_ele_t *prev = NULL;
+                size_t pos = 1;
+                for (list_ele_t *x = q->head; x != e; prev = x, x = x->next)
+                    pos++;
+                unlink_next(q, prev, pos);
+            } else
+                remove_element(q, e);
+            expired++;
+        }
+    }
+    if (w->now < (uint64_t) now)
+        w->now = now;
+    q_record(q, WAL_EXPIRE, now, NULL);
+    return expired;
+}
+
+long q_clock(queue_t *q)
+{
+    return q && q->ttl ? (long) q->ttl->now : 0;
+}
+
+void q_log(queue_t *q, wal_t *wal)
+{
+    if (q)
+        q->wal = wal;
+}
+
+qsnap_t *q_clone(queue_t *q)
+{
+    if (!q || q->packed)
+        return NULL;
+    qsnap_t *s = q->snap;
+    if (s && !q->snap_pos && q->snap_len == q->size && s->size == q->size) {
+        /* Nothing changed since the last snapshot */
+        __atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+        return s;
+    }
+    s = malloc(sizeof(qsnap_t));
+    if (!s)
+        return NULL;
+    s->head = q->head;
+    s->size = q->size;
+    /* The reference of q to its old snapshot moves to the new one */
+    s->parent = q->snap;
+    s->hole_pos = q->snap_pos;
+    s->hole_len = q->snap_len;
+    s->refs = 1;
+    if (q->size) {
+        s->refs++;
+        q->snap = s;
+        q->snap_pos = 0;
+        q->snap_len = q->size;
+    }
+    return s;
+}
+
+size_t q_snap_size(qsnap_t *s)
+{
+    return s ? s->size : 0;
+}
+
+long q_snap_foreach(qsnap_t *s,
+                    void (*visit)(const char *s, void *arg),
+                    void *arg)
+{
+    if (!s)
+        return 0;
+    list_ele_t *e = s->head;
+    for (size_t pos = 0; pos < s->size; pos++) {
+        visit(e->value, arg);
+        /* The link out of the last element belongs to the queue */
+        if (pos + 1 < s->size)
+            e = e->next;
+    }
+    return s->size;
+}
+
+size_t q_shared(queue_t *q)
+{
+    return q ? q->snap_len : 0;
 }
 
 list_ele_t *sortList(list_ele_t *head, int (*cmp)(const char *, const char *))
@@ -199,15 +2802,13 @@ list_ele_t *sortList(list_ele_t *head, int (*cmp)(const char *, const char *))
 list_ele_t *truncate_and_findMid(list_ele_t *const head)
 {
     /* the list should be guarantee to have at least 2 elements */
-    list_ele_t *fast = head->next;
+    list_walker_t fast;
+    walk_init(&fast, head->next, false);
     list_ele_t *slow = head;
     list_ele_t *toTruncate = NULL;
-    while (fast) {
+    while (walk_next(&fast)) {
         /* fast forwards 2 place and slow forwards 1 place each iteration */
-        if (fast->next)
-            fast = fast->next->next;
-        else
-            fast = fast->next;
+        walk_next(&fast);
         toTruncate = slow;
         slow = slow->next;
     }
@@ -219,21 +2820,14 @@ list_ele_t *mergeSorted(list_ele_t *first,
                         list_ele_t *second,
                         int (*cmp)(const char *, const char *))
 {
-    list_ele_t *ans;
-    pop(cmp(first->value, second->value) < 0 ? &first : &second, &ans);
-    list_ele_t *it = ans;
-    while (1) {
-        if (!first) {
-            it->next = second;
-            break;
-        } else if (!second) {
-            it->next = first;
-            break;
-        } else {
-            pop(cmp(first->value, second->value) < 0 ? &first : &second,
-                &it->next);
-            it = it->next;
-        }
+    list_walker_t a, b;
+    walk_init(&a, first, true);
+    walk_init(&b, second, true);
+    list_ele_t *ans = NULL, **it = &ans;
+    while (a.cur && b.cur) {
+        *it = walk_next(cmp(a.cur->value, b.cur->value) < 0 ? &a : &b);
+        it = &(*it)->next;
     }
+    *it = a.cur ? a.cur : b.cur;
     return ans;
 }
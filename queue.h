@@ -22,11 +22,87 @@ typedef struct ELE {
     struct ELE *next;
 } list_ele_t;
 
+/*
+ * Number of elements ahead of the current one which list traversals prefetch,
+ * or 0 to prefetch nothing
+ */
+extern int prefetch_distance;
+
+/*
+ * Cursor over a list that prefetches the element prefetch_distance places
+ * ahead of the one it returns, and that element's string if values is true
+ */
+typedef struct {
+    list_ele_t *cur; /* Element returned by the next walk_next */
+    list_ele_t *ahead;
+    bool values;
+} list_walker_t;
+
+/* Start walking the list at head */
+static inline void walk_init(list_walker_t *w, list_ele_t *head, bool values)
+{
+    w->cur = head;
+    w->ahead = prefetch_distance > 0 ? head : NULL;
+    w->values = values;
+    for (int i = 0; w->ahead && i < prefetch_distance; i++) {
+        __builtin_prefetch(w->ahead->next);
+        if (values)
+            __builtin_prefetch(w->ahead->value);
+        w->ahead = w->ahead->next;
+    }
+}
+
+/*
+ * Return the current element, or NULL at the end of the list, and step past
+ * it. Its next field is read before returning, so the caller may relink or
+ * free the returned element.
+ */
+static inline list_ele_t *walk_next(list_walker_t *w)
+{
+    list_ele_t *e = w->cur;
+    if (!e)
+        return NULL;
+    if (w->ahead) {
+        __builtin_prefetch(w->ahead->next);
+        if (w->values)
+            __builtin_prefetch(w->ahead->value);
+        w->ahead = w->ahead->next;
+    }
+    w->cur = e->next;
+    return e;
+}
+
+/* Optional hash index over the strings of a queue, see q_index */
+typedef struct HINDEX hindex_t;
+
+/* Optional skip index over positions of a queue, see q_ordered/q_positions */
+typedef struct SKIPLIST skiplist_t;
+
+/* Front-coded strings following the tail, see q_compact_sorted */
+typedef struct FCSTORE fcstore_t;
+
+/* Deadlines of elements of a queue, see q_insert_tail_ttl */
+typedef struct TTLWHEEL ttlwheel_t;
+
+/* Write-ahead log of the changes of a queue, see q_log */
+typedef struct WAL wal_t;
+
+/* Read-only view of a queue at one point in time, see q_clone */
+typedef struct QSNAP qsnap_t;
+
 /* Queue structure */
 typedef struct {
     list_ele_t *head; /* Linked list of elements */
     list_ele_t *tail;
-    int size;
+    size_t size;
+    hindex_t *index; /* NULL unless enabled by q_index */
+    skiplist_t *skip; /* NULL unless enabled by q_ordered or q_positions */
+    fcstore_t *packed; /* NULL unless queue got compacted */
+    ttlwheel_t *ttl;   /* NULL unless elements got deadlines */
+    wal_t *wal;        /* NULL unless changes get logged */
+    qsnap_t *snap;     /* NULL unless elements are shared with snapshots */
+    size_t snap_pos;   /* Position of the first shared element, from 0 */
+    size_t snap_len;   /* Number of shared elements from there on */
 } queue_t;
 
 /* Operations on queue */
@@ -40,9 +116,25 @@ queue_t *q_new();
 /*
  * Free ALL storage used by queue.
  * No effect if q is NULL
+ * After q_free_async, storage is freed in the background; see q_sync.
  */
 void q_free(queue_t *q);
 
+/*
+ * Make q_free hand queues over to a background thread which frees them
+ * (enable is true), or stop that thread once it has freed all of them
+ * (enable is false). While there are too many queues pending, q_free frees
+ * in the calling thread.
+ * Return true if successful.
+ * Return false if could not start the thread.
+ */
+bool q_free_async(bool enable);
+
+/*
+ * Wait until all queues handed over by q_free have been freed.
+ */
+void q_sync();
+
 /*
  * Attempt to insert element at head of queue.
  * Return true if successful.
@@ -75,7 +167,7 @@ bool q_remove_head(queue_t *q, char *sp, size_t bufsize);
  * Return number of elements in queue.
  * Return 0 if q is NULL or empty
  */
-int q_size(queue_t *q);
+size_t q_size(queue_t *q);
 
 /*
  * Reverse elements in queue
@@ -93,6 +185,277 @@ void q_reverse(queue_t *q);
  */
 void q_sort(queue_t *q);
 
+/*
+ * Move the k smallest elements of queue to its head in ascending order
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * The remaining elements follow them in unspecified order.
+ * It takes O(n log k) time with a bounded heap of k element pointers.
+ * If k is not less than the size of queue, this is the same as q_sort.
+ */
+bool q_sort_topk(queue_t *q, size_t k);
+
+/*
+ * Remove duplicate strings from queue, preserving the order of the rest.
+ * Keep the first occurrence of each string if keep_first is true, or the
+ * last one otherwise. The space used by removed elements is freed.
+ * Return the number of elements removed.
+ * Return -1 if q is NULL or could not allocate space.
+ */
+long q_unique(queue_t *q, bool keep_first);
+
+/*
+ * Build (enable is true) or drop (enable is false) a hash index from the
+ * strings of queue to the elements holding them.
+ * Once built, all operations on queue keep the index in sync, so that
+ * q_contains and q_remove_value take expected O(1) time.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ */
+bool q_index(queue_t *q, bool enable);
+
+/*
+ * Return number of bytes used by the hash index of queue.
+ * Return 0 if q is NULL or has no index.
+ */
+size_t q_index_memory(queue_t *q);
+
+/*
+ * Return whether queue holds an element with string s.
+ * Return false if q is NULL or empty.
+ */
+bool q_contains(queue_t *q, const char *s);
+
+/*
+ * Attempt to remove one element holding string s from queue.
+ * Return true if successful.
+ * Return false if q is NULL or no element holds s.
+ * The space used by the list element and the string is freed.
+ */
+bool q_remove_value(queue_t *q, const char *s);
+
+/*
+ * Keep queue sorted in ascending order with a skip index (enable is true),
+ * or drop the skip index (enable is false). Enabling it sorts the queue.
+ * While it is kept, q_insert_sorted, q_remove_value, q_range and q_rank take
+ * expected O(log n) time. Inserting a string out of order, or reversing the
+ * queue, makes the index fall back to positions only, as with q_positions.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ */
+bool q_ordered(queue_t *q, bool enable);
+
+/*
+ * Build (enable is true) or drop (enable is false) a skip index over the
+ * positions of queue, unless it has one already.
+ * Once built, all operations on queue keep the index in sync, so that
+ * q_get, q_remove_at and q_insert_at take expected O(log n) time.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ */
+bool q_positions(queue_t *q, bool enable);
+
+/*
+ * Attempt to copy the string of the element at index i of queue, counting
+ * from 0 at the head, to *sp (up to a maximum of bufsize-1 characters, plus
+ * a null terminator), if sp is non-NULL.
+ * Return true if successful.
+ * Return false if q is NULL or i is out of range.
+ */
+bool q_get(queue_t *q, size_t i, char *sp, size_t bufsize);
+
+/*
+ * Attempt to remove the element at index i of queue, counting from 0 at the
+ * head, copying its string to *sp as q_remove_head does.
+ * Return true if successful.
+ * Return false if q is NULL or i is out of range.
+ * The space used by the list element and the string is freed.
+ */
+bool q_remove_at(queue_t *q, size_t i, char *sp, size_t bufsize);
+
+/*
+ * Attempt to insert element holding string s at index i of queue, counting
+ * from 0 at the head, so that i equal to the size of queue inserts at tail.
+ * Return true if successful.
+ * Return false if q is NULL, i is out of range or could not allocate space.
+ * The function must explicitly allocate space and copy the string into it.
+ */
+bool q_insert_at(queue_t *q, size_t i, char *s);
+
+/*
+ * Attempt to insert element holding string s into sorted queue, after any
+ * element holding an equal string. Calls q_ordered first if needed.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * The function must explicitly allocate space and copy the string into it.
+ */
+bool q_insert_sorted(queue_t *q, char *s);
+
+/*
+ * Call visit with arg on every string s of queue, lo <= s < hi, in queue order.
+ * Return the number of visited strings, 0 if q is NULL.
+ */
+size_t q_range(queue_t *q,
+               const char *lo,
+               const char *hi,
+               void (*visit)(const char *s, void *arg),
+               void *arg);
+
+/*
+ * Return the number of strings of queue less than s.
+ * Return 0 if q is NULL.
+ */
+size_t q_rank(queue_t *q, const char *s);
+
+/*
+ * Re-encode all elements of queue into front-coded blocks, which pays off
+ * when neighbouring strings share prefixes as in a sorted queue. Any hash or
+ * skip index of queue is dropped. Strings are decoded again one at a time by
+ * q_remove_head, and q_insert_tail appends to the blocks. Other operations
+ * which need list elements call q_expand first.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ */
+bool q_compact_sorted(queue_t *q);
+
+/*
+ * Decode all compacted elements of queue back into list elements.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ */
+bool q_expand(queue_t *q);
+
+/*
+ * Call visit with arg on every string of queue in order, decoding compacted
+ * elements one at a time.
+ * Return the number of visited strings, 0 if q is NULL, or -1 if could not
+ * allocate space.
+ */
+long q_foreach(queue_t *q,
+               void (*visit)(const char *s, void *arg),
+               void *arg);
+
+/*
+ * Copy list elements and their strings into fresh memory in list order and
+ * free the old ones, which restores locality after q_sort.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space, leaving the queue
+ * unchanged.
+ */
+bool q_defrag(queue_t *q);
+
+/*
+ * Merge k sorted queues into qs[0] by relinking their elements, leaving the
+ * others empty. Equal strings keep the order of the queues holding them.
+ * It takes O(n log k) time with loser trees, and allocates nothing unless
+ * some queue needs q_expand. Any hash or skip index of the queues is
+ * dropped.
+ * Return true if successful.
+ * Return false if qs or any queue is NULL, if any queue appears twice in qs,
+ * or could not allocate space.
+ */
+bool q_merge_sorted(queue_t **qs, int k);
+
+/*
+ * Move all elements of queue src to the tail of queue dst in O(1) time,
+ * leaving src empty. Any hash or skip index of either queue is dropped.
+ * Return true if successful.
+ * Return false if dst or src is NULL, both are the same queue, or could not
+ * allocate space.
+ */
+bool q_concat(queue_t *dst, queue_t *src);
+
+/*
+ * Move the first n elements of queue to a new queue by relinking them, which
+ * takes O(n) time. Any hash or skip index of queue is dropped.
+ * Return the new queue.
+ * Return NULL if q is NULL, n exceeds the size of queue or could not allocate
+ * space.
+ */
+queue_t *q_split(queue_t *q, size_t n);
+
+/*
+ * Attempt to insert element at tail of queue, which expires ms milliseconds
+ * after the clock of queue, as q_expire moves it. Deadlines live in a
+ * hierarchical timing wheel, so that expiring takes amortized O(1) time per
+ * element, except for expiring the tail while other elements live, or while
+ * queue has a skip index, which walks the list. Operations relinking the
+ * elements of several queues, and q_compact_sorted, drop all deadlines.
+ * Return true if successful.
+ * Return false if q is NULL, ms is not positive or could not allocate space.
+ * The function must explicitly allocate space and copy the string into it.
+ */
+bool q_insert_tail_ttl(queue_t *q, char *s, long ms);
+
+/*
+ * Move the clock of queue forward to now, in milliseconds, and remove every
+ * element whose deadline got reached, without looking at the others.
+ * The clock of a queue starts at 0, and stays put if now lies before it.
+ * The space used by the removed elements is freed.
+ * Return the number of removed elements, 0 if q is NULL.
+ */
+size_t q_expire(queue_t *q, long now);
+
+/*
+ * Return the clock of queue, as last moved by q_expire.
+ * Return 0 if q is NULL or no element ever got a deadline.
+ */
+long q_clock(queue_t *q);
+
+/*
+ * Append a record of every later change to the elements of queue to write
+ * ahead log wal, or stop logging if wal is NULL. Operations moving elements
+ * between queues log them as insertions and removals.
+ * No effect if q is NULL
+ */
+void q_log(queue_t *q, wal_t *wal);
+
+/*
+ * Take a snapshot of queue in O(1) time, sharing its elements, which stay
+ * unchanged while shared. Operations changing the links between shared
+ * elements copy them first, but only those up to the last position they
+ * touch, and q_remove_head leaves shared elements to the snapshots. Inserting
+ * at either end copies nothing.
+ * A snapshot may be read and freed by another thread while queue changes.
+ * Return NULL if q is NULL or compacted, or could not allocate space.
+ */
+qsnap_t *q_clone(queue_t *q);
+
+/*
+ * Return number of elements in snapshot.
+ * Return 0 if s is NULL or empty
+ */
+size_t q_snap_size(qsnap_t *s);
+
+/*
+ * Call visit with arg on every string of snapshot in order.
+ * Return the number of visited strings, 0 if s is NULL.
+ */
+long q_snap_foreach(qsnap_t *s,
+                    void (*visit)(const char *s, void *arg),
+                    void *arg);
+
+/*
+ * Free snapshot, and the elements no other snapshot or queue shares.
+ * No effect if s is NULL
+ */
+void q_snap_free(qsnap_t *s);
+
+/*
+ * Copy all elements of queue shared with snapshots, as operations
+ * rearranging all of them, like q_sort and q_reverse, do first.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space, leaving the queue
+ * unchanged.
+ */
+bool q_unshare(queue_t *q);
+
+/*
+ * Return number of elements of queue still shared with snapshots.
+ * Return 0 if q is NULL
+ */
+size_t q_shared(queue_t *q);
+
 list_ele_t *sortList(list_ele_t *head, int (*cmp)(const char *, const char *));
 list_ele_t *truncate_and_findMid(list_ele_t *const);
 list_ele_t *mergeSorted(list_ele_t *,
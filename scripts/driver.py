@@ -17,6 +17,7 @@ class Tracer:
     autograde = False
     useValgrind = False
     colored = False
+    scale = False
 
     traceDict = {
         1: "trace-01-ops",
@@ -35,9 +36,38 @@ class Tracer:
         14: "trace-14-perf",
         15: "trace-15-perf",
         16: "trace-16-perf",
-        17: "trace-17-complexity"
+        17: "trace-17-complexity",
+        18: "trace-18-sortk",
+        19: "trace-19-unique",
+        20: "trace-20-index",
+        21: "trace-21-ordered",
+        22: "trace-22-positions",
+        23: "trace-23-compact",
+        24: "trace-24-defrag",
+        25: "trace-25-pool",
+        26: "trace-26-scale",
+        27: "trace-27-prefetch",
+        28: "trace-28-fixture",
+        29: "trace-29-reclaim",
+        30: "trace-30-tiered",
+        31: "trace-31-xsort",
+        32: "trace-32-merge",
+        33: "trace-33-rotate",
+        34: "trace-34-named",
+        35: "trace-35-pqueue",
+        36: "trace-36-ttl",
+        37: "trace-37-bqueue",
+        38: "trace-38-wsdeque",
+        39: "trace-39-shqueue",
+        40: "trace-40-wal",
+        41: "trace-41-repl",
+        42: "trace-42-snap",
+        43: "trace-43-billion"
     }
 
+    # Traces taking minutes, run only with --scale or -t
+    scaleTraces = [43]
+
     traceProbs = {
         1: "Trace-01",
         2: "Trace-02",
@@ -55,10 +85,36 @@ class Tracer:
         14: "Trace-14",
         15: "Trace-15",
         16: "Trace-16",
-        17: "Trace-17"
+        17: "Trace-17",
+        18: "Trace-18",
+        19: "Trace-19",
+        20: "Trace-20",
+        21: "Trace-21",
+        22: "Trace-22",
+        23: "Trace-23",
+        24: "Trace-24",
+        25: "Trace-25",
+        26: "Trace-26",
+        27: "Trace-27",
+        28: "Trace-28",
+        29: "Trace-29",
+        30: "Trace-30",
+        31: "Trace-31",
+        32: "Trace-32",
+        33: "Trace-33",
+        34: "Trace-34",
+        35: "Trace-35",
+        36: "Trace-36",
+        37: "Trace-37",
+        38: "Trace-38",
+        39: "Trace-39",
+        40: "Trace-40",
+        41: "Trace-41",
+        42: "Trace-42",
+        43: "Trace-43"
     }
 
-    maxScores = [0, 6, 6, 6, 6, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5]
+    maxScores = [0, 6, 6, 6, 6, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6]
 
     RED = '\033[91m'
     GREEN = '\033[92m'
@@ -69,13 +125,15 @@ class Tracer:
                  verbLevel=0,
                  autograde=False,
                  useValgrind=False,
-                 colored=False):
+                 colored=False,
+                 scale=False):
         if qtest != "":
             self.qtest = qtest
         self.verbLevel = verbLevel
         self.autograde = autograde
         self.useValgrind = useValgrind
         self.colored = colored
+        self.scale = scale
 
     def printInColor(self, text, color):
         if self.colored == False:
@@ -101,7 +159,8 @@ class Tracer:
         scoreDict = {k: 0 for k in self.traceDict.keys()}
         print("---\tTrace\t\tPoints")
         if tid == 0:
-            tidList = self.traceDict.keys()
+            tidList = [t for t in self.traceDict.keys()
+                       if self.scale or t not in self.scaleTraces]
         else:
             if not tid in self.traceDict:
                 self.printInColor("ERROR: Invalid trace ID %d" % tid, self.RED)
@@ -151,6 +210,7 @@ def usage(name):
     print("  -t TID    Trace ID to test")
     print("  -v VLEVEL Set verbosity level (0-3)")
     print("  -c Enable colored text")
+    print("  --scale   Also run traces taking minutes")
     sys.exit(0)
 
 
@@ -162,8 +222,9 @@ def run(name, args):
     autograde = False
     useValgrind = False
     colored = False
+    scale = False
 
-    optlist, args = getopt.getopt(args, 'hp:t:v:A:c', ['valgrind'])
+    optlist, args = getopt.getopt(args, 'hp:t:v:A:c', ['valgrind', 'scale'])
     for (opt, val) in optlist:
         if opt == '-h':
             usage(name)
@@ -180,6 +241,8 @@ def run(name, args):
             useValgrind = True
         elif opt == '-c':
             colored = True
+        elif opt == '--scale':
+            scale = True
         else:
             print("Unrecognized option '%s'" % opt)
             usage(name)
@@ -189,7 +252,8 @@ def run(name, args):
                verbLevel=vlevel,
                autograde=autograde,
                useValgrind=useValgrind,
-               colored=colored)
+               colored=colored,
+               scale=scale)
     t.run(tid)
 
 
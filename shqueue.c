@@ -0,0 +1,279 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "harness.h"
+#include "shqueue.h"
+
+#define SHQ_MIN_BLOCK 32
+
+/* Offset of the first block, past the header */
+#define SHQ_FIRST ((sizeof(shq_header_t) + 63) & ~(uint64_t) 63)
+
+#define BLOCK_BYTES(cls) ((uint64_t) SHQ_MIN_BLOCK << (cls))
+
+/* Element at offset off of the region of q */
+#define NODE(q, off) ((shq_node_t *) ((char *) (q)->hdr + (off)))
+
+/* Map the region open as fd of bytes bytes, return NULL if could not */
+static shqueue_t *shq_map(int fd, size_t bytes)
+{
+    shqueue_t *q = malloc(sizeof(shqueue_t));
+    if (!q)
+        return NULL;
+    q->hdr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (q->hdr == MAP_FAILED) {
+        free(q);
+        return NULL;
+    }
+    q->bytes = bytes;
+    return q;
+}
+
+/*
+ * Create a region of bytes bytes named name, which starts with a slash,
+ * replacing any region of that name, and map it as an empty queue.
+ * Return NULL if could not create the region or allocate space.
+ */
+shqueue_t *shq_create(const char *name, size_t bytes)
+{
+    if (bytes < SHQ_FIRST + SHQ_MIN_BLOCK)
+        return NULL;
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return NULL;
+    shqueue_t *q = NULL;
+    if (!ftruncate(fd, bytes))
+        q = shq_map(fd, bytes);
+    close(fd);
+    if (!q) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    shq_header_t *h = q->hdr;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&h->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    h->bytes = bytes;
+    h->brk = SHQ_FIRST;
+    /* The rest of the region is zero already, and magic says it is ready */
+    __atomic_store_n(&h->magic, SHQ_MAGIC, __ATOMIC_RELEASE);
+    return q;
+}
+
+/*
+ * Map the existing region named name.
+ * Return NULL if there is none holding a queue, or could not allocate space.
+ */
+shqueue_t *shq_attach(const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    shqueue_t *q = NULL;
+    if (!fstat(fd, &st) && (size_t) st.st_size >= SHQ_FIRST)
+        q = shq_map(fd, st.st_size);
+    close(fd);
+    if (!q)
+        return NULL;
+    if (__atomic_load_n(&q->hdr->magic, __ATOMIC_ACQUIRE) != SHQ_MAGIC ||
+        q->hdr->bytes != q->bytes) {
+        shq_detach(q);
+        return NULL;
+    }
+    return q;
+}
+
+/*
+ * Unmap region, which keeps existing, with its elements, until unlinked.
+ * No effect if q is NULL
+ */
+void shq_detach(shqueue_t *q)
+{
+    if (!q)
+        return;
+    munmap(q->hdr, q->bytes);
+    free(q);
+}
+
+/*
+ * Remove the region named name, which lives on while processes map it.
+ * Return true if successful.
+ */
+bool shq_unlink(const char *name)
+{
+    return !shm_unlink(name);
+}
+
+/* Whether off can be the offset of an element allocated in q */
+static bool valid_node(shqueue_t *q, uint64_t off)
+{
+    shq_header_t *h = q->hdr;
+    if (off < SHQ_FIRST || off % SHQ_MIN_BLOCK ||
+        off > h->brk - SHQ_MIN_BLOCK)
+        return false;
+    uint32_t cls = NODE(q, off)->cls;
+    return cls < SHQ_CLASSES && BLOCK_BYTES(cls) <= h->brk - off;
+}
+
+/*
+ * Rebuild tail, size and used of q, left behind by a process which died
+ * while changing the list, by following it from head.
+ * Every change to the list is ordered so that it stays linked from head.
+ */
+static void shq_repair(shqueue_t *q)
+{
+    shq_header_t *h = q->hdr;
+    uint64_t size = 0, used = 0, last = 0;
+    uint64_t limit = (h->brk - SHQ_FIRST) / SHQ_MIN_BLOCK;
+    uint64_t *link = &h->head;
+    while (*link && size < limit) {
+        if (!valid_node(q, *link)) {
+            *link = 0;
+            break;
+        }
+        last = *link;
+        used += BLOCK_BYTES(NODE(q, last)->cls);
+        size++;
+        link = &NODE(q, last)->next;
+    }
+    *link = 0;
+    h->tail = last;
+    h->size = size;
+    h->used = used;
+}
+
+/*
+ * Lock the region of q, repairing it if its holder died.
+ * Hold off the time limit meanwhile, as jumping out would leave it locked.
+ */
+static bool shq_lock(shqueue_t *q)
+{
+    shq_header_t *h = q->hdr;
+    exception_hold();
+    int err = pthread_mutex_lock(&h->lock);
+    if (err == EOWNERDEAD) {
+        shq_repair(q);
+        h->recoveries++;
+        err = pthread_mutex_consistent(&h->lock);
+    }
+    if (err)
+        exception_release();
+    return !err;
+}
+
+static void shq_unlock(shqueue_t *q)
+{
+    pthread_mutex_unlock(&q->hdr->lock);
+    exception_release();
+}
+
+/*
+ * Take a free block of q for an element holding len bytes.
+ * Return 0 if the region is full.
+ */
+static uint64_t block_new(shqueue_t *q, size_t len)
+{
+    shq_header_t *h = q->hdr;
+    uint32_t cls = 0;
+    while (BLOCK_BYTES(cls) < offsetof(shq_node_t, value) + len) {
+        if (++cls == SHQ_CLASSES)
+            return 0;
+    }
+    uint64_t off = h->free[cls];
+    if (off) {
+        h->free[cls] = NODE(q, off)->next;
+    } else {
+        if (BLOCK_BYTES(cls) > h->bytes - h->brk)
+            return 0;
+        off = h->brk;
+        h->brk += BLOCK_BYTES(cls);
+    }
+    NODE(q, off)->cls = cls;
+    h->used += BLOCK_BYTES(cls);
+    return off;
+}
+
+/*
+ * Attempt to insert element at tail of queue.
+ * Return true if successful.
+ * Return false if q is NULL or the region is full.
+ * Argument s points to the string to be stored.
+ */
+bool shq_insert_tail(shqueue_t *q, char *s)
+{
+    if (!q || !shq_lock(q))
+        return false;
+    shq_header_t *h = q->hdr;
+    size_t len = strlen(s) + 1;
+    uint64_t off = block_new(q, len);
+    if (off) {
+        shq_node_t *e = NODE(q, off);
+        memcpy(e->value, s, len);
+        e->next = 0;
+        /* Link the element before anything else refers to it */
+        if (h->tail)
+            NODE(q, h->tail)->next = off;
+        else
+            h->head = off;
+        h->tail = off;
+        h->size++;
+    }
+    shq_unlock(q);
+    return off != 0;
+}
+
+/*
+ * Attempt to remove element from head of queue.
+ * Return true if successful.
+ * Return false if queue is NULL or empty.
+ * If sp is non-NULL and an element is removed, copy the removed string to *sp
+ * (up to a maximum of bufsize-1 characters, plus a null terminator.)
+ */
+bool shq_remove_head(shqueue_t *q, char *sp, size_t bufsize)
+{
+    if (!q || !shq_lock(q))
+        return false;
+    shq_header_t *h = q->hdr;
+    uint64_t off = h->head;
+    if (off) {
+        shq_node_t *e = NODE(q, off);
+        if (sp) {
+            strncpy(sp, e->value, bufsize - 1);
+            sp[bufsize - 1] = '\0';
+        }
+        h->head = e->next;
+        if (!h->head)
+            h->tail = 0;
+        h->size--;
+        h->used -= BLOCK_BYTES(e->cls);
+        e->next = h->free[e->cls];
+        h->free[e->cls] = off;
+    }
+    shq_unlock(q);
+    return off != 0;
+}
+
+/*
+ * Return number of elements in queue.
+ * Return 0 if q is NULL or empty
+ */
+size_t shq_size(shqueue_t *q)
+{
+    if (!q || !shq_lock(q))
+        return 0;
+    size_t size = q->hdr->size;
+    shq_unlock(q);
+    return size;
+}
@@ -0,0 +1,96 @@
+#ifndef LAB0_SHQUEUE_H
+#define LAB0_SHQUEUE_H
+
+/*
+ * Queue shared by processes through a named POSIX shared memory region.
+ * Elements and their strings live inside the region and link to each other
+ * by offsets from its start, so every process can map it at any address.
+ * Operations hold a robust process-shared mutex: if a process dies holding
+ * it, the next one to lock it repairs the list from head to the last
+ * reachable element. The element being moved by the dead process may then
+ * be lost, but the queue stays usable.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHQ_MAGIC 0x6c6162307368710aULL
+#define SHQ_CLASSES 32
+
+/* Element, inside a block of 32 << cls bytes */
+typedef struct {
+    uint64_t next; /* Offset of the next element, or 0 */
+    uint32_t cls;
+    char value[];
+} shq_node_t;
+
+/* Start of the region */
+typedef struct {
+    uint64_t magic; /* Written last by the creator */
+    uint64_t bytes; /* Size of the region */
+    pthread_mutex_t lock;
+    uint64_t head, tail; /* Offsets of the first and last elements, or 0 */
+    uint64_t size;
+    uint64_t brk;               /* Offset of the first never used byte */
+    uint64_t free[SHQ_CLASSES]; /* Free blocks of each class */
+    uint64_t used;              /* Bytes in blocks holding elements */
+    uint64_t recoveries;        /* Times a dead process held the lock */
+} shq_header_t;
+
+/* Mapping of a region in this process */
+typedef struct {
+    shq_header_t *hdr;
+    size_t bytes;
+} shqueue_t;
+
+/*
+ * Create a region of bytes bytes named name, which starts with a slash,
+ * replacing any region of that name, and map it as an empty queue.
+ * Return NULL if could not create the region or allocate space.
+ */
+shqueue_t *shq_create(const char *name, size_t bytes);
+
+/*
+ * Map the existing region named name.
+ * Return NULL if there is none holding a queue, or could not allocate space.
+ */
+shqueue_t *shq_attach(const char *name);
+
+/*
+ * Unmap region, which keeps existing, with its elements, until unlinked.
+ * No effect if q is NULL
+ */
+void shq_detach(shqueue_t *q);
+
+/*
+ * Remove the region named name, which lives on while processes map it.
+ * Return true if successful.
+ */
+bool shq_unlink(const char *name);
+
+/*
+ * Attempt to insert element at tail of queue.
+ * Return true if successful.
+ * Return false if q is NULL or the region is full.
+ * Argument s points to the string to be stored.
+ */
+bool shq_insert_tail(shqueue_t *q, char *s);
+
+/*
+ * Attempt to remove element from head of queue.
+ * Return true if successful.
+ * Return false if queue is NULL or empty.
+ * If sp is non-NULL and an element is removed, copy the removed string to *sp
+ * (up to a maximum of bufsize-1 characters, plus a null terminator.)
+ */
+bool shq_remove_head(shqueue_t *q, char *sp, size_t bufsize);
+
+/*
+ * Return number of elements in queue.
+ * Return 0 if q is NULL or empty
+ */
+size_t shq_size(shqueue_t *q);
+
+#endif /* LAB0_SHQUEUE_H */
@@ -0,0 +1,227 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "harness.h"
+#include "tqueue.h"
+
+/* Estimated memory taken by an element holding a string of len bytes */
+#define ELE_BYTES(len) (sizeof(list_ele_t) + (len) + 1)
+
+/*
+ * Create empty queue keeping up to limit bytes of elements in memory.
+ * Return NULL if could not allocate space or create the file.
+ */
+tqueue_t *tq_new(const char *dir, size_t limit)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/qtest.XXXXXX", dir ? dir : "/tmp");
+    tqueue_t *q = malloc(sizeof(tqueue_t));
+    if (!q)
+        return NULL;
+    memset(q, 0, sizeof(tqueue_t));
+    q->limit = limit;
+    q->front = q_new();
+    q->back = q_new();
+    q->fd = mkstemp(path);
+    if (!q->front || !q->back || q->fd < 0) {
+        if (q->fd >= 0)
+            close(q->fd);
+        q_free(q->front);
+        q_free(q->back);
+        free(q);
+        return NULL;
+    }
+    unlink(path);
+    return q;
+}
+
+/* Free all storage used by queue and close its spill file */
+void tq_free(tqueue_t *q)
+{
+    if (!q)
+        return;
+    q_free(q->front);
+    q_free(q->back);
+    while (q->seg_head) {
+        tq_seg_t *seg = q->seg_head;
+        q->seg_head = seg->next;
+        free(seg);
+    }
+    free(q->buf);
+    close(q->fd);
+    free(q);
+}
+
+/* Make buf of q hold at least size bytes */
+static bool buf_reserve(tqueue_t *q, size_t size)
+{
+    if (size <= q->buf_cap)
+        return true;
+    size_t cap = q->buf_cap ? q->buf_cap : 4096;
+    while (cap < size)
+        cap *= 2;
+    char *buf = realloc(q->buf, cap);
+    if (!buf)
+        return false;
+    q->buf = buf;
+    q->buf_cap = cap;
+    return true;
+}
+
+/*
+ * Write the oldest TQ_SEGMENT elements of the back queue to the end of the
+ * spill file, removing them only once written.
+ * Return false if could not allocate space or write the file.
+ */
+static bool spill(tqueue_t *q)
+{
+    tq_seg_t *seg = malloc(sizeof(tq_seg_t));
+    if (!seg)
+        return false;
+    size_t bytes = 0, count = 0;
+    for (list_ele_t *e = q->back->head; e && count < TQ_SEGMENT;
+         e = e->next, count++) {
+        size_t len = strlen(e->value) + 1;
+        if (!buf_reserve(q, bytes + len)) {
+            free(seg);
+            return false;
+        }
+        memcpy(q->buf + bytes, e->value, len);
+        bytes += len;
+    }
+
+    for (size_t done = 0; done < bytes;) {
+        ssize_t n = pwrite(q->fd, q->buf + done, bytes - done,
+                           q->file_end + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            free(seg);
+            return false;
+        }
+        done += n;
+    }
+
+    seg->offset = q->file_end;
+    seg->bytes = bytes;
+    seg->count = count;
+    seg->next = NULL;
+    if (q->seg_tail)
+        q->seg_tail->next = seg;
+    else
+        q->seg_head = seg;
+    q->seg_tail = seg;
+    q->file_end += bytes;
+    q->mem_bytes -= count * sizeof(list_ele_t) + bytes;
+    for (size_t i = 0; i < count; i++)
+        q_remove_head(q->back, NULL, 0);
+    q->spills++;
+    q->spilled += count;
+    q->on_disk += count;
+    return true;
+}
+
+/*
+ * Read the oldest segment of the spill file into the front queue, and have
+ * the next one read ahead. A segment read in part stays in the file with
+ * the rest of its elements.
+ * Return false if could not read the file or allocate space.
+ */
+static bool restore(tqueue_t *q)
+{
+    tq_seg_t *seg = q->seg_head;
+    if (!buf_reserve(q, seg->bytes))
+        return false;
+    for (size_t done = 0; done < seg->bytes;) {
+        ssize_t n = pread(q->fd, q->buf + done, seg->bytes - done,
+                          seg->offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    if (seg->next)
+        posix_fadvise(q->fd, seg->next->offset, seg->next->bytes,
+                      POSIX_FADV_WILLNEED);
+
+    size_t used = 0, count = 0;
+    bool ok = true;
+    while (ok && count < seg->count) {
+        char *s = q->buf + used;
+        size_t len = strlen(s) + 1;
+        ok = q_insert_tail(q->front, s);
+        if (ok) {
+            used += len;
+            count++;
+            q->mem_bytes += ELE_BYTES(len - 1);
+        }
+    }
+    q->restored += count;
+    q->on_disk -= count;
+    if (!ok) {
+        seg->offset += used;
+        seg->bytes -= used;
+        seg->count -= count;
+        return count > 0;
+    }
+
+    q->restores++;
+    q->seg_head = seg->next;
+    if (!q->seg_head) {
+        q->seg_tail = NULL;
+        /* Give the space of the file back */
+        if (!ftruncate(q->fd, 0))
+            q->file_end = 0;
+    }
+    free(seg);
+    return true;
+}
+
+/*
+ * Attempt to insert element at tail of queue.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ */
+bool tq_insert_tail(tqueue_t *q, char *s)
+{
+    if (!q || !q_insert_tail(q->back, s))
+        return false;
+    q->mem_bytes += ELE_BYTES(strlen(s));
+    if (q->mem_bytes > q->limit && q->back->size >= TQ_SEGMENT)
+        spill(q);
+    return true;
+}
+
+/*
+ * Attempt to remove element from head of queue.
+ * Return true if successful.
+ * Return false if queue is NULL or empty, or could not restore elements.
+ */
+bool tq_remove_head(tqueue_t *q, char *sp, size_t bufsize)
+{
+    if (!q)
+        return false;
+    if (!q->front->size && q->seg_head && !restore(q))
+        return false;
+    queue_t *from = q->front->size ? q->front : q->back;
+    if (!from->size)
+        return false;
+    q->mem_bytes -= ELE_BYTES(strlen(from->head->value));
+    return q_remove_head(from, sp, bufsize);
+}
+
+/*
+ * Return number of elements in queue, including those in the spill file.
+ * Return 0 if q is NULL or empty
+ */
+size_t tq_size(tqueue_t *q)
+{
+    if (!q)
+        return 0;
+    return q->front->size + q->on_disk + q->back->size;
+}
@@ -0,0 +1,82 @@
+#ifndef LAB0_TQUEUE_H
+#define LAB0_TQUEUE_H
+
+/*
+ * Tiered queue holding more than fits in memory.
+ * New elements go to an in-memory back queue and old ones leave from an
+ * in-memory front queue. Once the elements in memory take more than a limit
+ * of bytes, the oldest elements of the back queue are written as a segment
+ * to a spill file with a single sequential write. Segments are read back
+ * into the front queue as the consumer reaches them, while the kernel is
+ * told to read the following segment ahead.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "queue.h"
+
+/* Elements written to the spill file at once */
+#define TQ_SEGMENT 1024
+
+/* Run of elements in the spill file, as strings with null terminators */
+typedef struct TQSEG {
+    off_t offset;
+    size_t bytes;
+    size_t count;
+    struct TQSEG *next;
+} tq_seg_t;
+
+typedef struct {
+    queue_t *front; /* Oldest elements, consumed first */
+    tq_seg_t *seg_head, *seg_tail; /* Elements between front and back */
+    queue_t *back; /* Newest elements */
+    size_t limit;  /* Bytes of elements to keep in memory */
+    size_t mem_bytes;
+    int fd;         /* Spill file, unlinked once created */
+    off_t file_end; /* Reset when no segment is left */
+    char *buf;      /* Holds one segment on its way to or from the file */
+    size_t buf_cap;
+    /* Counters */
+    size_t spills, spilled;   /* Segments and elements written */
+    size_t restores, restored; /* Segments and elements read back */
+    size_t on_disk;            /* Elements in the spill file */
+} tqueue_t;
+
+/*
+ * Create empty queue keeping up to limit bytes of elements in memory, with
+ * a spill file in directory dir, or in /tmp if dir is NULL.
+ * Return NULL if could not allocate space or create the file.
+ */
+tqueue_t *tq_new(const char *dir, size_t limit);
+
+/* Free all storage used by queue and close its spill file */
+void tq_free(tqueue_t *q);
+
+/*
+ * Attempt to insert element at tail of queue.
+ * Return true if successful.
+ * Return false if q is NULL or could not allocate space.
+ * Argument s points to the string to be stored.
+ * Failing to spill elements to the file leaves them in memory.
+ */
+bool tq_insert_tail(tqueue_t *q, char *s);
+
+/*
+ * Attempt to remove element from head of queue.
+ * Return true if successful.
+ * Return false if queue is NULL or empty, or could not read the spill file
+ * or allocate space for the elements read from it.
+ * If sp is non-NULL and an element is removed, copy the removed string to *sp
+ * (up to a maximum of bufsize-1 characters, plus a null terminator.)
+ */
+bool tq_remove_head(tqueue_t *q, char *sp, size_t bufsize);
+
+/*
+ * Return number of elements in queue, including those in the spill file.
+ * Return 0 if q is NULL or empty
+ */
+size_t tq_size(tqueue_t *q);
+
+#endif /* LAB0_TQUEUE_H */
@@ -0,0 +1,5 @@
+# Reverse the queue of trace-28 and drain part of it
+reverse
+rh zebra
+rh gerbil
+free
@@ -0,0 +1,5 @@
+# Sort the queue of trace-28 and drain part of it
+sort
+rh aardvark
+size
+free
@@ -0,0 +1,21 @@
+# Test of sortk
+option fail 0
+option malloc 0
+new
+it gerbil
+it bear
+it meerkat
+it dolphin
+it aardvark
+sortk 0
+size 5
+sortk 2
+rh aardvark
+rh bear
+sortk 5
+rh dolphin
+rh gerbil
+rh meerkat
+ih RAND 100000
+sortk 10
+free
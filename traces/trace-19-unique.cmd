@@ -0,0 +1,36 @@
+# Test of unique on unsorted, sorted and duplicate-heavy queues
+option fail 0
+option malloc 0
+new
+it gerbil
+it bear
+it gerbil
+it dolphin
+it bear
+unique
+rh gerbil
+rh bear
+rh dolphin
+it gerbil
+it bear
+it gerbil
+it dolphin
+it bear
+unique 0
+rh gerbil
+rh dolphin
+rh bear
+ih meerkat 3
+ih dolphin 2
+ih bear
+unique
+rh bear
+rh dolphin
+rh meerkat
+it gerbil 300000
+it bear 400000
+it gerbil 300000
+unique
+rh gerbil
+rh bear
+free
@@ -0,0 +1,39 @@
+# Test of hash index with find and rmv
+option fail 0
+option malloc 0
+new
+ih gerbil
+ih bear
+it dolphin
+index 1
+find bear 1
+find meerkat 0
+it meerkat
+it bear
+ih gerbil
+find meerkat 1
+rmv bear
+rmv meerkat
+find meerkat 0
+rmv bear
+find bear 0
+rh gerbil
+rh gerbil
+reverse
+sort
+rmv dolphin
+size
+it vulture 1000
+it squirrel
+ih gerbil 1000
+rmv squirrel
+find squirrel 0
+index 0
+find vulture 1
+rmv vulture
+index 1
+rmv vulture
+unique
+rh gerbil
+rh vulture
+free
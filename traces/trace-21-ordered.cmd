@@ -0,0 +1,38 @@
+# Test of ordered mode with is, range, rank and FIFO operations
+option fail 0
+option malloc 0
+new
+ih dolphin
+ih bear
+it gerbil
+ih meerkat
+ordered
+is cat
+is zebra
+is bear
+rank bear 0
+rank bison 2
+rank zz 7
+range bear dolphin
+rh bear
+rh bear
+it zebra
+rmv gerbil
+find gerbil 0
+rank zebra 3
+ih aardvark
+reverse
+is eagle
+rh aardvark
+rh cat
+rh dolphin
+rh eagle
+rh meerkat
+rh zebra
+rh zebra
+ordered 1
+is RAND 100000
+rank zzzzzzzzzz 100000
+ordered 0
+size
+free
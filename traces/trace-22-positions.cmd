@@ -0,0 +1,48 @@
+# Test of positional skip index with get, ia, ra and sample
+option fail 0
+option malloc 0
+new
+it dolphin
+it bear
+it gerbil
+get 1 bear
+positions
+ia 0 meerkat
+ia 4 zebra
+ia 2 cat
+get 0 meerkat
+get 2 cat
+get 5 zebra
+ra 3 bear
+reverse
+get 0 zebra
+get 4 meerkat
+sort
+get 0 cat
+get 3 meerkat
+ordered
+is bear
+get 0 bear
+ih vulture
+get 0 vulture
+ra 0 vulture
+rank dolphin 2
+ra 5 zebra
+ra 0 bear
+ra 0 cat
+ra 0 dolphin
+ra 0 gerbil
+ra 0 meerkat
+it RAND 200000
+ia 100000 squirrel
+get 100003
+get 100000 squirrel
+sample 10
+ra 100000 squirrel
+ih aardvark
+get 0 aardvark
+it zebra
+get 200001 zebra
+positions 0
+get 200001 zebra
+free
@@ -0,0 +1,37 @@
+# Test of front-coded compaction with lazy decoding
+option fail 0
+option malloc 0
+new
+ih gerbil
+ih bear
+it dolphin
+ih bearcat
+sort
+compact
+find dolphin 1
+rank dolphin 2
+it meerkat
+ih aardvark
+rh aardvark
+rh bear
+rh bearcat
+it zebra
+rh dolphin
+compact 0
+rh gerbil
+compact
+reverse
+rh zebra
+rh meerkat
+size
+compact
+size
+it RAND 300000
+sort
+compact
+it zzzzzzzzzzz
+unique
+find zzzzzzzzzzz 1
+rh
+compact
+free
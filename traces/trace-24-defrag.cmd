@@ -0,0 +1,29 @@
+# Test of defrag, alone and after sort, with indexes in sync
+option fail 0
+option malloc 0
+new
+ih gerbil
+ih bear
+it dolphin
+ih meerkat
+index 1
+positions
+sort
+defrag
+get 0 bear
+find dolphin 1
+rmv dolphin
+find dolphin 0
+option defrag 1
+it aardvark
+sort
+get 0 aardvark
+rh aardvark
+rh bear
+rh gerbil
+rh meerkat
+it RAND 300000
+sort
+defrag
+option defrag 0
+free
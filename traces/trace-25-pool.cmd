@@ -0,0 +1,6 @@
+# Test of compact index-linked queue against the regular queue
+option fail 0
+option malloc 0
+bench pool 1
+bench pool 1000
+bench pool 50000
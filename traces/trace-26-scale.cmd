@@ -0,0 +1,25 @@
+# Test of counts and indices past 2^32, which must not wrap, on a small queue
+option fail 0
+option malloc 0
+new
+it gerbil
+it dolphin
+it meerkat
+it bear
+sortk 4294967297
+rh bear
+rh dolphin
+rh gerbil
+rh meerkat
+it dolphin
+it gerbil
+option fail 10
+get 4294967296 none
+get 4294967297 none
+ra 4294967296 none
+ia 4294967297 none
+option fail 0
+size
+get 1 gerbil
+ra 0 dolphin
+free
@@ -0,0 +1,30 @@
+# Test of list traversals at several prefetch distances
+option fail 0
+option malloc 0
+option prefetch 0
+new
+ih dolphin
+it bear
+it gerbil
+reverse
+sort
+show
+option prefetch 1
+ih meerkat
+ih aardvark 3
+it zebra
+reverse
+sort
+show
+option prefetch 64
+it vulture
+reverse
+sort
+show
+free
+new
+ih RAND 1000
+sort
+reverse
+free
+bench prefetch 20000
@@ -0,0 +1,15 @@
+# Test of scripts run against a forked fixture
+option fail 0
+option malloc 0
+new
+ih dolphin 300000
+it gerbil 300000
+ih aardvark
+it zebra
+fixture save big
+fixture run big traces/fixtures/sort.cmd traces/fixtures/reverse.cmd
+fixture run big traces/fixtures/sort.cmd
+rh aardvark
+size
+free
+fixture drop big
@@ -0,0 +1,23 @@
+# Test of freeing queues in a background thread
+option fail 0
+option malloc 0
+option reclaim 1
+new
+ih dolphin 500000
+it gerbil 500000
+free
+new
+ih RAND 200000
+sort
+new
+it bear 3
+reverse
+rh bear
+sync
+free
+sync
+new
+ih meerkat 300000
+option reclaim 0
+free
+sync
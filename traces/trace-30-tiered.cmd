@@ -0,0 +1,26 @@
+# Test of tiered queue spilling to and restoring from its file
+option fail 0
+option malloc 0
+tnew 65536
+tit dolphin 5000
+tit RAND 20000
+tit gerbil
+tstat
+trh dolphin 5000
+trh
+tstat
+trh
+trh
+tit meerkat 3000
+trh RAND 19997
+trh gerbil
+trh meerkat 3000
+tstat
+tit bear
+trh bear
+tfree
+tnew 0
+tit zebra 100000
+trh zebra 50000
+tstat
+tfree
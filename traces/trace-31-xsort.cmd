@@ -0,0 +1,15 @@
+# Test of external sort with runs merged in several passes
+option fail 0
+option malloc 0
+gen /tmp/qtest.xsort.in 2000000 3
+option xmem 256
+xsort /tmp/qtest.xsort.in /tmp/qtest.xsort.out
+new
+it zzzz
+xsort /tmp/qtest.xsort.out
+rh zzzz
+option xmem 65536
+new
+xsort /tmp/qtest.xsort.in
+size
+free
@@ -0,0 +1,19 @@
+# Test of merging sorted queues, with more than one level of loser trees
+option fail 0
+option malloc 0
+new
+merge 3 0
+size
+ih dolphin
+ih bear
+ih gerbil
+merge 5 100
+size
+merge 200 50
+size
+free
+new
+it RAND 100000
+merge 15 20000
+size
+free
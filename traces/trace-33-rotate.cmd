@@ -0,0 +1,27 @@
+# Test of splitting and concatenating queues
+option fail 0
+option malloc 0
+new
+rotate 0
+ih dolphin
+ih bear
+ih gerbil
+it meerkat
+it bear
+rotate 1
+rh bear
+rh dolphin
+rotate 3
+rh meerkat
+rotate 0
+rotate 1
+rh gerbil
+rh bear
+size
+free
+new
+it RAND 1000000
+rotate 500000
+rotate 1000000
+size
+free
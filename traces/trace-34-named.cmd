@@ -0,0 +1,37 @@
+# Test of named queues, and of operations taking two queues
+option fail 0
+option malloc 0
+new
+ih dolphin
+ih bear
+new a
+it gerbil
+it meerkat
+ih@main eagle
+it@main vulture
+rh gerbil
+use main
+rh eagle
+concat a
+size
+rh bear
+rh dolphin
+rh vulture
+rh meerkat
+size@a
+it RAND 100
+split 40 b
+size
+size@b
+rh@b
+concat b
+size
+new c 1000
+it RAND 10
+ih@c7 horse
+rh@c7 horse
+stats
+use a
+free
+free@main
+stats
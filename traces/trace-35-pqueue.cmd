@@ -0,0 +1,23 @@
+# Test of priority queue, removing the smallest strings first
+option fail 0
+option malloc 0
+pqnew
+pqi gerbil
+pqi bear
+pqi dolphin
+pqi bear
+pqrm bear
+pqrm bear
+pqi aardvark
+pqrm aardvark 2
+pqrm gerbil
+pqi RAND 100000
+pqi meerkat 1000
+pqrm RAND 60000
+pqfree
+pqnew
+pqi RAND 50000
+pqrm RAND 50000
+pqi zebra
+pqrm zebra
+pqfree
@@ -0,0 +1,46 @@
+# Test of elements expiring by their deadlines
+option fail 0
+option malloc 0
+new
+tick 100 0
+itt dolphin 10
+it bear
+itt gerbil 5
+itt meerkat 5000
+ih vulture
+itt eagle 300000
+tick 4 0
+tick 1 1
+tick 5 1
+rh vulture
+rh bear
+tick 4989 0
+tick 1 1
+size
+index 1
+itt cow 70
+it horse
+itt fox 64
+itt zebra 4096
+tick 64 1
+tick 6 1
+find horse
+tick 290000 1
+tick 100000 1
+rh horse
+size
+itt RAND 1 100000
+it lion
+itt RAND 2 100000
+tick 2 200000
+rh lion
+itt ant 10
+it ant
+unique 0
+itt bee 20
+itt bee 10
+unique
+tick 10 0
+tick 10 1
+rh ant
+free
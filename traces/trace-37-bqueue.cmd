@@ -0,0 +1,5 @@
+# Test of bounded queue shared by producer and consumer threads
+option fail 0
+option malloc 0
+bench bq 20000 16
+bench bq 5000 1
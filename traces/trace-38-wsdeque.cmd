@@ -0,0 +1,5 @@
+# Test of work stealing between threads over Chase-Lev deques
+option fail 0
+option malloc 0
+bench ws 4 20000
+bench ws 3 2000
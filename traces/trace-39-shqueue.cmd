@@ -0,0 +1,21 @@
+# Test of queue in shared memory, attached again and shared by processes
+option fail 0
+option malloc 0
+snew /lab0-trace-39 65536
+sit dolphin
+sit bear
+sit RAND 100
+sstat 102
+sdetach
+sattach /lab0-trace-39
+srh dolphin
+srh bear
+srh RAND 100
+sstat 0
+sit RAND 2000
+sstat 2000
+srh RAND 2000
+sstat 0
+sdetach
+sunlink /lab0-trace-39
+bench shm 2 20000
@@ -0,0 +1,105 @@
+# Test of write-ahead log, recovering queues after closes and checkpoints
+option fail 0
+option malloc 0
+wal unlink /tmp/qtest-trace-40.wal
+new
+wal open /tmp/qtest-trace-40.wal
+ih dolphin
+it bear
+it gerbil
+reverse
+sort
+it zebra 3
+itt mole 100
+tick 50
+rh bear
+wal sync
+free
+new
+wal open /tmp/qtest-trace-40.wal
+rh dolphin
+rh gerbil
+tick 60 1
+it cat
+wal close
+free
+new
+wal open /tmp/qtest-trace-40.wal
+rh zebra
+rh zebra
+rh zebra
+rh cat
+size 0
+wal close
+free
+wal unlink /tmp/qtest-trace-40.wal
+new
+wal open /tmp/qtest-trace-40.wal
+it e
+it c
+it a
+it c
+it d
+it b
+unique
+sortk 2
+wal checkpoint
+ia 1 f
+ra 0 a
+rmv d
+rotate 2
+is bb
+wal stats
+wal close
+free
+new
+wal open /tmp/qtest-trace-40.wal
+rh b
+rh bb
+rh c
+rh e
+rh f
+size 0
+wal close
+free
+wal unlink /tmp/qtest-trace-40.wal
+new
+wal open /tmp/qtest-trace-40.wal
+it a
+it b
+it a
+index 1
+rmv b
+rmv a
+wal close
+free
+new
+wal open /tmp/qtest-trace-40.wal
+rh a
+it a
+it b
+it a
+it c
+index 1
+rmv a
+wal close
+free
+new
+wal open /tmp/qtest-trace-40.wal
+rh a
+rh b
+rh c
+itt x 10
+it y
+index 1
+tick 10 1
+wal close
+free
+new
+wal open /tmp/qtest-trace-40.wal
+rh y
+size 0
+wal close
+free
+wal unlink /tmp/qtest-trace-40.wal
+bench wal 20000
@@ -0,0 +1,53 @@
+# Test of shipping queue changes to forked followers, which must catch up
+option fail 0
+option malloc 0
+new
+it RAND 500
+ih dolphin
+repl serve /tmp/qtest-trace-41.sock fork
+it bear 3
+reverse
+sort
+rh
+itt mole 100
+tick 150 1
+ia 2 gerbil
+rmv gerbil
+it zebra
+unique
+repl stop
+size 502
+wal unlink /tmp/qtest-trace-41.wal
+free
+new
+wal open /tmp/qtest-trace-41.wal
+it cat 2
+repl serve /tmp/qtest-trace-41.sock fork
+ih ant
+rotate 1
+is bee
+it RAND 2000
+free
+new
+wal open /tmp/qtest-trace-41.wal
+rh ant
+size 2003
+wal close
+wal unlink /tmp/qtest-trace-41.wal
+free
+new
+it a
+it b
+it a
+it c
+repl serve /tmp/qtest-trace-41.sock fork
+index 1
+rmv a
+rmv b
+it a
+rmv a
+rmv a
+repl stop
+rh c
+free
+bench repl 20000
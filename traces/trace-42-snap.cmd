@@ -0,0 +1,49 @@
+# Test of snapshots sharing elements while the queue keeps changing
+option fail 0
+option malloc 0
+new
+ih dolphin
+ih bear
+ih gerbil
+it meerkat
+snap take
+show
+snap show 0
+ih zebra
+it cat
+rh zebra
+rh gerbil
+snap take
+ia 1 vulture
+ra 3
+snap check
+is ant
+rotate 2
+reverse
+sort
+snap show 0
+snap show 1
+snap check
+it RAND 1000
+snap take
+free
+snap check
+snap free 0
+snap check
+snap free
+new
+it RAND 50000
+snap take
+rh
+it fox
+snap check
+free
+snap free
+new
+ih gxy
+snap take
+snap free
+rotate 1
+rh gxy
+free
+bench snap 20000
@@ -0,0 +1,14 @@
+# Test of over 2^32 insertions and removals on a queue kept at 16 elements
+option fail 0
+option malloc 0
+option timeout 3600
+new
+it gerbil
+option keep 16
+ih dolphin 2200000000
+size
+rh dolphin
+option keep 0
+ra 14 dolphin
+size
+free
@@ -0,0 +1,924 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "harness.h"
+#include "wal.h"
+
+#define WAL_MAGIC 0x4c415751  /* "QWAL" */
+#define SNAP_MAGIC 0x504e5351 /* "QSNP" */
+#define WAL_VERSION 1
+
+/* Records of a snapshot go in frames of about this many bytes */
+#define SNAP_FRAME (1 << 20)
+
+/* Latencies are counted in buckets 1/HIST_SUB apart on a log scale */
+#define HIST_SUB 16
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+/* First bytes of a log */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t gen; /* One more than that of the log it replaced */
+} wal_header_t;
+
+/* First bytes of a snapshot */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t gen;    /* Of the log holding the records which follow it */
+    uint64_t offset; /* Where those records start in that log */
+} snap_header_t;
+
+/* Each frame starts with the length and checksum of the records it holds */
+typedef struct {
+    uint32_t len;
+    uint32_t sum;
+} frame_header_t;
+
+/* Each shipped frame starts with this, and the follower acknowledges it */
+typedef struct {
+    uint32_t kind; /* SHIP_RECORDS or SHIP_END */
+    uint32_t len;
+    uint64_t lsn;   /* Of the last record shipped so far */
+    uint64_t stamp; /* When the oldest record got appended, or the digest */
+} ship_header_t;
+
+typedef struct {
+    uint64_t lsn;    /* Of the last record applied */
+    uint64_t digest; /* Of the queue of the follower, after SHIP_END */
+    uint64_t final;  /* Whether this answers SHIP_END */
+} ship_ack_t;
+
+#define SHIP_RECORDS 1
+#define SHIP_END 2
+
+/* Records waiting for a commit, with the time each was appended */
+typedef struct {
+    unsigned char *buf;
+    size_t len, cap;
+    uint64_t *stamps;
+    size_t cnt, stamps_cap;
+} wal_batch_t;
+
+struct WAL {
+    char *path;
+    int fd;
+    uint64_t gen;
+    uint64_t size; /* Bytes of the log */
+    long interval_us;
+    size_t batch;
+    pthread_mutex_t lock;
+    pthread_cond_t work; /* Signaled on the first record of a batch */
+    pthread_cond_t done; /* Broadcast when records became durable */
+    wal_batch_t cur, out; /* Being appended to, and being written */
+    uint64_t appended, durable; /* Sequence numbers */
+    bool flush, stop, failed;
+    pthread_t thread;
+    int ship; /* Socket of the follower, or -1 */
+    ship_ack_t ack;
+    size_t ack_len; /* Bytes of ack received so far */
+    /* Counters */
+    uint64_t commits, bytes, recovered, opened;
+    uint64_t shipped, acked, max_lag;
+    uint64_t hist[HIST_BUCKETS];
+};
+
+/* Kinds of records which have an argument, and which have a string */
+#define HAS_ARG(op)                                                         \
+    ((op) == WAL_REMOVE_HEAD || (op) == WAL_SORT_TOPK ||                    \
+     (op) == WAL_UNIQUE || (op) == WAL_REMOVE_AT || (op) == WAL_INSERT_AT || \
+     (op) == WAL_INSERT_TTL || (op) == WAL_EXPIRE)
+#define HAS_STR(op)                                                    \
+    ((op) == WAL_INSERT_HEAD || (op) == WAL_INSERT_TAIL ||             \
+     (op) == WAL_REMOVE_VALUE || (op) == WAL_INSERT_AT ||              \
+     (op) == WAL_INSERT_SORTED || (op) == WAL_INSERT_TTL)
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* FNV-1a hash of the len bytes at p */
+static uint32_t checksum(const unsigned char *p, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+    for (const char *p = buf; len > 0;) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Send len bytes to socket fd, which may be closed without raising SIGPIPE */
+static bool send_all(int fd, const void *buf, size_t len)
+{
+    for (const char *p = buf; len > 0;) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Receive len bytes from socket fd, return false if it got closed before */
+static bool recv_all(int fd, void *buf, size_t len)
+{
+    for (char *p = buf; len > 0;) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Read len bytes at offset off, return false if fewer are there */
+static bool pread_all(int fd, void *buf, size_t len, uint64_t off)
+{
+    for (char *p = buf; len > 0;) {
+        ssize_t n = pread(fd, p, len, off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        off += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Write the len bytes of records at buf as one frame */
+static bool write_frame(int fd, const unsigned char *buf, size_t len)
+{
+    frame_header_t h = {len, checksum(buf, len)};
+    return write_all(fd, &h, sizeof(h)) && write_all(fd, buf, len);
+}
+
+/* Ship the len bytes of records at buf, the last one numbered lsn */
+static bool ship_frame(int fd,
+                       const unsigned char *buf,
+                       size_t len,
+                       uint64_t lsn,
+                       uint64_t stamp)
+{
+    ship_header_t h = {SHIP_RECORDS, len, lsn, stamp};
+    return send_all(fd, &h, sizeof(h)) && send_all(fd, buf, len);
+}
+
+/*
+ * Take the acknowledgements the follower of w sent so far, or wait for the
+ * next one if wait is true.
+ * Return false if the follower went away.
+ */
+static bool take_acks(wal_t *w, bool wait)
+{
+    for (;;) {
+        ssize_t n = recv(w->ship, (char *) &w->ack + w->ack_len,
+                         sizeof(ship_ack_t) - w->ack_len,
+                         wait ? 0 : MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && !wait && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (n <= 0)
+            return false;
+        w->ack_len += n;
+        if (w->ack_len == sizeof(ship_ack_t)) {
+            w->ack_len = 0;
+            w->acked = w->ack.lsn;
+            if (wait)
+                return true;
+        }
+    }
+}
+
+/* Make batch hold at least len more bytes and one more record */
+static bool batch_reserve(wal_batch_t *b, size_t len)
+{
+    if (b->len + len > b->cap) {
+        size_t cap = b->cap ? 2 * b->cap : 4096;
+        while (cap < b->len + len)
+            cap *= 2;
+        unsigned char *buf = realloc(b->buf, cap);
+        if (!buf)
+            return false;
+        b->buf = buf;
+        b->cap = cap;
+    }
+    if (b->cnt == b->stamps_cap) {
+        size_t cap = b->stamps_cap ? 2 * b->stamps_cap : 256;
+        uint64_t *stamps = realloc(b->stamps, cap * sizeof(uint64_t));
+        if (!stamps)
+            return false;
+        b->stamps = stamps;
+        b->stamps_cap = cap;
+    }
+    return true;
+}
+
+/* Encode a record at p, which has room for it, return its length */
+static size_t encode(unsigned char *p, wal_op_t op, long arg, const char *s)
+{
+    size_t n = 0;
+    p[n++] = op;
+    if (HAS_ARG(op)) {
+        /* Zigzag, so that small negative arguments stay short too */
+        uint64_t v = ((uint64_t) arg << 1) ^ (uint64_t) (arg >> 63);
+        for (; v >= 0x80; v >>= 7)
+            p[n++] = (v & 0x7f) | 0x80;
+        p[n++] = v;
+    }
+    if (HAS_STR(op)) {
+        size_t len = strlen(s) + 1;
+        memcpy(p + n, s, len);
+        n += len;
+    }
+    return n;
+}
+
+/* Redo one record on q, return false if the queue function failed */
+static bool apply(queue_t *q, wal_op_t op, long arg, char *s)
+{
+    switch (op) {
+    case WAL_INSERT_HEAD:
+        return q_insert_head(q, s);
+    case WAL_INSERT_TAIL:
+        return q_insert_tail(q, s);
+    case WAL_REMOVE_HEAD:
+        for (long i = 0; i < arg; i++)
+            if (!q_remove_head(q, NULL, 0))
+                return false;
+        return true;
+    case WAL_REVERSE:
+        q_reverse(q);
+        return true;
+    case WAL_SORT:
+        q_sort(q);
+        return true;
+    case WAL_SORT_TOPK:
+        return q_sort_topk(q, arg);
+    case WAL_UNIQUE:
+        return q_unique(q, arg) >= 0;
+    case WAL_REMOVE_VALUE:
+        return q_remove_value(q, s);
+    case WAL_REMOVE_AT:
+        return q_remove_at(q, arg, NULL, 0);
+    case WAL_INSERT_AT:
+        return q_insert_at(q, arg, s);
+    case WAL_INSERT_SORTED:
+        return q_insert_sorted(q, s);
+    case WAL_INSERT_TTL:
+        return q_insert_tail_ttl(q, s, arg);
+    case WAL_EXPIRE:
+        q_expire(q, arg);
+        return true;
+    case WAL_DROP_TTL: {
+        /* Splitting off no elements drops the deadlines all the same */
+        queue_t *none = q_split(q, 0);
+        bool ok = none != NULL;
+        q_free(none);
+        return ok;
+    }
+    }
+    return false;
+}
+
+/*
+ * Redo the records of the len bytes at buf on q, adding their number to
+ * *cnt. Return false if they are malformed or could not be redone.
+ */
+static bool apply_records(queue_t *q, unsigned char *buf, size_t len,
+                          uint64_t *cnt)
+{
+    for (size_t n = 0; n < len; (*cnt)++) {
+        wal_op_t op = buf[n++];
+        long arg = 0;
+        if (HAS_ARG(op)) {
+            uint64_t v = 0;
+            int shift = 0;
+            do {
+                if (n == len || shift > 63)
+                    return false;
+                v |= (uint64_t) (buf[n] & 0x7f) << shift;
+                shift += 7;
+            } while (buf[n++] & 0x80);
+            arg = (long) (v >> 1) ^ -(long) (v & 1);
+        }
+        char *s = NULL;
+        if (HAS_STR(op)) {
+            s = (char *) buf + n;
+            size_t slen = strnlen(s, len - n);
+            if (slen == len - n)
+                return false;
+            n += slen + 1;
+        }
+        if (!apply(q, op, arg, s))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Redo the records of the frames of fd from offset off on q, stopping at
+ * the first incomplete or corrupt frame, whose offset is stored in *end.
+ * Return false if records could not be redone or space allocated.
+ */
+static bool replay(int fd, uint64_t off, queue_t *q, uint64_t *cnt,
+                   uint64_t *end)
+{
+    struct stat st;
+    if (fstat(fd, &st))
+        return false;
+    frame_header_t h;
+    while (pread_all(fd, &h, sizeof(h), off) &&
+           h.len <= st.st_size - off - sizeof(h)) {
+        unsigned char *buf = malloc(h.len ? h.len : 1);
+        if (!buf)
+            return false;
+        bool whole = pread_all(fd, buf, h.len, off + sizeof(h)) &&
+                     checksum(buf, h.len) == h.sum;
+        bool ok = !whole || apply_records(q, buf, h.len, cnt);
+        free(buf);
+        if (!ok)
+            return false;
+        if (!whole)
+            break;
+        off += sizeof(h) + h.len;
+    }
+    *end = off;
+    return true;
+}
+
+/* Return a copy of path with suffix appended */
+static char *path_with(const char *path, const char *suffix)
+{
+    char *p = malloc(strlen(path) + strlen(suffix) + 1);
+    if (p) {
+        strcpy(p, path);
+        strcat(p, suffix);
+    }
+    return p;
+}
+
+/* Sync the directory holding path, so that renaming into it is durable */
+static void sync_dir(const char *path)
+{
+    char *dir = path_with(path, "");
+    if (!dir)
+        return;
+    char *slash = strrchr(dir, '/');
+    if (slash)
+        slash[slash == dir] = '\0';
+    int fd = open(slash ? dir : ".", O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+/*
+ * Write a new log of generation gen, and rename it over path.
+ * Return its descriptor, or -1 if could not.
+ */
+static int create_log(const char *path, uint64_t gen)
+{
+    char *tmp = path_with(path, ".tmp");
+    if (!tmp)
+        return -1;
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    wal_header_t h = {WAL_MAGIC, WAL_VERSION, gen};
+    if (fd >= 0 && (!write_all(fd, &h, sizeof(h)) || fsync(fd) ||
+                    rename(tmp, path))) {
+        close(fd);
+        unlink(tmp);
+        fd = -1;
+    }
+    free(tmp);
+    if (fd >= 0)
+        sync_dir(path);
+    return fd;
+}
+
+/*
+ * Replay the snapshot and the log at path into q, truncating any incomplete
+ * frame at the end of the log, which a crash left behind.
+ * Return false if they are corrupt, or could not be read or redone.
+ */
+static bool recover(wal_t *w, queue_t *q)
+{
+    bool ok = true, snap = false;
+    snap_header_t sh;
+    char *snap_path = path_with(w->path, ".snap");
+    if (!snap_path)
+        return false;
+    int fd = open(snap_path, O_RDONLY);
+    free(snap_path);
+    if (fd >= 0) {
+        uint64_t end;
+        snap = true;
+        ok = pread_all(fd, &sh, sizeof(sh), 0) && sh.magic == SNAP_MAGIC &&
+             sh.version == WAL_VERSION &&
+             replay(fd, sizeof(sh), q, &w->recovered, &end);
+        close(fd);
+    }
+
+    w->fd = open(w->path, O_RDWR);
+    if (!ok || (w->fd < 0 && errno != ENOENT))
+        return false;
+    if (w->fd < 0) {
+        w->gen = snap ? sh.gen + 1 : 1;
+        w->fd = create_log(w->path, w->gen);
+        w->size = sizeof(wal_header_t);
+        return w->fd >= 0;
+    }
+
+    wal_header_t h;
+    if (!pread_all(w->fd, &h, sizeof(h), 0) || h.magic != WAL_MAGIC ||
+        h.version != WAL_VERSION)
+        return false;
+    uint64_t start = sizeof(h);
+    if (snap && h.gen == sh.gen)
+        /* A crash came before the log got started over */
+        start = sh.offset;
+    else if (snap && h.gen != sh.gen + 1)
+        return false;
+    w->gen = h.gen;
+    if (!replay(w->fd, start, q, &w->recovered, &w->size))
+        return false;
+    struct stat st;
+    if (fstat(w->fd, &st) || (st.st_size > (off_t) w->size &&
+                              (ftruncate(w->fd, w->size) || fsync(w->fd))))
+        return false;
+    return lseek(w->fd, w->size, SEEK_SET) >= 0;
+}
+
+/* Count cnt latencies of ns nanoseconds into hist */
+static void hist_add(uint64_t *hist, uint64_t ns, uint64_t cnt)
+{
+    size_t k = ns;
+    if (ns >= HIST_SUB) {
+        int e = 63 - __builtin_clzll(ns);
+        k = (e - 3) * HIST_SUB + ((ns >> (e - 4)) & (HIST_SUB - 1));
+    }
+    hist[k] += cnt;
+}
+
+/* Smallest latency of bucket k, in microseconds */
+static double bucket_us(size_t k)
+{
+    if (k < HIST_SUB)
+        return k / 1e3;
+    int e = k / HIST_SUB + 3;
+    return (double) ((uint64_t) (HIST_SUB + k % HIST_SUB) << (e - 4)) / 1e3;
+}
+
+/* Fill the latency percentiles of st from hist */
+static void hist_percentiles(const uint64_t *hist, wal_stats_t *st)
+{
+    uint64_t total = 0;
+    for (size_t k = 0; k < HIST_BUCKETS; k++)
+        total += hist[k];
+    double *ps[] = {&st->p50, &st->p90, &st->p99, &st->p999, &st->max};
+    double fractions[] = {0.5, 0.9, 0.99, 0.999, 1};
+    uint64_t seen = 0;
+    for (size_t k = 0, i = 0; total && k < HIST_BUCKETS; k++) {
+        seen += hist[k];
+        for (; i < 5 && seen >= fractions[i] * total; i++)
+            *ps[i] = bucket_us(k);
+    }
+}
+
+/*
+ * Lock w from the caller of the log, holding off the time limit meanwhile,
+ * as jumping out would leave it locked. The thread of the log blocks signals.
+ */
+static void wal_lock(wal_t *w)
+{
+    exception_hold();
+    pthread_mutex_lock(&w->lock);
+}
+
+static void wal_unlock(wal_t *w)
+{
+    pthread_mutex_unlock(&w->lock);
+    exception_release();
+}
+
+/* Write out batches once they are full, old enough or to be flushed */
+static void *wal_main(void *arg)
+{
+    wal_t *w = arg;
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->cur.cnt && !w->stop)
+            pthread_cond_wait(&w->work, &w->lock);
+        if (!w->cur.cnt)
+            break;
+        uint64_t deadline = w->cur.stamps[0] + w->interval_us * 1000;
+        struct timespec ts = {deadline / 1000000000, deadline % 1000000000};
+        while (!w->stop && !w->flush && w->cur.cnt < w->batch &&
+               pthread_cond_timedwait(&w->work, &w->lock, &ts) != ETIMEDOUT)
+            ;
+        wal_batch_t b = w->out;
+        w->out = w->cur;
+        w->cur = b;
+        uint64_t end = w->appended;
+        int ship = w->ship;
+        w->flush = false;
+        pthread_mutex_unlock(&w->lock);
+
+        bool ok = w->fd < 0 || (write_frame(w->fd, w->out.buf, w->out.len) &&
+                                !fdatasync(w->fd));
+        uint64_t t = now_ns();
+        /* The follower gets records once they are durable here */
+        bool shipped = ship < 0 || ship_frame(ship, w->out.buf, w->out.len,
+                                              end, w->out.stamps[0]);
+
+        pthread_mutex_lock(&w->lock);
+        for (size_t i = 0; i < w->out.cnt; i++)
+            hist_add(w->hist, t > w->out.stamps[i] ? t - w->out.stamps[i] : 0,
+                     1);
+        w->failed = w->failed || !ok;
+        if (ship >= 0 && shipped && take_acks(w, false)) {
+            w->shipped = end;
+            if (end - w->acked > w->max_lag)
+                w->max_lag = end - w->acked;
+        } else if (ship >= 0) {
+            /* The follower went away, which does not fail the log */
+            close(ship);
+            w->ship = -1;
+        }
+        w->size += sizeof(frame_header_t) + w->out.len;
+        w->bytes += sizeof(frame_header_t) + w->out.len;
+        w->commits++;
+        w->durable = end;
+        w->out.len = w->out.cnt = 0;
+        pthread_cond_broadcast(&w->done);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+wal_t *wal_open(const char *path, queue_t *q, long interval_us, size_t batch)
+{
+    if (!q || (path && q_size(q)) || interval_us < 0 || !batch)
+        return NULL;
+    wal_t *w = malloc(sizeof(wal_t));
+    if (!w)
+        return NULL;
+    memset(w, 0, sizeof(wal_t));
+    w->fd = -1;
+    w->ship = -1;
+    w->path = path ? path_with(path, "") : NULL;
+    if (path && (!w->path || !recover(w, q))) {
+        if (w->fd >= 0)
+            close(w->fd);
+        free(w->path);
+        free(w);
+        return NULL;
+    }
+    w->interval_us = interval_us;
+    w->batch = batch;
+    w->opened = now_ns();
+
+    /* Batches become due on the monotonic clock */
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->work, &attr);
+    pthread_cond_init(&w->done, NULL);
+    pthread_condattr_destroy(&attr);
+
+    /* Signals are for the main thread */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&w->thread, NULL, wal_main, w);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err) {
+        if (w->fd >= 0)
+            close(w->fd);
+        free(w->path);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+bool wal_close(wal_t *w)
+{
+    if (!w)
+        return true;
+    wal_lock(w);
+    w->stop = true;
+    pthread_cond_signal(&w->work);
+    wal_unlock(w);
+    pthread_join(w->thread, NULL);
+    bool ok = !w->failed;
+    if (w->fd >= 0)
+        close(w->fd);
+    if (w->ship >= 0)
+        close(w->ship);
+    pthread_cond_destroy(&w->work);
+    pthread_cond_destroy(&w->done);
+    pthread_mutex_destroy(&w->lock);
+    free(w->cur.buf);
+    free(w->cur.stamps);
+    free(w->out.buf);
+    free(w->out.stamps);
+    free(w->path);
+    free(w);
+    return ok;
+}
+
+uint64_t wal_append(wal_t *w, wal_op_t op, long arg, const char *s)
+{
+    size_t len = 1 + 10 + (HAS_STR(op) ? strlen(s) + 1 : 0);
+    wal_lock(w);
+    uint64_t lsn = 0;
+    if (!w->failed && batch_reserve(&w->cur, len)) {
+        w->cur.len += encode(w->cur.buf + w->cur.len, op, arg, s);
+        w->cur.stamps[w->cur.cnt++] = now_ns();
+        lsn = ++w->appended;
+        /* The thread waits for the first record, then for the batch */
+        if (w->cur.cnt == 1 || w->cur.cnt == w->batch)
+            pthread_cond_signal(&w->work);
+    } else {
+        w->failed = true;
+    }
+    wal_unlock(w);
+    return lsn;
+}
+
+bool wal_commit(wal_t *w, uint64_t lsn, bool now)
+{
+    wal_lock(w);
+    if (now && w->durable < lsn) {
+        w->flush = true;
+        pthread_cond_signal(&w->work);
+    }
+    while (w->durable < lsn && !w->failed)
+        pthread_cond_wait(&w->done, &w->lock);
+    bool ok = !w->failed;
+    wal_unlock(w);
+    return ok;
+}
+
+/*
+ * State of q_foreach writing a snapshot as frames to fd, or shipping them
+ * as of record lsn if ship is true
+ */
+typedef struct {
+    unsigned char *buf;
+    size_t len, cap;
+    int fd;
+    bool ship;
+    uint64_t lsn;
+    bool ok;
+} snap_writer_t;
+
+/* Write out the frame built so far */
+static void snap_flush(snap_writer_t *sw)
+{
+    if (sw->ok && sw->len)
+        sw->ok = sw->ship ? ship_frame(sw->fd, sw->buf, sw->len, sw->lsn, 0)
+                          : write_frame(sw->fd, sw->buf, sw->len);
+    sw->len = 0;
+}
+
+/* Append a record inserting s at tail to the frame being built */
+static void snap_visit(const char *s, void *arg)
+{
+    snap_writer_t *sw = arg;
+    size_t len = strlen(s) + 2;
+    if (!sw->ok)
+        return;
+    if (sw->len + len > sw->cap) {
+        snap_flush(sw);
+        if (len > sw->cap) {
+            size_t cap = len > SNAP_FRAME ? len : SNAP_FRAME;
+            unsigned char *buf = realloc(sw->buf, cap);
+            if (!buf) {
+                sw->ok = false;
+                return;
+            }
+            sw->buf = buf;
+            sw->cap = cap;
+        }
+    }
+    sw->len += encode(sw->buf + sw->len, WAL_INSERT_TAIL, 0, s);
+}
+
+bool wal_checkpoint(wal_t *w, queue_t *q)
+{
+    if (!w || !w->path || !q || q->ttl || !wal_commit(w, w->appended, true))
+        return false;
+    char *snap_path = path_with(w->path, ".snap");
+    char *tmp = path_with(w->path, ".snap.tmp");
+    snap_writer_t sw = {NULL, 0, 0, -1, false, 0, true};
+    if (snap_path && tmp)
+        sw.fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    /* No records get appended meanwhile, but the lock keeps the thread off */
+    wal_lock(w);
+    snap_header_t h = {SNAP_MAGIC, WAL_VERSION, w->gen, w->size};
+    sw.ok = sw.fd >= 0 && write_all(sw.fd, &h, sizeof(h));
+    sw.ok = sw.ok && q_foreach(q, snap_visit, &sw) >= 0 && sw.ok;
+    snap_flush(&sw);
+    sw.ok = sw.ok && !fsync(sw.fd) && !rename(tmp, snap_path);
+    if (sw.fd >= 0)
+        close(sw.fd);
+    if (sw.ok) {
+        sync_dir(snap_path);
+        int fd = create_log(w->path, w->gen + 1);
+        if (fd >= 0) {
+            close(w->fd);
+            w->fd = fd;
+            w->gen++;
+            w->size = sizeof(wal_header_t);
+        } else {
+            /* The snapshot covers the old log, which keeps on growing */
+            w->failed = lseek(w->fd, w->size, SEEK_SET) < 0;
+        }
+    } else if (tmp) {
+        unlink(tmp);
+    }
+    wal_unlock(w);
+    free(sw.buf);
+    free(snap_path);
+    free(tmp);
+    return sw.ok;
+}
+
+void wal_stats(wal_t *w, wal_stats_t *st)
+{
+    memset(st, 0, sizeof(wal_stats_t));
+    if (!w)
+        return;
+    wal_lock(w);
+    st->records = w->appended;
+    st->commits = w->commits;
+    st->bytes = w->bytes;
+    st->recovered = w->recovered;
+    st->shipped = w->shipped;
+    st->acked = w->acked;
+    st->max_lag = w->max_lag;
+    st->seconds = (now_ns() - w->opened) / 1e9;
+    hist_percentiles(w->hist, st);
+    wal_unlock(w);
+}
+
+bool wal_unlink(const char *path)
+{
+    char *snap_path = path_with(path, ".snap");
+    bool found = !unlink(path);
+    if (snap_path) {
+        found = !unlink(snap_path) || found;
+        free(snap_path);
+    }
+    return found;
+}
+
+/* Hash the string s into the digest at arg */
+static void digest_visit(const char *s, void *arg)
+{
+    uint64_t *h = arg;
+    do {
+        *h ^= (unsigned char) *s;
+        *h *= 1099511628211ULL;
+    } while (*s++);
+}
+
+/* Return a FNV-1a hash of the strings of q in order */
+static uint64_t queue_digest(queue_t *q)
+{
+    uint64_t h = 14695981039346656037ULL;
+    q_foreach(q, digest_visit, &h);
+    return h;
+}
+
+bool wal_ship(wal_t *w, int fd, queue_t *q)
+{
+    if (!w || w->ship >= 0 || !q || q->ttl ||
+        !wal_commit(w, w->appended, true))
+        return false;
+    /* The thread is idle, and the lock keeps it so */
+    wal_lock(w);
+    snap_writer_t sw = {NULL, 0, 0, fd, true, w->appended, true};
+    sw.ok = q_foreach(q, snap_visit, &sw) >= 0 && sw.ok;
+    snap_flush(&sw);
+    free(sw.buf);
+    if (sw.ok) {
+        w->ship = fd;
+        w->ack_len = 0;
+        w->shipped = w->acked = w->appended;
+        w->max_lag = 0;
+    }
+    wal_unlock(w);
+    return sw.ok;
+}
+
+bool wal_unship(wal_t *w, queue_t *q)
+{
+    if (!w || !q || !wal_commit(w, w->appended, true))
+        return false;
+    /* The thread is idle, and the lock keeps it so */
+    wal_lock(w);
+    bool ok = w->ship >= 0;
+    if (ok) {
+        ship_header_t h = {SHIP_END, 0, w->appended, queue_digest(q)};
+        ok = send_all(w->ship, &h, sizeof(h));
+        /* The follower answers the end with the digest of its queue */
+        do
+            ok = ok && take_acks(w, true);
+        while (ok && !w->ack.final);
+        ok = ok && w->ack.digest == h.stamp;
+        close(w->ship);
+        w->ship = -1;
+    }
+    wal_unlock(w);
+    return ok;
+}
+
+bool wal_follow(int fd, queue_t *q, wal_stats_t *st)
+{
+    memset(st, 0, sizeof(wal_stats_t));
+    if (!q || q_size(q))
+        return false;
+    uint64_t *hist = malloc(HIST_BUCKETS * sizeof(uint64_t));
+    if (hist)
+        memset(hist, 0, HIST_BUCKETS * sizeof(uint64_t));
+    unsigned char *buf = NULL;
+    size_t cap = 0;
+    uint64_t start = now_ns();
+    ship_header_t h;
+    bool ok = hist != NULL;
+    while (ok && (ok = recv_all(fd, &h, sizeof(h))) && h.kind == SHIP_RECORDS) {
+        if (h.len > cap) {
+            unsigned char *bigger = realloc(buf, h.len);
+            if (!(ok = bigger != NULL))
+                break;
+            buf = bigger;
+            cap = h.len;
+        }
+        uint64_t before = st->records;
+        ok = recv_all(fd, buf, h.len) &&
+             apply_records(q, buf, h.len, &st->records);
+        /* Records of a frame count as late as the oldest one */
+        uint64_t t = now_ns();
+        if (h.stamp)
+            hist_add(hist, t > h.stamp ? t - h.stamp : 0,
+                     st->records - before);
+        st->commits++;
+        st->bytes += sizeof(h) + h.len;
+        ship_ack_t ack = {h.lsn, 0, 0};
+        ok = ok && send_all(fd, &ack, sizeof(ack));
+    }
+    if (ok) {
+        ship_ack_t ack = {h.lsn, queue_digest(q), 1};
+        ok = h.kind == SHIP_END && send_all(fd, &ack, sizeof(ack)) &&
+             ack.digest == h.stamp;
+    }
+    st->seconds = (now_ns() - start) / 1e9;
+    if (hist)
+        hist_percentiles(hist, st);
+    free(hist);
+    free(buf);
+    return ok;
+}
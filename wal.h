@@ -0,0 +1,130 @@
+#ifndef LAB0_WAL_H
+#define LAB0_WAL_H
+
+/*
+ * Write-ahead log of the changes made to a queue, see q_log.
+ * Each change appends a compact record to a buffer in memory. A group
+ * commit thread writes the buffer out as one checksummed frame and fsyncs
+ * the log once interval_us microseconds have passed since the oldest record
+ * of the buffer was appended, or once batch records are waiting, whichever
+ * comes first. A checkpoint writes a snapshot of the queue next to the log,
+ * in the file named after the log with ".snap" appended, and starts the log
+ * over. Opening a log recovers the queue from the snapshot and whatever
+ * complete frames follow it in the log.
+ *
+ * A log can also ship its frames, once committed, to a follower at the
+ * other end of a socket, which applies them to a replica of the queue, see
+ * wal_ship and wal_follow. A log opened without a path only ships.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "queue.h"
+
+/* Kinds of records, each redoing the queue function of the same name */
+typedef enum {
+    WAL_INSERT_HEAD = 1, /* String */
+    WAL_INSERT_TAIL,     /* String */
+    WAL_REMOVE_HEAD,     /* Argument is the number of elements removed */
+    WAL_REVERSE,
+    WAL_SORT,
+    WAL_SORT_TOPK,     /* Argument is k */
+    WAL_UNIQUE,        /* Argument is keep_first */
+    WAL_REMOVE_VALUE,  /* String */
+    WAL_REMOVE_AT,     /* Argument is the index */
+    WAL_INSERT_AT,     /* Argument is the index, and string */
+    WAL_INSERT_SORTED, /* String */
+    WAL_INSERT_TTL,    /* Argument is the time to live, and string */
+    WAL_EXPIRE,        /* Argument is the time now */
+    WAL_DROP_TTL,      /* Deadlines dropped as q_concat or q_split do */
+} wal_op_t;
+
+/* Counters of a log, see wal_stats */
+typedef struct {
+    uint64_t records; /* Appended since the log got opened */
+    uint64_t commits; /* Frames written and synced */
+    uint64_t bytes;   /* Bytes of frames written */
+    uint64_t recovered; /* Records replayed when opening */
+    uint64_t shipped;   /* Last record sent to the follower */
+    uint64_t acked;     /* Last record the follower applied */
+    uint64_t max_lag;   /* Most records sent but not yet applied */
+    double seconds;     /* Since the log got opened */
+    /* Microseconds from appending records until they were synced */
+    double p50, p90, p99, p999, max;
+} wal_stats_t;
+
+/*
+ * Open the log at path, creating it if there is none, replay its snapshot
+ * and records into empty queue q, and start its group commit thread.
+ * If path is NULL, the log keeps no file, q may have elements, and records
+ * only get shipped.
+ * Return NULL if could not read or create the log, or allocate space.
+ */
+wal_t *wal_open(const char *path, queue_t *q, long interval_us, size_t batch);
+
+/*
+ * Commit all records, stop the group commit thread and free the log.
+ * Return false if any record could not be made durable.
+ * No effect if w is NULL
+ */
+bool wal_close(wal_t *w);
+
+/*
+ * Append a record of kind op to the log, return its sequence number, or 0 if
+ * could not allocate space, which makes the log fail from then on.
+ */
+uint64_t wal_append(wal_t *w, wal_op_t op, long arg, const char *s);
+
+/*
+ * Wait until the record numbered lsn, and all before it, are durable.
+ * If now is true, commit them right away rather than waiting for the batch.
+ * Return false if the log failed to write them.
+ */
+bool wal_commit(wal_t *w, uint64_t lsn, bool now);
+
+/*
+ * Commit all records, then replace the snapshot of the log with one of q and
+ * start the log over.
+ * Return false if the log failed or keeps no file, if q has elements with
+ * deadlines, which snapshots do not keep, or if could not write the snapshot.
+ */
+bool wal_checkpoint(wal_t *w, queue_t *q);
+
+/* Fill st with the counters of the log */
+void wal_stats(wal_t *w, wal_stats_t *st);
+
+/*
+ * Commit all records, send a snapshot of q, the queue w records, to the
+ * follower at the other end of socket fd, then ship it every frame committed
+ * from now on. The log owns fd from then on.
+ * Return false if already shipping, if q has elements with deadlines, or if
+ * could not send the snapshot.
+ */
+bool wal_ship(wal_t *w, int fd, queue_t *q);
+
+/*
+ * Commit all records, tell the follower to stop, wait until it applied
+ * everything and close its socket.
+ * Return false if the follower went away or its replica differs from q.
+ */
+bool wal_unship(wal_t *w, queue_t *q);
+
+/*
+ * Apply what the log at the other end of socket fd ships into empty queue q,
+ * acknowledging each frame, until the log stops shipping.
+ * Fill st with the records, frames and bytes received, and with how many
+ * microseconds records took from being appended to the log until applied,
+ * which assumes both ends share the monotonic clock of one host.
+ * Return false if the log went away or the replica differs from its queue.
+ */
+bool wal_follow(int fd, queue_t *q, wal_stats_t *st);
+
+/*
+ * Remove the log at path and its snapshot.
+ * Return false if neither existed.
+ */
+bool wal_unlink(const char *path);
+
+#endif /* LAB0_WAL_H */
@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "wsdeque.h"
+
+#define WS_INITIAL_SIZE 64
+
+static ws_array_t *ws_array_new(size_t size)
+{
+    ws_array_t *a = malloc(sizeof(ws_array_t) + size * sizeof(a->slots[0]));
+    if (!a)
+        return NULL;
+    a->size = size;
+    a->prev = NULL;
+    return a;
+}
+
+/* Slots are ordered by the accesses to top and bottom around them */
+static inline list_ele_t *ws_get(ws_array_t *a, long i)
+{
+    return atomic_load_explicit(&a->slots[i & (a->size - 1)],
+                                memory_order_relaxed);
+}
+
+static inline void ws_put(ws_array_t *a, long i, list_ele_t *e)
+{
+    atomic_store_explicit(&a->slots[i & (a->size - 1)], e,
+                          memory_order_relaxed);
+}
+
+wsdeque_t *ws_new()
+{
+    wsdeque_t *ws = malloc(sizeof(wsdeque_t));
+    if (!ws)
+        return NULL;
+    ws_array_t *a = ws_array_new(WS_INITIAL_SIZE);
+    if (!a) {
+        free(ws);
+        return NULL;
+    }
+    atomic_init(&ws->top, 0);
+    atomic_init(&ws->bottom, 0);
+    atomic_init(&ws->array, a);
+    return ws;
+}
+
+/* Free element e, copying its string to *sp first if sp is non-NULL */
+static void ws_release(list_ele_t *e, char *sp, size_t bufsize)
+{
+    if (sp && bufsize) {
+        strncpy(sp, e->value, bufsize - 1);
+        sp[bufsize - 1] = '\0';
+    }
+    free(e->value);
+    free(e);
+}
+
+void ws_free(wsdeque_t *ws)
+{
+    if (!ws)
+        return;
+    ws_array_t *a = atomic_load_explicit(&ws->array, memory_order_relaxed);
+    long t = atomic_load_explicit(&ws->top, memory_order_relaxed);
+    long b = atomic_load_explicit(&ws->bottom, memory_order_relaxed);
+    for (long i = t; i < b; i++)
+        ws_release(ws_get(a, i), NULL, 0);
+    while (a) {
+        ws_array_t *prev = a->prev;
+        free(a);
+        a = prev;
+    }
+    free(ws);
+}
+
+bool ws_push(wsdeque_t *ws, char *s)
+{
+    if (!ws)
+        return false;
+    list_ele_t *e = malloc(sizeof(list_ele_t));
+    if (!e)
+        return false;
+    e->value = strdup(s);
+    if (!e->value) {
+        free(e);
+        return false;
+    }
+    e->next = NULL;
+
+    long b = atomic_load_explicit(&ws->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&ws->top, memory_order_acquire);
+    ws_array_t *a = atomic_load_explicit(&ws->array, memory_order_relaxed);
+    if (b - t > (long) a->size - 1) {
+        /* Full, so copy elements into an array twice as large */
+        ws_array_t *bigger = ws_array_new(2 * a->size);
+        if (!bigger) {
+            free(e->value);
+            free(e);
+            return false;
+        }
+        for (long i = t; i < b; i++)
+            ws_put(bigger, i, ws_get(a, i));
+        bigger->prev = a;
+        atomic_store_explicit(&ws->array, bigger, memory_order_release);
+        a = bigger;
+    }
+    ws_put(a, b, e);
+    atomic_store_explicit(&ws->bottom, b + 1, memory_order_release);
+    return true;
+}
+
+bool ws_pop(wsdeque_t *ws, char *sp, size_t bufsize)
+{
+    if (!ws)
+        return false;
+    long b = atomic_load_explicit(&ws->bottom, memory_order_relaxed) - 1;
+    ws_array_t *a = atomic_load_explicit(&ws->array, memory_order_relaxed);
+    atomic_store_explicit(&ws->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&ws->top, memory_order_relaxed);
+    if (t > b) {
+        /* Empty */
+        atomic_store_explicit(&ws->bottom, b + 1, memory_order_release);
+        return false;
+    }
+    list_ele_t *e = ws_get(a, b);
+    if (t == b) {
+        /* Last element, which thieves may be after as well */
+        bool won = atomic_compare_exchange_strong_explicit(
+            &ws->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&ws->bottom, b + 1, memory_order_release);
+        if (!won)
+            return false;
+    }
+    ws_release(e, sp, bufsize);
+    return true;
+}
+
+ws_steal_t ws_steal(wsdeque_t *ws, char *sp, size_t bufsize)
+{
+    if (!ws)
+        return WS_EMPTY;
+    long t = atomic_load_explicit(&ws->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&ws->bottom, memory_order_acquire);
+    if (t >= b)
+        return WS_EMPTY;
+    ws_array_t *a = atomic_load_explicit(&ws->array, memory_order_acquire);
+    list_ele_t *e = ws_get(a, t);
+    if (!atomic_compare_exchange_strong_explicit(
+            &ws->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+        return WS_RETRY;
+    ws_release(e, sp, bufsize);
+    return WS_STOLEN;
+}
+
+size_t ws_size(wsdeque_t *ws)
+{
+    if (!ws)
+        return 0;
+    long b = atomic_load_explicit(&ws->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&ws->top, memory_order_relaxed);
+    return b > t ? b - t : 0;
+}
@@ -0,0 +1,84 @@
+#ifndef LAB0_WSDEQUE_H
+#define LAB0_WSDEQUE_H
+
+/*
+ * Work-stealing deque after Chase and Lev, in the form given for weak memory
+ * models by Le, Pop, Cohen and Zappa Nardelli.
+ * Its owner thread pushes and pops elements at the bottom without locks,
+ * while other threads steal them from the top with a compare-and-swap on
+ * the top index. Elements live in a circular array of list element pointers
+ * which the owner doubles when full; old arrays are kept until ws_free, as
+ * thieves may still read from them.
+ * Strings are copied in and out, and elements freed, as by q_insert_tail
+ * and q_remove_head.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+typedef struct WSARRAY {
+    size_t size; /* Power of 2 */
+    struct WSARRAY *prev; /* Array replaced by this one, or NULL */
+    _Atomic(list_ele_t *) slots[];
+} ws_array_t;
+
+typedef struct {
+    _Alignas(64) atomic_long top; /* Next element to steal */
+    _Alignas(64) atomic_long bottom; /* Next free slot of the owner */
+    _Atomic(ws_array_t *) array;
+} wsdeque_t;
+
+/* Outcome of ws_steal */
+typedef enum {
+    WS_EMPTY,  /* Nothing to steal */
+    WS_STOLEN, /* Took the top element */
+    WS_RETRY,  /* Lost a race with the owner or another thief */
+} ws_steal_t;
+
+/*
+ * Create empty deque.
+ * Return NULL if could not allocate space.
+ */
+wsdeque_t *ws_new();
+
+/*
+ * Free all storage used by deque, which no thread may be using.
+ * No effect if ws is NULL
+ */
+void ws_free(wsdeque_t *ws);
+
+/*
+ * Attempt to insert element at bottom of deque. Owner thread only.
+ * Return true if successful.
+ * Return false if ws is NULL or could not allocate space.
+ */
+bool ws_push(wsdeque_t *ws, char *s);
+
+/*
+ * Attempt to remove element from bottom of deque, last in first out.
+ * Owner thread only.
+ * Return true if successful.
+ * Return false if ws is NULL or empty, or a thief took the last element.
+ * If sp is non-NULL and an element is removed, copy the removed string to *sp
+ * (up to a maximum of bufsize-1 characters, plus a null terminator.)
+ */
+bool ws_pop(wsdeque_t *ws, char *sp, size_t bufsize);
+
+/*
+ * Attempt to remove element from top of deque, first in first out.
+ * Any thread may call it.
+ * If an element is stolen and sp is non-NULL, copy its string to *sp as
+ * ws_pop does.
+ */
+ws_steal_t ws_steal(wsdeque_t *ws, char *sp, size_t bufsize);
+
+/*
+ * Return number of elements in deque, which may be stale by the time it
+ * returns unless called by the owner with no thieves around.
+ */
+size_t ws_size(wsdeque_t *ws);
+
+#endif /* LAB0_WSDEQUE_H */
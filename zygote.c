@@ -0,0 +1,236 @@
+/* Fixtures which run scripts in forked copies of a saved qtest state */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "console.h"
+#include "report.h"
+#include "zygote.h"
+
+#define MAXFIXTURE 16
+#define MAXPATH 256
+
+/* A saved fixture, served by process pid over a pair of pipes */
+typedef struct {
+    char *name;
+    pid_t pid;
+    int req_fd;   /* Script names to run go to the fixture */
+    int reply_fd; /* Results of each run come back */
+} fixture_t;
+
+/* Result of running one script against a fixture */
+typedef struct {
+    int ok;
+    double elapsed;
+} fixture_result_t;
+
+static fixture_t fixtures[MAXFIXTURE];
+static int fixture_cnt = 0;
+
+/* Read or write exactly len bytes, retrying on short transfers */
+static bool read_all(int fd, void *buf, size_t len)
+{
+    for (char *p = buf; len > 0;) {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+    for (const char *p = buf; len > 0;) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/*
+ * Serve run requests from the parent until it closes the request pipe.
+ * Each script runs in a child forked from this process, which therefore
+ * starts from the state at the time of saving, shared copy-on-write.
+ */
+static void serve(int req_fd, int reply_fd)
+{
+    uint32_t len;
+    char path[MAXPATH];
+    while (read_all(req_fd, &len, sizeof(len)) && len < MAXPATH &&
+           read_all(req_fd, path, len)) {
+        path[len] = '\0';
+        fixture_result_t res = {0, 0};
+        double t;
+        init_time(&t);
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(req_fd);
+            close(reply_fd);
+            bool ok = run_script(path);
+            fflush(NULL);
+            _exit(ok ? 0 : 1);
+        }
+        int status;
+        if (pid > 0 && waitpid(pid, &status, 0) == pid)
+            res.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        res.elapsed = delta_time(&t);
+        if (!write_all(reply_fd, &res, sizeof(res)))
+            break;
+    }
+    _exit(0);
+}
+
+static fixture_t *find_fixture(char *name)
+{
+    for (int i = 0; i < fixture_cnt; i++)
+        if (!strcmp(fixtures[i].name, name))
+            return &fixtures[i];
+    return NULL;
+}
+
+/* Close the pipes of fixture f and wait for its process to exit */
+static void drop_fixture(fixture_t *f)
+{
+    close(f->req_fd);
+    close(f->reply_fd);
+    waitpid(f->pid, NULL, 0);
+    free_string(f->name);
+    *f = fixtures[--fixture_cnt];
+}
+
+static bool save_fixture(char *name)
+{
+    fixture_t *old = find_fixture(name);
+    if (old)
+        drop_fixture(old);
+    if (fixture_cnt == MAXFIXTURE) {
+        report(1, "ERROR: Cannot hold more than %d fixtures", MAXFIXTURE);
+        return false;
+    }
+
+    int req[2], reply[2];
+    if (pipe(req)) {
+        report(1, "ERROR: Could not create pipe");
+        return false;
+    }
+    if (pipe(reply)) {
+        close(req[0]);
+        close(req[1]);
+        report(1, "ERROR: Could not create pipe");
+        return false;
+    }
+
+    /* Keep buffered output from being written twice */
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* Let other fixtures see their request pipes closed by the parent */
+        for (int i = 0; i < fixture_cnt; i++) {
+            close(fixtures[i].req_fd);
+            close(fixtures[i].reply_fd);
+        }
+        close(req[1]);
+        close(reply[0]);
+        serve(req[0], reply[1]);
+    }
+    close(req[0]);
+    close(reply[1]);
+    if (pid < 0) {
+        close(req[1]);
+        close(reply[0]);
+        report(1, "ERROR: Could not fork fixture process");
+        return false;
+    }
+
+    fixture_t *f = &fixtures[fixture_cnt++];
+    f->name = strsave_or_fail(name, "save_fixture");
+    f->pid = pid;
+    f->req_fd = req[1];
+    f->reply_fd = reply[0];
+    report(2, "Saved fixture %s", name);
+    return true;
+}
+
+static bool run_fixture(char *name, char *script)
+{
+    fixture_t *f = find_fixture(name);
+    if (!f) {
+        report(1, "ERROR: No fixture named %s", name);
+        return false;
+    }
+
+    uint32_t len = strlen(script);
+    if (len >= MAXPATH) {
+        report(1, "ERROR: Script name %s is too long", script);
+        return false;
+    }
+
+    fixture_result_t res;
+    fflush(NULL);
+    if (!write_all(f->req_fd, &len, sizeof(len)) ||
+        !write_all(f->req_fd, script, len) ||
+        !read_all(f->reply_fd, &res, sizeof(res))) {
+        report(1, "ERROR: Lost fixture %s", name);
+        drop_fixture(f);
+        return false;
+    }
+
+    if (!res.ok) {
+        report(1, "ERROR: Script %s failed on fixture %s", script, name);
+        return false;
+    }
+    report(2, "Ran %s on fixture %s in %.3f s", script, name, res.elapsed);
+    return true;
+}
+
+static bool do_fixture(int argc, char *argv[])
+{
+    if (argc == 3 && !strcmp(argv[1], "save"))
+        return save_fixture(argv[2]);
+
+    if (argc == 3 && !strcmp(argv[1], "drop")) {
+        fixture_t *f = find_fixture(argv[2]);
+        if (!f) {
+            report(1, "ERROR: No fixture named %s", argv[2]);
+            return false;
+        }
+        drop_fixture(f);
+        return true;
+    }
+
+    if (argc >= 4 && !strcmp(argv[1], "run")) {
+        bool ok = true;
+        for (int i = 3; ok && i < argc; i++)
+            ok = run_fixture(argv[2], argv[i]);
+        return ok;
+    }
+
+    report(1, "Usage: %s save NAME | run NAME SCRIPT... | drop NAME", argv[0]);
+    return false;
+}
+
+static bool zygote_quit(int argc, char *argv[])
+{
+    while (fixture_cnt)
+        drop_fixture(&fixtures[0]);
+    return true;
+}
+
+void zygote_init()
+{
+    add_cmd("fixture", do_fixture,
+            " save|run|drop  | 'save NAME' forks a copy of the current state, "
+            "'run NAME SCRIPT...' runs each script in a fresh fork of it, "
+            "'drop NAME' ends it");
+    add_quit_helper(zygote_quit);
+}
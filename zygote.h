@@ -0,0 +1,13 @@
+#ifndef LAB0_ZYGOTE_H
+#define LAB0_ZYGOTE_H
+
+/*
+ * Fixtures of the fixture command: a process forked with the state of qtest
+ * at the time of saving, which forks again for each script run against it,
+ * so that every run starts from the same queue at no cost to rebuild it.
+ */
+
+/* Register the fixture command with the console */
+void zygote_init();
+
+#endif /* LAB0_ZYGOTE_H */